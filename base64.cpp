@@ -15,71 +15,356 @@
  * You should have received a copy of the GNU General Public License
  * along with this program. If not, see <https://www.gnu.org/licenses/>.
  */
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "base64.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BASE64_X86
+#include <immintrin.h>
+#endif
 
 static const char base64_table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
-char* base64Encode(const char* input) {
-    size_t input_len = strlen(input);
-    size_t output_len = 4 * ((input_len + 2) / 3) + 1;
-    char* encoded = (char*)malloc(output_len);
-    if (!encoded) {
-        perror("malloc");
-        return NULL;
+// the value of every character, 255 for those outside the alphabet (incl. the '=' padding)
+static const unsigned char base64_values[256] = {
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  62, 255, 255, 255,  63,
+     52,  53,  54,  55,  56,  57,  58,  59,  60,  61, 255, 255, 255, 255, 255, 255,
+    255,   0,   1,   2,   3,   4,   5,   6,   7,   8,   9,  10,  11,  12,  13,  14,
+     15,  16,  17,  18,  19,  20,  21,  22,  23,  24,  25, 255, 255, 255, 255, 255,
+    255,  26,  27,  28,  29,  30,  31,  32,  33,  34,  35,  36,  37,  38,  39,  40,
+     41,  42,  43,  44,  45,  46,  47,  48,  49,  50,  51, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+};
+
+/** the vector loops take as many whole blocks as they can & return the input they consumed, the scalar
+* code takes care of the rest & of the padding. A decode loop stops before a block with a character
+* outside the alphabet, so that the scalar code finds it.
+*/
+typedef size_t (*EncodeBulk)(const unsigned char *input, size_t len, char *output);
+typedef size_t (*DecodeBulk)(const char *input, size_t len, unsigned char *output);
+
+static size_t encodeBulkNone(const unsigned char *, size_t, char *) {
+    return 0;
+}
+
+static size_t decodeBulkNone(const char *, size_t, unsigned char *) {
+    return 0;
+}
+
+#ifdef BASE64_X86
+
+/** 12 bytes into 16 sextets, one in each byte (Muła & Lemire, "Faster Base64 Encoding and Decoding
+* using AVX2 Instructions")
+*/
+__attribute__((target("ssse3")))
+static inline __m128i encodeSplit128(__m128i in) {
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(t1, t3);
+}
+
+/** sextets to characters, by the offset of the range each of them falls in
+*/
+__attribute__((target("ssse3")))
+static inline __m128i encodeTranslate128(__m128i sextets) {
+    // 0..25 -> 13, 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12
+    __m128i range = _mm_subs_epu8(sextets, _mm_set1_epi8(51));
+    const __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), sextets);
+    range = _mm_or_si128(range, _mm_and_si128(upper, _mm_set1_epi8(13)));
+    const __m128i offsets = _mm_setr_epi8('a'-26, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52,
+        '0'-52, '0'-52, '0'-52, '+'-62, '/'-63, 'A', 0, 0);
+    return _mm_add_epi8(sextets, _mm_shuffle_epi8(offsets, range));
+}
+
+__attribute__((target("ssse3")))
+static size_t encodeBulkSsse3(const unsigned char *input, size_t len, char *output) {
+    size_t i = 0;
+    // a load takes 16 bytes of which 12 are used
+    for (; i+16 <= len; i += 12, output += 16) {
+        __m128i in = _mm_loadu_si128((const __m128i*)(input+i));
+        _mm_storeu_si128((__m128i*)output, encodeTranslate128(encodeSplit128(in)));
     }
+    return i;
+}
 
-    size_t i, j = 0;
-    for (i = 0; i < input_len; i += 3) {
-        unsigned char a = input[i];
-        unsigned char b = (i + 1 < input_len) ? input[i + 1] : 0;
-        unsigned char c = (i + 2 < input_len) ? input[i + 2] : 0;
+__attribute__((target("avx2")))
+static size_t encodeBulkAvx2(const unsigned char *input, size_t len, char *output) {
+    size_t i = 0;
+    if (len < 32)
+        return encodeBulkSsse3(input, len, output);
+    // the first block through SSSE3, the 32 byte loads start 4 bytes before the block from then on, so
+    // that each lane gets its 12 bytes at the same offset
+    i = encodeBulkSsse3(input, 16, output);
+    output += i/3*4;
+    const __m256i shuffle = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+        14, 15, 13, 14, 11, 12, 10, 11, 8, 9, 7, 8, 5, 6, 4, 5);
+    for (; i+28 <= len; i += 24, output += 32) {
+        __m256i in = _mm256_loadu_si256((const __m256i*)(input+i-4));
+        in = _mm256_shuffle_epi8(in, shuffle);
+        const __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+        const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        const __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+        const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        const __m256i sextets = _mm256_or_si256(t1, t3);
 
-        encoded[j++] = base64_table[(a >> 2) & 0x3F];
-        encoded[j++] = base64_table[((a << 4) | (b >> 4)) & 0x3F];
-        encoded[j++] = base64_table[((b << 2) | (c >> 6)) & 0x3F];
-        encoded[j++] = base64_table[c & 0x3F];
+        __m256i range = _mm256_subs_epu8(sextets, _mm256_set1_epi8(51));
+        const __m256i upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), sextets);
+        range = _mm256_or_si256(range, _mm256_and_si256(upper, _mm256_set1_epi8(13)));
+        const __m256i offsets = _mm256_setr_epi8('a'-26, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52,
+            '0'-52, '0'-52, '0'-52, '+'-62, '/'-63, 'A', 0, 0,
+            'a'-26, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52,
+            '0'-52, '0'-52, '0'-52, '+'-62, '/'-63, 'A', 0, 0);
+        _mm256_storeu_si256((__m256i*)output, _mm256_add_epi8(sextets, _mm256_shuffle_epi8(offsets, range)));
     }
+    return i+encodeBulkSsse3(input+i, len-i, output);
+}
+
+/** the characters are classified by their nibbles, a character is in the alphabet if the classes of its
+* high & low nibble don't overlap (see Muła & Lemire, the tables are those of aklomp/base64)
+*/
+__attribute__((target("ssse3")))
+static size_t decodeBulkSsse3(const char *input, size_t len, unsigned char *output) {
+    const __m128i lutLo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lutHi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lutRoll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask2F = _mm_set1_epi8(0x2f);
 
-    while (j > 0 && input_len % 3 != 0) {
-        encoded[--j] = '=';
-        input_len++;
+    size_t i = 0;
+    // a store writes 16 bytes of which 12 are used, keep it within the output of the whole input
+    for (; i+24 <= len; i += 16, output += 12) {
+        __m128i str = _mm_loadu_si128((const __m128i*)(input+i));
+        const __m128i hiNibbles = _mm_and_si128(_mm_srli_epi32(str, 4), mask2F);
+        const __m128i loNibbles = _mm_and_si128(str, mask2F);
+        const __m128i hi = _mm_shuffle_epi8(lutHi, hiNibbles);
+        const __m128i lo = _mm_shuffle_epi8(lutLo, loNibbles);
+        if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0)
+            break;
+        const __m128i eq2F = _mm_cmpeq_epi8(str, mask2F);
+        str = _mm_add_epi8(str, _mm_shuffle_epi8(lutRoll, _mm_add_epi8(eq2F, hiNibbles)));
+
+        // 4 sextets into 3 bytes
+        const __m128i pairs = _mm_maddubs_epi16(str, _mm_set1_epi32(0x01400140));
+        const __m128i words = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+        _mm_storeu_si128((__m128i*)output, _mm_shuffle_epi8(words, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1)));
     }
+    return i;
+}
 
-    encoded[output_len - 1] = '\0';
-    return encoded;
+__attribute__((target("avx2")))
+static size_t decodeBulkAvx2(const char *input, size_t len, unsigned char *output) {
+    const __m256i lutLo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m256i lutHi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lutRoll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i mask2F = _mm256_set1_epi8(0x2f);
+
+    size_t i = 0;
+    // a store writes 32 bytes of which 24 are used
+    for (; i+44 <= len; i += 32, output += 24) {
+        __m256i str = _mm256_loadu_si256((const __m256i*)(input+i));
+        const __m256i hiNibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4), mask2F);
+        const __m256i loNibbles = _mm256_and_si256(str, mask2F);
+        const __m256i hi = _mm256_shuffle_epi8(lutHi, hiNibbles);
+        const __m256i lo = _mm256_shuffle_epi8(lutLo, loNibbles);
+        if (!_mm256_testz_si256(lo, hi))
+            break;
+        const __m256i eq2F = _mm256_cmpeq_epi8(str, mask2F);
+        str = _mm256_add_epi8(str, _mm256_shuffle_epi8(lutRoll, _mm256_add_epi8(eq2F, hiNibbles)));
+
+        const __m256i pairs = _mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140));
+        __m256i words = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+        words = _mm256_shuffle_epi8(words, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+        // the 12 bytes of each lane next to each other
+        words = _mm256_permutevar8x32_epi32(words, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1));
+        _mm256_storeu_si256((__m256i*)output, words);
+    }
+    return i+decodeBulkSsse3(input+i, len-i, output);
 }
 
-char* base64Decode(const char* input) {
-    size_t input_len = strlen(input);
-    size_t output_len = input_len / 4 * 3;
-    if (input[input_len - 1] == '=') {
-        output_len--;
-        if (input[input_len - 2] == '=') {
-            output_len--;
+#endif
+
+typedef struct Base64Implementation {
+    const char *name;
+    EncodeBulk encode;
+    DecodeBulk decode;
+} Base64Implementation;
+
+static const Base64Implementation implementations[] = {
+#ifdef BASE64_X86
+    { "avx2", encodeBulkAvx2, decodeBulkAvx2 },
+    { "ssse3", encodeBulkSsse3, decodeBulkSsse3 },
+#endif
+    { "scalar", encodeBulkNone, decodeBulkNone },
+};
+
+static bool supported(const Base64Implementation *implementation) {
+#ifdef BASE64_X86
+    __builtin_cpu_init();
+    if (strcmp(implementation->name, "avx2") == 0)
+        return __builtin_cpu_supports("avx2");
+    if (strcmp(implementation->name, "ssse3") == 0)
+        return __builtin_cpu_supports("ssse3");
+#endif
+    return true;
+}
+
+// the fastest one the CPU runs, picked at the first use. Without optimization the intrinsics are not
+// inlined & the vector loops run slower than the scalar one, such a build stays scalar unless selected
+static const Base64Implementation *implementation = NULL;
+
+static const Base64Implementation *currentImplementation() {
+    if (!implementation) {
+        for (size_t n = 0; n < sizeof(implementations)/sizeof(implementations[0]); n++) {
+#ifndef __OPTIMIZE__
+            if (strcmp(implementations[n].name, "scalar") != 0)
+                continue;
+#endif
+            if (supported(&implementations[n])) {
+                implementation = &implementations[n];
+                break;
+            }
         }
     }
+    return implementation;
+}
 
-    char* decoded = (char*)malloc(output_len + 1);
-    if (!decoded) {
+const char *base64Implementation() {
+    return currentImplementation()->name;
+}
+
+bool base64SelectImplementation(const char *name) {
+    for (size_t n = 0; n < sizeof(implementations)/sizeof(implementations[0]); n++) {
+        if (strcmp(implementations[n].name, name) == 0 && supported(&implementations[n])) {
+            implementation = &implementations[n];
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t base64EncodedLen(size_t len) {
+    return (len+2)/3*4;
+}
+
+size_t base64DecodedLen(size_t len) {
+    return len/4*3;
+}
+
+size_t base64EncodeTo(const char* input, size_t input_len, char* output) {
+    const unsigned char *in = (const unsigned char*)input;
+    size_t i = currentImplementation()->encode(in, input_len, output);
+    size_t j = i/3*4;
+    for (; i+3 <= input_len; i += 3) {
+        unsigned int block = (in[i] << 16) | (in[i+1] << 8) | in[i+2];
+        output[j++] = base64_table[(block >> 18) & 0x3F];
+        output[j++] = base64_table[(block >> 12) & 0x3F];
+        output[j++] = base64_table[(block >> 6) & 0x3F];
+        output[j++] = base64_table[block & 0x3F];
+    }
+    if (i < input_len) {
+        unsigned int block = in[i] << 16;
+        if (i+1 < input_len)
+            block |= in[i+1] << 8;
+        output[j++] = base64_table[(block >> 18) & 0x3F];
+        output[j++] = base64_table[(block >> 12) & 0x3F];
+        output[j++] = i+1 < input_len ? base64_table[(block >> 6) & 0x3F] : '=';
+        output[j++] = '=';
+    }
+    return j;
+}
+
+bool base64DecodeTo(const char* input, size_t input_len, char* output, size_t* output_len) {
+    unsigned char *out = (unsigned char*)output;
+    size_t i = currentImplementation()->decode(input, input_len, out);
+    size_t j = i/4*3;
+    *output_len = j;
+    if (input_len % 4 != 0)
+        return false;
+    for (; i < input_len; i += 4) {
+        const unsigned char *in = (const unsigned char*)input+i;
+        unsigned char a = base64_values[in[0]];
+        unsigned char b = base64_values[in[1]];
+        unsigned char c = base64_values[in[2]];
+        unsigned char d = base64_values[in[3]];
+        if (((a | b | c | d) & 0xC0) == 0) {
+            out[j++] = (a << 2) | (b >> 4);
+            out[j++] = (b << 4) | (c >> 2);
+            out[j++] = (c << 6) | d;
+            *output_len = j;
+            continue;
+        }
+        // padding, only in the last block
+        if (i+4 != input_len || a == 255 || b == 255 || in[3] != '=' || (c == 255 && in[2] != '='))
+            return false;
+        out[j++] = (a << 2) | (b >> 4);
+        if (in[2] != '=')
+            out[j++] = (b << 4) | (c >> 2);
+        *output_len = j;
+    }
+    return true;
+}
+
+char* base64Encode(const char* input) {
+    return base64EncodeLen(input, strlen(input));
+}
+
+char* base64EncodeLen(const char* input, size_t input_len) {
+    char* encoded = (char*)malloc(base64EncodedLen(input_len) + 1);
+    if (!encoded) {
         perror("malloc");
         return NULL;
     }
+    encoded[base64EncodeTo(input, input_len, encoded)] = '\0';
+    return encoded;
+}
 
-    size_t i, j = 0;
-    for (i = 0; i < input_len; i += 4) {
-        unsigned char a = strchr(base64_table, input[i]) - base64_table;
-        unsigned char b = strchr(base64_table, input[i + 1]) - base64_table;
-        unsigned char c = strchr(base64_table, input[i + 2]) - base64_table;
-        unsigned char d = strchr(base64_table, input[i + 3]) - base64_table;
-
-        decoded[j++] = (a << 2) | (b >> 4);
-        decoded[j++] = (b << 4) | (c >> 2);
-        decoded[j++] = (c << 6) | d;
+char* base64Decode(const char* input) {
+    size_t input_len = strlen(input);
+    char* decoded = (char*)malloc(base64DecodedLen(input_len) + 1);
+    if (!decoded) {
+        perror("malloc");
+        return NULL;
     }
 
+    size_t output_len = 0;
+    if (!base64DecodeTo(input, input_len, decoded, &output_len)) {
+        free(decoded);
+        return NULL;
+    }
     decoded[output_len] = '\0';
     return decoded;
 }
+
+/** decode input_len characters (a multiple of 4, '=' padding only in the last block) into output,
+* which needs room for input_len/4*3 bytes. Returns the number of decoded bytes, output isn't terminated.
+* Used to decode a payload piece by piece while it is still arriving, stops at a character outside
+* the alphabet.
+*/
+size_t base64DecodeBlock(const char* input, size_t input_len, char* output) {
+    size_t output_len = 0;
+    base64DecodeTo(input, input_len, output, &output_len);
+    return output_len;
+}
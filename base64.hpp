@@ -19,7 +19,21 @@
 #ifndef __EDGERQ_BASE64_H__
 #define __EDGERQ_BASE64_H__
 
+#include <stddef.h>
+
+/** the work is done by SSSE3 or AVX2 loops where the CPU has them (picked at runtime), the scalar code
+* takes the rest & the padding
+*/
+size_t base64EncodedLen(size_t len); // characters for len bytes, padding included
+size_t base64DecodedLen(size_t len); // room the bytes of len characters need
+size_t base64EncodeTo(const char* input, size_t input_len, char* output); // output isn't terminated, returns its length
+bool base64DecodeTo(const char* input, size_t input_len, char* output, size_t* output_len); // false on a character outside the alphabet or misplaced padding, output_len is what got decoded anyway
+const char *base64Implementation(); // "avx2", "ssse3" or "scalar"
+bool base64SelectImplementation(const char *name); // false if the CPU doesn't have it, for benchmarks
+
 char* base64Encode(const char* input);
-char* base64Decode(const char* input);
+char* base64EncodeLen(const char* input, size_t input_len); // input may contain 0x00 bytes
+char* base64Decode(const char* input); // NULL if it isn't base64
+size_t base64DecodeBlock(const char* input, size_t input_len, char* output); // input_len must be a multiple of 4
 
 #endif
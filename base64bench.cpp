@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) [2023] Milan Kazarka
+ * Email: milan.kazarka.office@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/** base64 throughput of every implementation the CPU runs, encode in input bytes & decode in output bytes
+* per second, at payload sizes from a small request to a large response.
+*
+* usage: base64bench [milliseconds per case]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "base64.hpp"
+
+static double nowSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec+ts.tv_nsec/1e9;
+}
+
+int main(int argc, char **argv) {
+    double budget = (argc > 1 ? atoi(argv[1]) : 200)/1000.0;
+    const size_t sizes[] = { 1024, 64*1024, 1024*1024, 12*1024*1024 };
+    const char *implementations[] = { "scalar", "ssse3", "avx2" };
+    const size_t largest = sizes[sizeof(sizes)/sizeof(sizes[0])-1];
+
+    char *data = (char*)malloc(largest);
+    char *encoded = (char*)malloc(base64EncodedLen(largest));
+    char *decoded = (char*)malloc(largest);
+    srand(1);
+    for (size_t n = 0; n < largest; n++)
+        data[n] = (char)rand();
+
+    printf("%-8s %10s %12s %12s\n", "impl", "bytes", "encode GB/s", "decode GB/s");
+    for (size_t i = 0; i < sizeof(implementations)/sizeof(implementations[0]); i++) {
+        if (!base64SelectImplementation(implementations[i])) {
+            printf("%-8s not supported by this CPU\n", implementations[i]);
+            continue;
+        }
+        for (size_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++) {
+            size_t size = sizes[s];
+            size_t len = 0;
+
+            long rounds = 0;
+            double start = nowSeconds(), elapsed = 0;
+            do {
+                len = base64EncodeTo(data, size, encoded);
+                rounds++;
+            } while ((elapsed = nowSeconds()-start) < budget);
+            double encodeRate = (double)size*rounds/elapsed/1e9;
+
+            size_t decodedLen = 0;
+            rounds = 0;
+            start = nowSeconds();
+            do {
+                if (!base64DecodeTo(encoded, len, decoded, &decodedLen)) {
+                    printf("error: %s failed to decode\n", implementations[i]);
+                    return 1;
+                }
+                rounds++;
+            } while ((elapsed = nowSeconds()-start) < budget);
+            double decodeRate = (double)decodedLen*rounds/elapsed/1e9;
+
+            if (decodedLen != size || memcmp(decoded, data, size) != 0) {
+                printf("error: %s doesn't decode what it encoded\n", implementations[i]);
+                return 1;
+            }
+            printf("%-8s %10zu %12.2f %12.2f\n", implementations[i], size, encodeRate, decodeRate);
+        }
+    }
+
+    free(data);
+    free(encoded);
+    free(decoded);
+    return 0;
+}
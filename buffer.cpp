@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) [2023] Milan Kazarka
+ * Email: milan.kazarka.office@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "buffer.hpp"
+
+Buffer *newBuffer(size_t capacity) {
+    Buffer *buffer = (Buffer*)malloc(sizeof(Buffer));
+    if (!buffer)
+        return NULL;
+    // never without memory, so that data can always be terminated
+    buffer->data = (char*)malloc(capacity+1);
+    if (!buffer->data) {
+        free(buffer);
+        return NULL;
+    }
+    buffer->len = 0;
+    buffer->capacity = capacity;
+    buffer->refs = 1;
+    return buffer;
+}
+
+Buffer *adoptBuffer(char *data, size_t len) {
+    Buffer *buffer = (Buffer*)malloc(sizeof(Buffer));
+    if (!buffer)
+        return NULL;
+    buffer->data = data;
+    buffer->len = len;
+    buffer->capacity = len;
+    buffer->refs = 1;
+    return buffer;
+}
+
+bool reserveBuffer(Buffer *buffer, size_t capacity) {
+    if (capacity <= buffer->capacity)
+        return true;
+    // slices point into the data, it may only move while we are the only ones holding it
+    if (__sync_fetch_and_add(&buffer->refs, 0) > 1) {
+        printf("warning: can't grow a shared buffer\n");
+        return false;
+    }
+    size_t grown = buffer->capacity*2;
+    if (grown < capacity)
+        grown = capacity;
+    char *data = (char*)realloc(buffer->data, grown+1);
+    if (!data)
+        return false;
+    buffer->data = data;
+    buffer->capacity = grown;
+    return true;
+}
+
+bool appendBuffer(Buffer *buffer, const char *data, size_t len) {
+    if (!reserveBuffer(buffer, buffer->len+len))
+        return false;
+    memcpy(buffer->data+buffer->len, data, len);
+    buffer->len += len;
+    return true;
+}
+
+void retainBuffer(Buffer *buffer) {
+    __sync_add_and_fetch(&buffer->refs, 1);
+}
+
+void releaseBuffer(Buffer *buffer) {
+    if (buffer && __sync_sub_and_fetch(&buffer->refs, 1) == 0) {
+        free(buffer->data);
+        free(buffer);
+    }
+}
+
+Slice sliceBuffer(Buffer *buffer, size_t offset, size_t len) {
+    retainBuffer(buffer);
+    Slice slice;
+    slice.owner = buffer;
+    slice.data = buffer->data+offset;
+    slice.len = len;
+    return slice;
+}
+
+Slice adoptSlice(char *data, size_t len) {
+    Buffer *buffer = data ? adoptBuffer(data, len) : NULL;
+    if (!buffer) {
+        free(data);
+        return borrowSlice(NULL, 0);
+    }
+    Slice slice = sliceBuffer(buffer, 0, len);
+    releaseBuffer(buffer);
+    return slice;
+}
+
+Slice borrowSlice(const char *data, size_t len) {
+    Slice slice;
+    slice.owner = NULL;
+    slice.data = data;
+    slice.len = len;
+    return slice;
+}
+
+Slice textSlice(const char *text) {
+    return borrowSlice(text, text ? strlen(text) : 0);
+}
+
+Slice keepSlice(Slice slice) {
+    if (slice.owner) {
+        retainBuffer(slice.owner);
+        return slice;
+    }
+    Buffer *buffer = newBuffer(slice.len);
+    if (!buffer)
+        return borrowSlice(NULL, 0);
+    appendBuffer(buffer, slice.data, slice.len);
+    Slice kept = sliceBuffer(buffer, 0, slice.len);
+    releaseBuffer(buffer);
+    return kept;
+}
+
+Slice subSlice(Slice slice, size_t offset, size_t len) {
+    return borrowSlice(slice.data+offset, len);
+}
+
+void releaseSlice(Slice *slice) {
+    releaseBuffer(slice->owner);
+    slice->owner = NULL;
+    slice->data = NULL;
+    slice->len = 0;
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) [2023] Milan Kazarka
+ * Email: milan.kazarka.office@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BUFFER_HPP__
+#define __BUFFER_HPP__
+
+#include <stdlib.h>
+
+/** a message is measured once & handed on by reference instead of being copied & measured again at
+* every stage. A Buffer is refcounted memory, a Slice is a view of some of its bytes that holds a
+* reference to it, or a view of memory that it doesn't own (a literal, a receive buffer) & that has to
+* outlive it.
+*/
+
+typedef struct Buffer {
+    char *data;
+    size_t len; // bytes used
+    size_t capacity;
+    int refs; // the Buffer is freed once the last one is released
+} Buffer;
+
+typedef struct Slice {
+    Buffer *owner; // NULL if the slice borrows its bytes
+    const char *data;
+    size_t len;
+} Slice;
+
+Buffer *newBuffer(size_t capacity); // one reference, empty
+Buffer *adoptBuffer(char *data, size_t len); // takes over malloc'd data of len bytes
+bool reserveBuffer(Buffer *buffer, size_t capacity); // room for capacity bytes, grows geometrically
+bool appendBuffer(Buffer *buffer, const char *data, size_t len);
+void retainBuffer(Buffer *buffer);
+void releaseBuffer(Buffer *buffer);
+
+Slice sliceBuffer(Buffer *buffer, size_t offset, size_t len); // takes a reference to the buffer
+Slice adoptSlice(char *data, size_t len); // all of a buffer adopted from data, empty if data is NULL
+Slice borrowSlice(const char *data, size_t len);
+Slice textSlice(const char *text); // borrowed, measured with strlen once
+Slice keepSlice(Slice slice); // a slice that may outlive this one, copied only if it was borrowed
+Slice subSlice(Slice slice, size_t offset, size_t len); // borrowed, lives as long as slice does
+void releaseSlice(Slice *slice); // drops its reference, the slice is empty afterwards
+
+#endif
@@ -25,10 +25,12 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <unistd.h>
 #include <signal.h>
 #include <semaphore.h>
+#include <fcntl.h>
 #include <tinyxml2.h>
 #include "msggram.hpp"
 #include <string.h>
@@ -41,10 +43,40 @@
 #include "time.hpp"
 #include "common.hpp"
 #include <arpa/inet.h>
+#include <errno.h>
+
+#include <stdint.h>
+#include "uring.hpp"
+#include "http.hpp"
+#include "slotmap.hpp"
+#include "timerwheel.hpp"
+#include "uuidmap.hpp"
+#include "reassembly.hpp"
+#include "reliability.hpp"
+#include "pathmtu.hpp"
+#include "wire.hpp"
+#include "buffer.hpp"
+#include "envelope.hpp"
+#include "gramring.hpp"
+#include <poll.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <linux/filter.h>
+#define SC_ENGINE_EPOLL // the event-driven engine is only available where we have epoll
+#endif
+#ifdef HAVE_URING
+#define SC_ENGINE_URING
+#endif
 
 #define SC_MAX_REQUESTS 100 // maximum number of requests each service can hold at any time
 #define SC_TERMINATE_CHILD_PROCESSES
 
+#define ENGINE_FORK 0 // fork a child process for every accepted connection (default)
+#define ENGINE_EPOLL 1 // event loop threads own the accepted sockets, no process/thread per request
+#define ENGINE_URING 2 // same event loops driven through io_uring, incl. the UDP listener
+
 #define SEMAPHORE_PROTECTION
 
 pid_t parentPid;
@@ -54,10 +86,15 @@ sem_t *binarySemaphore; // Pointer to the semaphore
 
 // simulation
 #define MAX_UDP_MSG_SIZE 1024*64 // buffer for UDP read #todo - rename
-#define NREQUESTS 20 // maximum requests we are constructing out of segments at any given time
-int sockfd; // listener socket
+#define TIMER_TICK_MS 10 // resolution of the request, keep-alive & reassembly deadlines
+#define REAP_INTERVAL_MS 50 // ENGINE_FORK, how often we check if a child that responded has exited
+
+int sockfd = -1; // listener socket, not used when sharding (each shard has its own)
 struct sockaddr_in server_addr; // there is only a single UDP listeniner
-RQMSG rqmsgs[NREQUESTS];
+ReassemblyTable reassembly; // messages being put together out of the grams received on sockfd
+TimerWheel udpTimers; // reassembly deadlines of the UDP listener thread
+PathMtu pathMtu; // size of the grams sent to each SP
+Outbound outbound; // messages sent to the SPs until they acknowledge them
 // \simulation
 
 // this effectively limits the size of the 'id' in Request to int. We leave the Request id as 'long long'
@@ -68,31 +105,53 @@ volatile sig_atomic_t pipemsgid = 1;
 
 typedef struct Service {
     const char *id;
+    Uuid key; // id parsed, see servicesById
     int port;
     bool inaddrAny;
 
     int maxConnections;
     int requestBuffer;
     int requestTtl;
+    int keepAliveTimeout; // seconds an idle consumer connection is kept open for the next request, 0 = close after every response
+    int maxIdleConnections; // cap on the idle keep-alive connections of the service
+    volatile int idleConnections;
 
     char *pipeId; // #todo - change to a list of pipes when we'll add load balancing one service to multiple pipes
+    Uuid pipeKey; // pipeId parsed, only valid with pipeId set
 
-    LinkedList requests;
+    int listenerFd; // only used by the event-driven engine, serviceListener keeps its own
+
+    int nshards;
+    SlotMap *requests; // one table per shard, the fork engine only uses requests[0]
 } Service;
 
 typedef struct Setup {
     int listenerPort;
     bool inaddrAny;
+    int gramSize; // data in a gram sent to an SP, PATHMTU_AUTO to fit the path MTU of each SP
+    bool fec; // parity grams along with the grams to an SP that loses them
+    bool binaryWire; // take the binary frames when an SP offers them (see wire.hpp)
     int maxConnections;
     int requestBuffer;
     int requestTtl;
+    int keepAliveTimeout;
+    int maxIdleConnections;
+    int maxPartialMessages; // messages being reassembled out of grams at any given time
+    long long maxPartialMemory; // bytes their grams may take
+    int engine; // ENGINE_FORK, ENGINE_EPOLL or ENGINE_URING
+    int engineThreads; // number of event loops when running ENGINE_EPOLL or ENGINE_URING
+    bool sharding; // every event loop is a shard with its own listeners, UDP socket & tables
+    int nshards; // engineThreads when sharding, otherwise 1
     LinkedList services;
+    UuidMap servicesById; // built at config load & only read afterwards, no locking
     // #todo - this would be a good place for pipes
 } Setup;
 
 // #todo - we need to create a structure passed down to the child_process that would have both
 // the Service and Request - to be able to do things like lock the binary semaphore
 //
+struct EventLoop;
+
 typedef struct Request {
     long long id;
     volatile sig_atomic_t socket;
@@ -100,6 +159,11 @@ typedef struct Request {
     volatile sig_atomic_t pipe_fd[2]; // Pipe for parent<->child process communication
     volatile sig_atomic_t pipe_fd_rev[2]; // rename to Unix Pipes as we also have Service Pipes
     pthread_t threadId;
+    struct EventLoop *loop; // event loop owning 'socket' (ENGINE_EPOLL), NULL for forked requests
+    Service *service;
+    bool responded; // the response was handed over to the event loop, flag to remove
+    Timer deadline; // ENGINE_FORK, the TTL & once responded the reaping of the child process
+    long long start; // ENGINE_FORK, getMonotonicMillis() when the request was accepted
 } Request;
 
 typedef struct Child_ConnectionThreadData {
@@ -109,36 +173,49 @@ typedef struct Child_ConnectionThreadData {
 
 typedef struct ServiceDef { // #todo #refactoring
     char *id; // #todo - char or const char
+    Uuid key;
 } ServiceDef;
 
 typedef struct Pipe {
     const char *id; // Id or id?
+    Uuid key;
     struct sockaddr_in client_addr;
-    LinkedList serviceDefs;
+    UuidMap serviceDefs;
+    bool binary; // requests go as wire frames, negotiated when the SP asked for the pipe
 } Pipe;
 
 Setup globalSetup;
-LinkedList pipes;
+UuidMap pipes; // by Pipe key, its mutex also guards the pipes themselves
+TimerWheel requestTimers; // ENGINE_FORK, deadlines of the forked requests, run by the watchdog
 
-void processRequestList(LinkedList* list, bool lock);
 void closeSocket(int socket);
 int isSocketOpen(int socket_fd);
 void onNewConsumerConnection(int new_socket);
-void removeRequestsWithDuplicateSocket(LinkedList* list,int socket,bool lock);
-void invalidateRequestsWithDuplicateSocket(LinkedList* list,int socket,bool lock);
+void removeRequestsWithDuplicateSocket(SlotMap* list,int socket,bool lock);
+void invalidateRequestsWithDuplicateSocket(SlotMap* list,int socket,bool lock);
 void initializePipe(Pipe *pipe);
 void initializeService(ServiceDef *service);
-Pipe *pipeById(const char *id);
+Pipe *pipeById(const char *id, bool lock);
+Pipe *pipeByKey(const Uuid *key, bool lock);
 char* GenerateUUID();
 ServiceDef *serviceDefByIdInPipe(Pipe *pipe,const char *id); // #todo - evaluate if to only run on the one Pipe or check pipes - if there can be multiples
-Service *serviceByServiceDef(LinkedList* services, ServiceDef *serviceDef, bool lock);
-void debugRequests(LinkedList* list, bool lock);
+Service *serviceByServiceDef(ServiceDef *serviceDef);
+Service *serviceById(const char *id);
+Service *serviceByKey(const Uuid *key);
+void debugRequests(SlotMap* list, bool lock);
 bool loadConfigurationFile(const char *filename);
 bool runSetup(Setup *setup);
 bool runService(Service *service);
-bool initService(Service *service, const char *uuid, const char *name, int port);
+bool initService(Service *service, const char *uuid, const char *name, int port, int nshards);
+bool attachGramSteering(int fd, int nshards);
 void *watchdog(void *data);
 void *pipeListener(void *data);
+bool postCompletion(struct EventLoop *loop, Service *service, long long requestId, int socket, char *data, size_t len, bool last);
+void udpsendSocket(int fd, Slice message, const struct sockaddr_in *addr);
+int bindUdpSocket(Setup *setup, bool reusePort);
+void createUdpSocket(Setup *setup);
+void initReassembly(ReassemblyTable *reassembly, TimerWheel *timers, int nshards, int fd);
+void onDatagram(int fd, ReassemblyTable *reassembly, const char *buffer, unsigned int num_bytes, struct sockaddr_in client_addr);
 
 // Helper function to generate a new UUID
 char* GenerateUUID() {
@@ -180,13 +257,20 @@ char *mkrndstr(size_t length) { // const size_t length, supra
 }
 
 void initializePipe(Pipe *pipe) {
-    initLinkedList(&pipe->serviceDefs,LIST_USEMUTEX);
+    initUuidMap(&pipe->serviceDefs,4,UUIDMAP_USEMUTEX);
     pipe->id = GenerateUUID();
+    parseUuid(pipe->id,&pipe->key);
+    pipe->binary = false;
 }
 
 void initializeService(ServiceDef *service,const char *id) {
     service->id = (char*)malloc(strlen(id)+1);
     strcpy(service->id,id); // #todo - check if the const is needed in service
+    parseUuid(service->id,&service->key);
+}
+
+Pipe *pipeByKey(const Uuid *key, bool lock) {
+    return (Pipe*)uuidMapGet(&pipes,key,lock);
 }
 
 Pipe *pipeById(const char *id,bool lock) {
@@ -195,158 +279,164 @@ Pipe *pipeById(const char *id,bool lock) {
         verbose("warning: Id NULL\n");
         return NULL;
     }
-    if (lock)
-        lockList(&pipes);
-    Node* current = pipes.head;
-    while (current != NULL) {
-        Pipe *pipe = (Pipe*)current->data;
-        verbose("    pipe id(%s)\n",pipe->id);
-        if (strcmp(pipe->id,id)==0) {
-            unlockList(&pipes);
-            return pipe;
-        }
-        current = current->next;
-    }
-    if (lock)
-        unlockList(&pipes);
-    return NULL;
+    return (Pipe*)uuidMapGetText(&pipes,id,lock);
 }
 
 ServiceDef *serviceDefByIdInPipe(Pipe *pipe,const char *id) {
-    lockList(&pipe->serviceDefs);
-    Node* current = pipe->serviceDefs.head;
-    while (current != NULL) {
-        ServiceDef *service = (ServiceDef*)current->data;
-        if (strcmp(service->id,id)==0) {
-            unlockList(&pipe->serviceDefs);
-            return service;
+    return (ServiceDef*)uuidMapGetText(&pipe->serviceDefs,id,true);
+}
+
+Service *serviceByServiceDef(ServiceDef *serviceDef) {
+    return (Service*)uuidMapGet(&globalSetup.servicesById,&serviceDef->key,false);
+}
+
+Service *serviceById(const char *id) {
+    return (Service*)uuidMapGetText(&globalSetup.servicesById,id,false);
+}
+
+Service *serviceByKey(const Uuid *key) {
+    return (Service*)uuidMapGet(&globalSetup.servicesById,key,false);
+}
+
+bool writeAll(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, data, len);
+        if (written == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("write");
+            return false;
         }
-        current = current->next;
+        data += written;
+        len -= written;
     }
-    unlockList(&pipe->serviceDefs);
-    return NULL;
+    return true;
 }
 
-Service *serviceByServiceDef(LinkedList* services, ServiceDef *serviceDef, bool lock) {
-    if (lock)
-        lockList(services);
-    
-    Node* current = services->head;
-    while (current != NULL) {
-        Service *service = (Service*)current->data;
-        if (strcmp(service->id,serviceDef->id)==0) {
-            if (lock)
-                unlockList(services);
-            return service;
+/** writeAll for the pieces of iov in order, iov is used up in the process
+*/
+bool writevAll(int fd, struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t written = writev(fd, iov, iovcnt);
+        if (written == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("writev");
+            return false;
+        }
+        while (iovcnt > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char*)iov->iov_base+written;
+            iov->iov_len -= written;
         }
-        current = current->next;
     }
+    return true;
+}
 
-    if (lock)
-        unlockList(services);
-    
-    return NULL;
+bool readAll(int fd, char *data, size_t len) {
+    while (len > 0) {
+        ssize_t bytes_read = read(fd, data, len);
+        if (bytes_read == -1 && errno == EINTR)
+            continue;
+        if (bytes_read <= 0)
+            return false;
+        data += bytes_read;
+        len -= bytes_read;
+    }
+    return true;
+}
+
+bool sendAll(int socket, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t sent = send(socket, data, len, MSG_NOSIGNAL);
+        if (sent == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("send");
+            return false;
+        }
+        data += sent;
+        len -= sent;
+    }
+    return true;
 }
 
-void debugRequests(LinkedList* list, bool lock) {
+void debugRequests(SlotMap* list, bool lock) {
     verbose("debugRequests\n");
     if (lock)
-        lockList(list);
-    int index = 0;
-    Node* current = list->head;
-    while (current != NULL) {
-        if (current->data) {
-            Request *request = (Request*)current->data;
-            verbose("    node(%d) ts_ms(%lld) diff(%lld) pipe_fd[1]='%d'\n",index,current->timestamp_ms,getCurrentTimeMillis()-current->timestamp_ms,request->pipe_fd[1]);
+        lockSlotMap(list);
+    for (int index = 0; index < list->capacity; index++) {
+        Slot *slot = slotMapAt(list,index);
+        if (slot && slot->data) {
+            Request *request = (Request*)slot->data;
+            verbose("    node(%d) ts_ms(%lld) diff(%lld) pipe_fd[1]='%d'\n",index,slot->timestamp_ms,getCurrentTimeMillis()-slot->timestamp_ms,request->pipe_fd[1]);
 
         }
-        current = current->next;
-        index++;
     }
     if (lock)
-        unlockList(list);
+        unlockSlotMap(list);
 }
 
-/** always either lock here or upstream
+/** drop a forked request (ENGINE_FORK) from its table & make sure its child process is gone. A request
+* that has already been removed is left alone.
 */
-void processRequestList(LinkedList* list, bool lock) {
-
-    if (lock)
-        lockList(list);
-
-    long long currentTimeMs = getCurrentTimeMillis();
-    Node* current = list->head;
-    Node* previous = NULL;
-    bool remove = false;
-
-    while (current != NULL) {
-        remove = false;
-        // calculate the time elapsed since the node's timestamp
-        long long diffTimeMs = currentTimeMs - current->timestamp_ms;
-        long long threshold = globalSetup.requestTtl*1000; // 1s
-
-        if (diffTimeMs > threshold) {
-            verbose("WARNING: removing Request node due to timeout\n");
-            remove = true;
-        }
-
-        Request *request = (Request*)current->data;
-        if (request) {
-            if (request->pipe_fd[1]==-1) {
-                verbose("request->pipe_fd[1]==-1 <- flag to remove\n");
-                remove = true;
-            }
-        }
-
-        if (remove) {
-            // remove the node from the list
-            Node* nodeToRemove = current;
-            
-            if (previous == NULL) {
-                list->head = current->next;
-                current = list->head;
-            } else {
-                previous->next = current->next;
-                current = current->next;
-            }
-            
-            verbose("removing node(%lld) due to timeout or pipe closure\n",nodeToRemove->id);
+void expireRequest(Service *service, Request *request) {
+    SlotMap *list = service->requests;
 
-            if (request) {
+    lockSlotMap(list);
+    if (slotMapGet(list,request->id,false) != request) {
+        unlockSlotMap(list);
+        return;
+    }
+    // the generation of the slot changes so late responses don't match
+    slotMapRemove(list,request->id,false);
+    // a response arriving meanwhile might have rescheduled it
+    cancelTimer(&requestTimers,&request->deadline);
+    unlockSlotMap(list);
+
+    verbose("removing node(%lld) due to timeout or pipe closure\n",request->id);
+
+    if (request->pipe_fd[1]!=-1) {
+        write(request->pipe_fd[1], " ", 1);
+        close(request->pipe_fd[1]);
+        request->pipe_fd[1] = -1; // #todo - create separate function to invalidate a Request
+    }
 #ifdef SC_TERMINATE_CHILD_PROCESSES
-                if (request->pId!=-1) {
-                    verbose("sending SIGTERM to process %d\n",request->pId);
-                    if (request->pipe_fd[1]!=-1) {
-                        write(request->pipe_fd[1], " ", 1);
-                        close(request->pipe_fd[1]);
-                        request->pipe_fd[1] = -1;
-                    }
-                    kill(request->pId, SIGTERM); // Terminate the child process
-                    verbose("waiting for SIGTERM to complete\n");
-                    wait(NULL); // Wait for the child process to finish
-                    verbose("SIGTERM completed\n");
-                }
+    if (request->pId!=-1) {
+        verbose("sending SIGTERM to process %d\n",request->pId);
+        kill(request->pId, SIGTERM); // Terminate the child process
+        verbose("waiting for SIGTERM to complete\n");
+        waitpid(request->pId, NULL, 0); // Wait for the child process to finish
+        verbose("SIGTERM completed\n");
+    }
 #endif
-                if (request->pipe_fd[1]!=-1) {
-                    write(request->pipe_fd[1], " ", 1);
-                    close(request->pipe_fd[1]);
-                    request->pipe_fd[1] = -1; // #todo - create separate function to invalidate a Request
-                }
-            } else {
-                verbose("WARNING: found node without request\n");
-            }
 
-            free(request);
-            free(nodeToRemove);
+    free(request);
+}
 
-        } else {
-            previous = current;
-            current = current->next;
+/** the TTL of a forked request ran out, or it has been responded & we wait for its child to exit
+*/
+void onRequestDeadline(Timer *timer) {
+    Request *request = (Request*)timer->data;
+    Service *service = request->service;
+
+    if (request->pipe_fd[1]==-1 && request->pId!=-1) {
+        // responded, the child exits once it relayed the response
+        int pid = waitpid(request->pId, NULL, WNOHANG);
+        if (pid == request->pId || (pid == -1 && errno == ECHILD)) {
+            request->pId = -1;
+        } else if (getMonotonicMillis()-request->start < service->requestTtl*1000LL) {
+            addTimer(&requestTimers,&request->deadline,REAP_INTERVAL_MS);
+            return;
         }
+    } else if (request->pipe_fd[1]!=-1) {
+        verbose("WARNING: removing Request node due to timeout\n");
     }
-
-    if (lock)
-        unlockList(list);
+    expireRequest(service, request);
 }
 
 int isSocketOpen(int socket_fd) {
@@ -378,142 +468,90 @@ void invalidateRequest(Request *request) {
 /** We should make sure that we don't have the same socket descriptor in multiple requests.
 *   This should be done right after we receive a new connection & before we do any work on it.
 */
-void invalidateRequestsWithDuplicateSocket(LinkedList* list,int socket,bool lock) {
+void invalidateRequestsWithDuplicateSocket(SlotMap* list,int socket,bool lock) {
     if (lock)
-        lockList(list);
+        lockSlotMap(list);
 
-    Node* current = list->head;
-    while (current != NULL) {
-        Request *request = (Request*)current->data;
+    for (int index = 0; index < list->capacity; index++) {
+        Slot *current = slotMapAt(list,index);
+        Request *request = current ? (Request*)current->data : NULL;
         if (request) {
             if (request->socket==socket) {
                 // we assume that the one passed is the open one
                 request->socket = -1;
             }
         }
-        current = current->next;
     }
 
     if (lock)
-        unlockList(list);
+        unlockSlotMap(list);
 }
 
-void removeRequestsWithDuplicateSocket(LinkedList* list,int socket,bool lock) {
+void removeRequestsWithDuplicateSocket(SlotMap* list,int socket,bool lock) {
     if (lock)
-        lockList(list);
+        lockSlotMap(list);
 
-    Node* current = list->head;
-    Node* previous = NULL;
-
-    while (current != NULL) {
-        
-        Request *request = (Request*)current->data;
-        if (request->socket==socket) {
-            // remove the node from the list
-            Node* nodeToRemove = current;
-            
-            if (previous == NULL) {
-                list->head = current->next;
-                current = list->head;
-            } else {
-                previous->next = current->next;
-                current = current->next;
-            }
-            
+    for (int index = 0; index < list->capacity; index++) {
+        Slot *current = slotMapAt(list,index);
+        Request *request = current ? (Request*)current->data : NULL;
+        if (request && request->socket==socket) {
+            slotMapRemove(list,slotMapHandle(list,index),false);
             free(request);
-            free(nodeToRemove);
-        } else {
-            previous = current;
-            current = current->next;
         }
     }
 
     if (lock)
-        unlockList(list);
+        unlockSlotMap(list);
 }
 
 /**
 * #todo - change from using a binary semaphore for locking to posix mutex as we should
 * not be calling this function from child processes anyway
-*
-* #todo - set the addrlen here instead of passing it possibly
 */
-void udpsend(const char *message, const struct sockaddr_in *addr, int addrlen) {
-    verbose("udpsend message(%s)\n",message);
+void udpsend(Slice message, const struct sockaddr_in *addr) {
+    udpsendSocket(sockfd,message,addr);
+}
+
+/** same as udpsend, through a specific UDP socket (a shard's own socket when sharding)
+*/
+void udpsendSocket(int fd, Slice message, const struct sockaddr_in *addr) {
+    verbose("udpsend message(%.*s)\n",isWireFrame(message.data,message.len) ? 6 : (int)message.len,isWireFrame(message.data,message.len) ? "binary" : message.data);
 
     if (getpid()!=parentPid) {
         verbose("warning: do not call udpsend from child process\n");
         return;
     }
 
-    int msgidcopy = msgid;
-
-    unsigned int gramsize = (64*1024)-1024;
-    unsigned int msglen = (unsigned int)strlen(message);
-    unsigned int countdown = msglen;
-    unsigned int size = gramsize;
-    unsigned int gramindex = 0;
-    unsigned int dataindex = 0;
-    unsigned int ngrams = 0;
-    unsigned int dataoffset = 0;
-
-    while(countdown!=0) {
-        if (countdown<size)
-            size = countdown;
-        countdown-=size;
-        ngrams++;
-    }
-    size = gramsize;
-    countdown = msglen;
-
-    while(countdown!=0) {
-        if (countdown<size)
-            size = countdown;
-
-        // #todo - change from just raw pointing to a position in data to using msggram.hpp - RQMSGRAW
-        unsigned int index = 0;
-        char *rqmsgraw = (char*)malloc(size+1024);
-        memcpy(rqmsgraw,&msgidcopy,sizeof(unsigned long long));
-        index+=sizeof(unsigned long long);
-        memcpy(rqmsgraw+index,&ngrams,sizeof(unsigned int));
-        index+=sizeof(unsigned int);
-        unsigned int thisindex = gramindex;
-        memcpy(rqmsgraw+index,&thisindex,sizeof(unsigned int));
-        index+=sizeof(unsigned int);
-        dataoffset = index;
-        memcpy(rqmsgraw+index,message+dataindex,size);
-        index+=size;
-        rqmsgraw[index]=0x00;
-
-        verbose("    sending msgid(%d) ngrams(%d) index(%d) data(%s) size(%d)\n",msgidcopy,ngrams,thisindex,rqmsgraw+dataoffset,index);
-
-        sem_wait(binarySemaphore);
-        
-        if (sendto(sockfd, rqmsgraw, index, 0, (struct sockaddr *)addr, addrlen) == -1) {
-            perror("sendto");
-
+    // a gram too large for the path fails as a whole, the message then goes again in smaller grams
+    // under a new msgid & the grams sent so far expire at the receiver
+    for (int attempt = 0; attempt < 3; attempt++) {
+        // every message gets its own id, parts of a request are sent as separate messages (the gram header carries 64 bits)
+        unsigned long long msgidcopy = (unsigned int)__sync_add_and_fetch(&msgid,1);
+
+        // shard sockets are only ever used by their own event loop
+        if (fd==sockfd)
+            sem_wait(binarySemaphore);
+        int error = sendMessage(&outbound,fd,addr,msgidcopy,message,gramPayload(&pathMtu,addr));
+        if (fd==sockfd)
             sem_post(binarySemaphore);
-
+        if (error == 0) {
+            verbose("udpsend finish\n");
+            return;
+        }
+        if (error != EMSGSIZE) {
+            errno = error;
+            perror("sendto");
             verbose("failed to send data\n");
             exit(EXIT_SUCCESS); // #todo - evaluate
-        } else {
-            
         }
-
-        sem_post(binarySemaphore);
-
-        free(rqmsgraw);
-
-        countdown-=size;
-        gramindex++;
-        dataindex+=size;
+        pathMtuExceeded(&pathMtu,addr);
     }
-    verbose("udpsend finish\n");
+    printf("warning: could not fit message into the path MTU, dropping it\n");
 }
 
 // do the same kind of segmentation as we do for UDP just for a pipe
 //
-void writePipe(int fd, char *message) {
+void writePipe(int fd, Slice message) {
     verbose("writePipe\n");
 
     int pipemsgidcopy = pipemsgid;
@@ -523,11 +561,20 @@ void writePipe(int fd, char *message) {
         Node* current = grams->head;
         while (current != NULL) {
             RQGRAM_HEADERDATA *headerdata = (RQGRAM_HEADERDATA*)current->data;
-            RQGRAM_HEADER *header = (RQGRAM_HEADER*)headerdata->data;
+            RQGRAM_HEADER *header = &headerdata->header;
+            // grams are larger than PIPE_BUF, so the writes aren't atomic & the reader needs the size
+            unsigned int gramlen = sizeof(RQGRAM_HEADER)+headerdata->data.len;
             verbose("SENDING MSG GRAM SIZE(%d) MSGID(%lld) INDEX(%d) NGRAMS(%d) \n",
-                headerdata->datalen,header->msgid,header->index,header->ngrams);
-            write(fd,headerdata->data,headerdata->datalen);
-            free(headerdata->data);
+                gramlen,header->msgid,header->index,header->ngrams);
+            // the size, the header & the piece of the message in one go, without putting them together first
+            struct iovec iov[3];
+            iov[0].iov_base = &gramlen;
+            iov[0].iov_len = sizeof(gramlen);
+            iov[1].iov_base = header;
+            iov[1].iov_len = sizeof(RQGRAM_HEADER);
+            iov[2].iov_base = (void*)headerdata->data.data;
+            iov[2].iov_len = headerdata->data.len;
+            writevAll(fd,iov,3);
             free(headerdata);
             current->data = NULL;
             current = current->next;
@@ -541,6 +588,28 @@ void writePipe(int fd, char *message) {
     verbose("udpsend finish\n");
 }
 
+/** wrap a request read from a consumer into the message we forward to the SP, a wire frame if the pipe
+* negotiated them. A request that isn't read in one go is forwarded in parts while reading, numbered from 0
+* with more="yes" on all but the last. The slice owns the message, it is empty if there is none.
+*/
+Slice requestEnvelope(Pipe *pipe, Service *service, long long requestId, const char *data, size_t len, int part, bool more) {
+    if (pipe->binary) {
+        unsigned char flags = 0;
+        if (part != 0 || more)
+            flags |= WIRE_FLAG_PART;
+        if (more)
+            flags |= WIRE_FLAG_MORE;
+        size_t size = 0;
+        char *frame = wireFrame(WIRE_KIND_REQUEST,flags,part,requestId,&pipe->key,&service->key,data,len,&size);
+        return adoptSlice(frame,size);
+    }
+
+    Slice message = requestEnvelopeXml(textSlice(pipe->id),textSlice(service->id),requestId,data,len,part,more);
+    if (!message.data)
+        printf("error: could not construct request\n");
+    return message; // release upstream
+}
+
 /** child process
 */
 void* child_ConnectionThread(void *arg) {
@@ -556,68 +625,71 @@ void* child_ConnectionThread(void *arg) {
 
     char buffer[service->requestBuffer];
 
-    valread = read(request->socket, buffer, service->requestBuffer-1);
-    buffer[valread] = 0x00;
-    verbose("read(%d) data(%s) from socket(%d)\n",valread,buffer,request->socket);
-
-    // the child process needs to forward the data through the UDP socket
-
+    // the pipe the service was routed through when we were forked
     Pipe *selectedPipe = NULL;
-    ServiceDef *selectedService = NULL;
-    Node* current = pipes.head;
-        while (current != NULL) {
-            selectedPipe = (Pipe*)current->data;
-            current = current->next;
-        }
-    // #todo
-    if (selectedPipe) {
-        current = selectedPipe->serviceDefs.head;
-        while (current != NULL) {
-            selectedService = (ServiceDef*)current->data;
-            current = current->next;
-        }
-    }
-    verbose("pipe(%s) service(%s)\n",selectedPipe->id,selectedService->id);
-
-    char *b64 = base64Encode(buffer);
-    if (!b64) {
-        // #todo - error
-        printf("error: base64Encode didn't return encoded data\n");
+    if (service->pipeId)
+        selectedPipe = pipeByKey(&service->pipeKey,false);
+    if (!selectedPipe) {
+        verbose("warning: no pipe assigned to service(%s)\n",service->id);
+        const char *response = "HTTP/1.1 502 Bad Gateway\r\nContent-Length: 27\r\nContent-Type: text/plain\r\n\r\nBad Gateway: Routing Error.";
+        sendAll(request->socket,response,strlen(response));
+        close(request->pipe_fd_rev[1]);
         return NULL;
     }
+    verbose("pipe(%s) service(%s)\n",selectedPipe->id,service->id);
+
+    // the child process needs to forward the data through the UDP socket, the body is forwarded in
+    // parts as we read it & the parent's pipeListener sends every part on until we close the pipe
+    HttpFraming framing;
+    initHttpFraming(&framing);
+    int part = 0;
+    bool more = true;
+    while (more) {
+        valread = read(request->socket, buffer, service->requestBuffer-1);
+        if (valread <= 0) {
+            verbose("consumer closed the connection before the request was complete\n");
+            break;
+        }
+        buffer[valread] = 0x00;
+        verbose("read(%d) data(%s) from socket(%d)\n",valread,buffer,request->socket);
 
-    unsigned int responseLen = strlen(b64)+1024;
-    char *response = (char*)malloc(responseLen); // #todo - 1024 is just an arbitrary number
+        httpFramingFeed(&framing,buffer,valread);
+        more = !httpFramingComplete(&framing);
 
-    snprintf(response,responseLen,"<?xml version=\"1.0\" encoding=\"UTF-8\"?><message><pipe_id>\"%s\"</pipe_id><services><service uuid=\"%s\"><request id=\"%lld\"><payload>%s</payload></request></service></services></message>\n",selectedPipe->id,selectedService->id,request->id,b64);
-    verbose("sending to pipe(%s)\n",response);
-    
-    writePipe(request->pipe_fd_rev[1],response);
+        Slice response = requestEnvelope(selectedPipe,service,request->id,buffer,valread,part++,more);
+        if (!response.data) {
+            // #todo - error
+            break;
+        }
+        verbose("sending to pipe(%.*s)\n",selectedPipe->binary ? 6 : (int)response.len,selectedPipe->binary ? "binary" : response.data);
+
+        writePipe(request->pipe_fd_rev[1],response);
 
-    free(b64);
-    free(response);
+        releaseSlice(&response);
+    }
+    cleanupHttpFraming(&framing);
+    close(request->pipe_fd_rev[1]);
 
     verbose("child_ConnectionThread finish\n");
 
     return NULL;
 }
 
-// just a silly watchdog
-// WARNING:
-// - not sure that this is safe if we don't take action / sync it up with creation of child processes
+/** ENGINE_FORK, expires the forked requests & reaps their children. Sleeps until the next deadline of
+* requestTimers is due.
+*/
 void *watchdog(void *data) {
     while(getpid()==parentPid) {
-        lockList(&globalSetup.services);
-
-        Node* current = globalSetup.services.head;
-        while (current != NULL) {
-            Service *service = (Service*)current->data;
-            processRequestList(&service->requests,true);
-            current = current->next;
-        }
-
-        unlockList(&globalSetup.services);
-        usleep(50000);
+        struct pollfd pfd;
+        pfd.fd = requestTimers.timerFd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        // without a timerfd we can't be woken up when a timer is added, poll the wheel instead
+        if (pfd.fd == -1)
+            poll(NULL, 0, REAP_INTERVAL_MS);
+        else if (poll(&pfd, 1, -1) == -1 && errno != EINTR)
+            perror("poll");
+        runTimers(&requestTimers);
     }
     return NULL;
 }
@@ -629,14 +701,15 @@ typedef struct PipeListener {
     //struct sockaddr_in client_addr;
 } PipeListener;
 
-/** we just forward data that comes through this pipe through UDP
+/** we just forward data that comes through this pipe through UDP, message by message (a request read in
+* parts comes as several messages) until the child closes the pipe
 */
 void *pipeListener(void *data) { // #todo - make sure it is understood that this is a thread
     if (!data)
         return NULL;
 
     char buffer[MAX_UDP_MSG_SIZE];
-    char *completemsg = NULL;
+    Slice completemsg = borrowSlice(NULL,0);
     PipeListener *listener = (PipeListener*)data;
     RQMSG rqmsg;
     initializeRQMSG(&rqmsg);
@@ -645,7 +718,14 @@ void *pipeListener(void *data) { // #todo - make sure it is understood that this
 
     printf("listen on pipeFd(%d) in pipeListener\n",listener->pipeFd);
     while(1) {
-        ssize_t bytes_read = read(listener->pipeFd, buffer, sizeof(buffer));
+        // every gram is prefixed by its size, see writePipe
+        unsigned int gramlen = 0;
+        if (!readAll(listener->pipeFd, (char*)&gramlen, sizeof(gramlen)) || gramlen >= sizeof(buffer) ||
+            !readAll(listener->pipeFd, buffer, gramlen)) {
+            printf("    no more data\n");
+            break;
+        }
+        ssize_t bytes_read = gramlen;
         printf("    got data\n");
         
         // this should never happen as we should execute this only in the parent process
@@ -656,91 +736,75 @@ void *pipeListener(void *data) { // #todo - make sure it is understood that this
         //    return NULL;
         //}
         
-        if (bytes_read>0) {
-            buffer[bytes_read] = '\0';
-
-            // #todo - make this into a separate function
-
-            // put the data in the right format
-            RQMSGRAW *rqmsgraw = (RQMSGRAW*)malloc(sizeof(RQMSGRAW));
-            unsigned int index = 0;
-            memcpy(&rqmsgraw->msgid,buffer,sizeof(unsigned long long));
-            index+=sizeof(unsigned long long);
-            memcpy(&rqmsgraw->ngrams,buffer+index,sizeof(unsigned int));
-            index+=sizeof(unsigned int);
-            memcpy(&rqmsgraw->index,buffer+index,sizeof(unsigned int));
-            index+=sizeof(unsigned int);
-            unsigned int chunksize = bytes_read-index;
-            rqmsgraw->data = (char*)malloc(chunksize+1);
-            memcpy(rqmsgraw->data,buffer+index,chunksize);
-            rqmsgraw->data[chunksize]=0x00;
-            printf("in(%s) size(%d)\n",rqmsgraw->data,chunksize);
-
-            completemsg = NULL;
-            
-            if (rqmsg.ngrams==0) { // #todo - make this nicer, this is horrible
-                rqmsg.ngrams = rqmsgraw->ngrams;
-                rqmsg.msgid = rqmsgraw->msgid;
+        buffer[bytes_read] = '\0';
+
+        // #todo - make this into a separate function
+
+        // put the data in the right format
+        if (bytes_read < (ssize_t)sizeof(RQGRAM_HEADER)) {
+            printf("    E1\n");
+            break;
+        }
+        RQGRAM_HEADER header;
+        memcpy(&header,buffer,sizeof(header));
+        unsigned int chunksize = bytes_read-sizeof(header);
+
+        completemsg = borrowSlice(NULL,0);
+
+        // a single gram is sent on straight from the buffer, it is terminated above
+        unsigned int singlelen = 0;
+        const char *single = rqmsg.ngrams==0 ? singleGramData(NULL,NULL,buffer,gramlen,&singlelen) : NULL;
+        Slice outmsg = borrowSlice(single,singlelen);
+        if (!single) {
+            if (rqmsg.ngrams==0) {
+                rqmsg.msgid = header.msgid;
+                rqmsg.timestamp = time(NULL);
             }
 
-            printf("rqmsg ngrams(%d) rqmsgraw->index(%d)\n",rqmsg.ngrams,rqmsgraw->index);
-            if (rqmsg.grams[rqmsgraw->index].data) {
+            printf("rqmsg ngrams(%d) index(%d)\n",header.ngrams,header.index);
+            if (!addGramToRQMSG(&rqmsg,header.index,header.ngrams,buffer+sizeof(header),chunksize)) {
                 // something went wrong - there shouldn't be data at this index
-                //rqmsg = NULL; // #todo - what's the alternative
-                free(rqmsgraw->data);
-                free(rqmsgraw);
-                rqmsgraw->data = NULL;
                 printf("    E1\n");
                 break;
-            } else {
-                rqmsg.grams[rqmsgraw->index].size = chunksize;
-                rqmsg.grams[rqmsgraw->index].data = rqmsgraw->data; // freed in invalidateRQMSG
-                completemsg = dataFromRQMSG(&rqmsg);
             }
-            
-            printf("2\n");
+            // owned, so that keeping it for retransmission doesn't copy it
+            outmsg = completemsg = sliceFromRQMSG(&rqmsg);
 
-            //free(rqmsgraw->data); // this is correct
-            free(rqmsgraw); // only this and not ->data, since that is held in rqmsg nodes
-
-            if (!completemsg) {
+            if (!completemsg.data) {
                 printf("    msg not complete\n");
                 continue;
             }
+        }
 
-            printf("sending response through pipeListener\n");
-            //printHex(completemsg,index);
+        printf("sending response through pipeListener\n");
+        //printHex(completemsg,index);
 
-            // #todo - add lock once we add propper cleanup
-            
-            lockList(&pipes);
-            if (listener->service->pipeId) {
-                Pipe *assignedPipe = pipeById(listener->service->pipeId,false); // #todo - wouldn't survive pipe clean-up in parallel
-                if (assignedPipe) {
-                    printf("have assigned pipe\n");
-                    udpsend(completemsg,&assignedPipe->client_addr,sizeof(assignedPipe->client_addr));
-                } else {
-                    printf("warning: can't send udp message 01 - pipe not in list\n");
-                    exit(2);
-                }
+        // #todo - add lock once we add propper cleanup
+        
+        lockUuidMap(&pipes);
+        if (listener->service->pipeId) {
+            Pipe *assignedPipe = pipeByKey(&listener->service->pipeKey,false); // #todo - wouldn't survive pipe clean-up in parallel
+            if (assignedPipe) {
+                printf("have assigned pipe\n");
+                udpsend(outmsg,&assignedPipe->client_addr);
             } else {
-                printf("warning: can't send udp message 02 - pipe not assigned\n");
+                printf("warning: can't send udp message 01 - pipe not in list\n");
                 exit(2);
             }
-            unlockList(&pipes);
-
-            //udpsend(completemsg,&listener->client_addr,sizeof(listener->client_addr));
-            
-            printf("data forwarded through UDP\n");
-
-            printf("3\n");
-            close(listener->pipeFd); // we only transmit a single complete message here
-            listener->pipeFd = -1;
-            free(completemsg);
-            break;
         } else {
-            printf("    no more data\n");
-            break;
+            printf("warning: can't send udp message 02 - pipe not assigned\n");
+            exit(2);
+        }
+        unlockUuidMap(&pipes);
+        //udpsend(completemsg,&listener->client_addr);
+        
+        printf("data forwarded through UDP\n");
+
+        printf("3\n");
+        if (completemsg.data) {
+            releaseSlice(&completemsg);
+            // ready for the next part of the request
+            invalidateRQMSG(&rqmsg);
         }
     }
     invalidateRQMSG(&rqmsg);
@@ -752,18 +816,13 @@ void *pipeListener(void *data) { // #todo - make sure it is understood that this
     return NULL;
 }
 
-void *serviceListener(void *arg) {
-
-    printf("consumerListener\n");
-
-    Service *service = (Service*)arg;
-
-    int server_fd, new_socket, valread;
+/** create the TCP socket a service listens on for consumer connections, with reusePort every shard
+* gets its own listener & the kernel spreads the connections between them
+*/
+int createServiceSocket(Service *service, bool reusePort) {
+    int server_fd;
     struct sockaddr_in address;
     int opt = 1;
-    int addrlen = sizeof(address);
-    bool processNodes = true;
-    //const char *response = "Hello from server"; // was somehow responsible for corrupting memmory when spawning new child processes
 
     // Creating socket file descriptor
     if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
@@ -776,6 +835,10 @@ void *serviceListener(void *arg) {
         perror("setsockopt() command failed while creating listener");
         exit(EXIT_FAILURE);
     }
+    if (reusePort && setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt))) {
+        perror("setsockopt(SO_REUSEPORT) command failed while creating listener");
+        exit(EXIT_FAILURE);
+    }
 
     // Set the receive timeout
     struct timeval timeout;
@@ -783,6 +846,7 @@ void *serviceListener(void *arg) {
     timeout.tv_usec = 0;
     setsockopt(server_fd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
 
+    memset(&address, 0, sizeof(address));
     address.sin_family = AF_INET;
     if (service->inaddrAny)
         address.sin_addr.s_addr = INADDR_ANY;
@@ -802,6 +866,22 @@ void *serviceListener(void *arg) {
         exit(EXIT_FAILURE);
     }
 
+    return server_fd;
+}
+
+void *serviceListener(void *arg) {
+
+    printf("consumerListener\n");
+
+    Service *service = (Service*)arg;
+
+    int server_fd, new_socket, valread;
+    struct sockaddr_in address;
+    int addrlen = sizeof(address);
+    //const char *response = "Hello from server"; // was somehow responsible for corrupting memmory when spawning new child processes
+
+    server_fd = createServiceSocket(service,false);
+
     while(1) {
         if ((new_socket = accept(server_fd, (struct sockaddr *)&address, (socklen_t *)&addrlen)) < 0) {
             perror("accept");
@@ -817,12 +897,11 @@ void *serviceListener(void *arg) {
             printf("accept\n");
 
              // helps load balancing - but would be better done in a different way
-            while (nodesCount(&service->requests,true)>SC_MAX_REQUESTS) {
+            while (slotMapCount(service->requests,true)>SC_MAX_REQUESTS) {
                     printf("    too many running nodes, waiting\n");
-                    processRequestList(&service->requests,true);
-                    usleep(1000); 
+                    usleep(1000); // the watchdog removes them as they time out or finish
             }
-            usleep(50*nodesCount(&service->requests,true)); // #todo - dynamic throttling
+            usleep(50*slotMapCount(service->requests,true)); // #todo - dynamic throttling
             //usleep(1000);
 
             // this is used by the child process to identify the outgoing response when it is sent segmented
@@ -842,11 +921,8 @@ void *serviceListener(void *arg) {
             int pipe_fd[2];
             int pipe_fd_rev[2]; // reverse ? (this is to receive the request to forward to the service provider)
 
-            processNodes = true;
             while( pipe(pipe_fd) == -1 ) {
                 printf("    Warning: maximum amount of pipes reached\n");
-                processRequestList(&service->requests,true);
-                processNodes = false;
                 usleep(20000);
             }
 
@@ -857,48 +933,40 @@ void *serviceListener(void *arg) {
             setsockopt(pipe_fd[0], SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
             setsockopt(pipe_fd[1], SOL_SOCKET, SO_SNDTIMEO, (const char*)&timeout, sizeof(timeout));
 
-            if (processNodes)
-                processRequestList(&service->requests,true);
-
-            processNodes = true;
             while( pipe(pipe_fd_rev) == -1 ) {
                 printf("    Warning: maximum amount of pipes reached (b)\n");
-                processRequestList(&service->requests,true);
-                processNodes = false;
                 usleep(20000);
             }
 
             setsockopt(pipe_fd_rev[0], SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
             setsockopt(pipe_fd_rev[1], SOL_SOCKET, SO_SNDTIMEO, (const char*)&timeout, sizeof(timeout));
 
-            if (processNodes)
-                processRequestList(&service->requests,true);
-
-            Node* node;
-            node = getNode();
             //pthread_t thread_id;
             Request *request = (Request*)malloc(sizeof(Request));
             request->socket = -1;
+            request->loop = NULL;
+            request->service = service;
+            request->responded = false;
+            initTimer(&request->deadline,onRequestDeadline,request);
+            request->start = getMonotonicMillis();
             request->pipe_fd[0] = pipe_fd[0];
             request->pipe_fd[1] = pipe_fd[1];
             request->pipe_fd_rev[0] = pipe_fd_rev[0];
             request->pipe_fd_rev[1] = pipe_fd_rev[1];
             printf("    new pipes [0]=%d [1]=%d /rev/ [0]=%d [1]=%d\n",pipe_fd[0],pipe_fd[1],pipe_fd_rev[0],pipe_fd_rev[1]);
             request->pId = -1;
-            node->data = request;
             
             //
             // #todo - this is only here (and not just in the parent), because 
-            // we're copying the node's id into the request id
-            lockList(&service->requests);
-            addNode(&service->requests,node,false);
-            int nc = nodesCount(&service->requests,false);
+            // we're copying the slot handle into the request id
+            lockSlotMap(service->requests);
+            request->id = slotMapInsert(service->requests,request,false);
+            int nc = slotMapCount(service->requests,false);
             printf("nodes count(%d)\n",nc);
-            debugRequests(&service->requests,false);
+            debugRequests(service->requests,false);
             //unlockList(&list); // only unlock at the end in parent
             
             //usleep(nc*100); // #todo this might be contraproductive - a large part of the work on this is that more requests don't add to call-time linearly
-            request->id = node->id;
 
             // Spawn a new process
             pid_t pid = fork();
@@ -918,14 +986,15 @@ void *serviceListener(void *arg) {
                 close(new_socket);
                 close(pipe_fd[0]);
                 close(pipe_fd[1]);
-                removeNode(&service->requests,node,false);
-                unlockList(&service->requests);
+                slotMapRemove(service->requests,request->id,false);
+                free(request);
+                unlockSlotMap(service->requests);
 
             } else if (pid == 0) {
 
                 printf("###CHILD PROCESS fd[%d]\n",pipe_fd[0]);
 
-                unlockList(&service->requests);
+                unlockSlotMap(service->requests);
 
                 // Child process
                 //close(sockfd);
@@ -951,20 +1020,30 @@ void *serviceListener(void *arg) {
                     exit(EXIT_FAILURE);
                 }
 
-                char buffer[100];
-
-                // we keep the process up and running until we receive a response to forward from the server
-                ssize_t bytes_read = read(pipe_fd[0], buffer, sizeof(buffer));
-                if (bytes_read == -1) {
-                    perror("read");
-                    close(new_socket);
-                    pthread_join(request->threadId,NULL);
-                    printf("Child process EXIT_FAILURE\n");
-                    exit(EXIT_FAILURE); // #todo - evaluate
+                char buffer[4096];
+                size_t len = 0;
+                size_t total = 0;
+
+                // we keep the process up and running until we receive a response to forward from the server.
+                // It arrives in parts as the parent streams it, each prefixed by its length & a zero length
+                // marks the end (see deliverResponse). We can't wait for EOF, other children hold the pipe too.
+                while (readAll(pipe_fd[0], (char*)&len, sizeof(len)) && len > 0) {
+                    while (len > 0) {
+                        size_t chunk = len < sizeof(buffer) ? len : sizeof(buffer);
+                        if (!readAll(pipe_fd[0], buffer, chunk)) {
+                            perror("read");
+                            close(new_socket);
+                            pthread_join(request->threadId,NULL);
+                            printf("Child process EXIT_FAILURE\n");
+                            exit(EXIT_FAILURE); // #todo - evaluate
+                        }
+                        sendAll(new_socket, buffer, chunk);
+                        len -= chunk;
+                        total += chunk;
+                    }
                 }
-                printf("Child process received: (%s) size(%ld)\n", buffer,bytes_read);
+                printf("Child process relayed size(%ld)\n", total);
                 
-                send(new_socket, buffer, strlen(buffer), 0);
                 close(new_socket);
 
                 //close(pipe_fd[0]); // for some reason this might create problems ?
@@ -988,13 +1067,14 @@ void *serviceListener(void *arg) {
                 request->pipe_fd[0] = -1;
                 request->pipe_fd_rev[1] = -1;
                 request->socket = -1; //new_socket;
+                addTimer(&requestTimers,&request->deadline,service->requestTtl*1000LL);
 
                 close(pipe_fd[0]); // Close the read end of the pipe in the parent
                 close(pipe_fd_rev[1]); // reverse, since with this we will be reading
                 // the response should also be handled by the child - us forwarding it the response through a pipe
                 // - for demo/testing we can also not do that & just respond here
                 close(new_socket); // Close the socket in the parent process
-                unlockList(&service->requests); // assumed locked
+                unlockSlotMap(service->requests); // assumed locked
 
                 //close(pipe_fd_rev[1]); // reverse, since with this we will be reading
 
@@ -1011,250 +1091,1391 @@ void *serviceListener(void *arg) {
     return NULL;
 }
 
-typedef struct ParseResult {
-    char *message; // to release (#todo - make prettier)
-    //Pipe *assignedPipe;
-    char *assignedPipeId; // to release
-} ParseResult;
-
-/**
-* #todo - too long, too complicated, too many levels
+/** Event-driven engines (ENGINE_EPOLL, ENGINE_URING)
 *
-* #todo - decide if we lock pipes for this method since it returns either one or id in the implementation
+* Each EventLoop thread owns the consumer sockets it accepted. A request is read, wrapped and sent
+* through the UDP pipe straight from the loop. Responses matched in parseUDPXmlMessage are posted
+* back to the owning loop as a Completion, so no process or thread is created per request.
+*
+* ENGINE_URING drives the same loops through io_uring: multishot accept on the service listeners,
+* the response send linked with the close of the consumer socket, and UDP grams received into a
+* provided buffer ring (udpserver_uring_thread).
+*
+* With sharding every loop is a shard pinned to a core. It owns SO_REUSEPORT listeners for each
+* service, its own SO_REUSEPORT UDP socket with its own reassembly table & its own request table per
+* service, so nothing but the pipe list is shared. Request ids carry the shard index
+* (id*nshards+shard), a response that the kernel steers to a different shard is handed over to the
+* owning loop as a Completion like any other.
 */
-ParseResult *parseUDPXmlMessage(const char* xmlMessage) {
-        
-        verbose("ParseXmlMessage\n");
-        
-        ParseResult *parseResult = (ParseResult*)malloc(sizeof(ParseResult));
-        parseResult->message = NULL;
-        //parseResult->assignedPipe = NULL;
-        parseResult->assignedPipeId = NULL;
 
-        Pipe *assignedPipe = NULL;
-        
-        char *result = (char*)malloc(4096); // #todo
-        result[0] = 0x00;
+typedef struct Completion {
+    Service *service;
+    long long requestId;
+    int socket;
+    char *data; // (part of the) response to write to the consumer, NULL to just close the connection
+    size_t len;
+    bool last; // the response is complete after data, otherwise more parts follow (streaming)
+} Completion;
+
+#define CONNECTION_CONSUMER 0 // accepted consumer socket
+#define CONNECTION_LISTENER 1 // service listener, shared by all loops unless sharding
+#define CONNECTION_UDP 2 // the shard's own UDP socket
+#define CONNECTION_TIMER 3 // timerfd of the loop's TimerWheel
+
+typedef struct Connection {
+    int kind;
+    int socket;
+    struct EventLoop *loop;
+    Service *service;
+    long long requestId; // -1 until the request has been forwarded
+    HttpFraming framing; // tells us when the request is complete, until then it is forwarded in parts
+    int part; // next part of the request to forward
+    char *in; // request buffer, only needed by ENGINE_URING where the read completes asynchronously
+    char *out; // response being written
+    size_t outLen;
+    size_t outSent;
+    char *pending; // streamed response parts that arrived while out was being written
+    size_t pendingLen;
+    HttpFraming responseFraming; // tells us if the response lets us keep the connection open
+    char *leftover; // read past the end of the request (pipelining), handled once we responded
+    size_t leftoverLen;
+    bool idle; // keep-alive, waiting for the next request
+    Timer deadline; // the TTL of the request, or how long we wait for the next one while idle
+    bool outDone; // the whole response has been queued, close (or wait for the next request) once it is written
+    bool sending; // ENGINE_URING, a send of out is in flight
+    bool closing; // ENGINE_URING, the close of the socket is linked after that send
+    bool closed; // ENGINE_EPOLL, closed while handling an epoll_wait batch, freed after it
+    struct Connection *nextClosed;
+} Connection;
+
+typedef struct EventLoop {
+    int index;
+    int epollFd;
+    int wakeFd; // eventfd signaled when completions are posted
+    struct Uring *ring; // ENGINE_URING, NULL when running on epoll
+    int udpFd; // sharding, the shard's own UDP socket, otherwise -1 (the global sockfd is used)
+    ReassemblyTable *reassembly; // sharding, grams received on udpFd
+    struct UringBufRing *bufRing; // sharding with ENGINE_URING, buffers for grams received on udpFd
+    GramRing grams; // sharding with ENGINE_EPOLL, buffers for grams received on udpFd
+    struct msghdr udpMsg;
+    pthread_t threadId;
+    LinkedList completions;
+    Connection **connections; // accepted sockets indexed by descriptor
+    int nconnections;
+    TimerWheel timers; // deadlines of the connections & of the shard's reassembly, only touched by the loop
+    Connection *closed; // ENGINE_EPOLL, closed during the current epoll_wait batch, linked by nextClosed
+} EventLoop;
 
-        parseResult->message = result;
+EventLoop *eventLoops = NULL;
 
-        // Parse the XML document
-        tinyxml2::XMLDocument xmlDoc;
-        tinyxml2::XMLError error = xmlDoc.Parse(xmlMessage);
-        if (error != tinyxml2::XML_SUCCESS) {
+/** hand a response or a part of a streamed response (last false) over to the loop owning the consumer
+* socket. Takes ownership of data.
+*/
+bool postCompletion(EventLoop *loop, Service *service, long long requestId, int socket, char *data, size_t len, bool last) {
+#ifdef SC_ENGINE_EPOLL
+    if (!loop) {
+        if (data)
+            free(data);
+        return false;
+    }
 
-            //std::cerr << "Error parsing XML message: " << xmlDoc.ErrorStr() << std::endl;
-            verbose("error parsing XML\n");
+    Completion *completion = (Completion*)malloc(sizeof(Completion));
+    completion->service = service;
+    completion->requestId = requestId;
+    completion->socket = socket;
+    completion->data = data;
+    completion->len = len;
+    completion->last = last;
 
-            // #todo
-            //result.response = CreateErrorResponse(xmlDoc.ErrorStr());
-            
-            return parseResult;
-        }
+    Node *node = getNode();
+    node->data = completion;
+    addNode(&loop->completions,node,true);
 
-        strcat(result,"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
-        strcat(result,"<message>\n");
-        strcat(result,"<response>\n");
-        strcat(result,"<pipe_id>");
+    uint64_t one = 1;
+    write(loop->wakeFd,&one,sizeof(one));
+    return true;
+#else
+    if (data)
+        free(data);
+    return false;
+#endif
+}
 
-        // Check if the message has a pipe ID
-        const char* pipeId = NULL;
-        if (xmlDoc.FirstChildElement("message")->FirstChildElement("pipe_id"))
-            pipeId = xmlDoc.FirstChildElement("message")->FirstChildElement("pipe_id")->GetText();
+#ifdef SC_ENGINE_EPOLL
 
-        if (pipeId) {
+int setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1)
+        return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
 
-            verbose("have pipeId\n");
-            
-            assignedPipe = pipeById(pipeId,true);
-            if (!assignedPipe) {
-                verbose("didn't find pipe\n");
-            }
-            
-            parseResult->assignedPipeId = (char*)malloc(strlen(pipeId)+1);
-            strcpy(parseResult->assignedPipeId,pipeId);
+/** the loop is done with the request (responded, timed out or the consumer went away), remove it from the
+* table of its shard. Does nothing if it has been removed already.
+*/
+void releaseRequest(Service *service, long long requestId) {
+    SlotMap *requests = &service->requests[requestId % service->nshards];
+    lockSlotMap(requests);
+    Request *request = (Request*)slotMapGet(requests,requestId / service->nshards,false);
+    if (request)
+        slotMapRemove(requests,requestId / service->nshards,false);
+    unlockSlotMap(requests);
+    if (request)
+        free(request);
+}
 
-            // #todo - error response on pipeId not found
-            /**
-            // If no matching pipe route was found, return an error response
-            if (!assignedPipeRoute) {
-                std::string errorMessage = "Unknown pipe ID: ";
-                errorMessage += pipeId;
-                result.response = CreateErrorResponse(errorMessage);
-                return result;
-            }
-            */
-        } else {
-            // Create a new pipe route if necessary
-            if (xmlDoc.FirstChildElement("message")->FirstChildElement("request_pipe_id")) {
-                
-                verbose("create new pipe\n");
+void onConnectionDeadline(Timer *timer);
 
-                assignedPipe = (Pipe*)malloc(sizeof(Pipe));
-                initializePipe(assignedPipe);
+Connection *addConnection(EventLoop *loop, Service *service, int socket) {
+    if (socket >= loop->nconnections) {
+        int n = loop->nconnections;
+        while (n <= socket)
+            n *= 2;
+        loop->connections = (Connection**)realloc(loop->connections, n*sizeof(Connection*));
+        memset(loop->connections+loop->nconnections, 0, (n-loop->nconnections)*sizeof(Connection*));
+        loop->nconnections = n;
+    }
 
-                parseResult->assignedPipeId = (char*)malloc(strlen(assignedPipe->id)+1);
-                strcpy(parseResult->assignedPipeId,assignedPipe->id);
-                printf("have new pipeid(%s)\n",parseResult->assignedPipeId);
+    Connection *connection = (Connection*)malloc(sizeof(Connection));
+    connection->kind = CONNECTION_CONSUMER;
+    connection->socket = socket;
+    connection->loop = loop;
+    connection->service = service;
+    connection->requestId = -1;
+    initHttpFraming(&connection->framing);
+    connection->part = 0;
+    connection->in = NULL;
+    connection->out = NULL;
+    connection->outLen = 0;
+    connection->outSent = 0;
+    connection->pending = NULL;
+    connection->pendingLen = 0;
+    initHttpResponseFraming(&connection->responseFraming,false);
+    connection->leftover = NULL;
+    connection->leftoverLen = 0;
+    connection->idle = false;
+    initTimer(&connection->deadline,onConnectionDeadline,connection);
+    connection->outDone = false;
+    connection->sending = false;
+    connection->closing = false;
+    connection->closed = false;
+    connection->nextClosed = NULL;
+    loop->connections[socket] = connection;
+    return connection;
+}
 
-                Node *node = getNode(); // #todo - rename to initializeNode()
-                node->data = assignedPipe;
-                addNode(&pipes,node,true);
+/** forget the connection, the socket is expected to be closed already (or closing through io_uring). On
+* epoll a later event of the same batch may still point at it, so it is only marked closed & freed once
+* the batch is handled.
+*/
+void freeConnection(EventLoop *loop, Connection *connection) {
+    // with io_uring the descriptor may already have been reused by a newer connection
+    if (connection->socket < loop->nconnections && loop->connections[connection->socket] == connection)
+        loop->connections[connection->socket] = NULL;
+    if (connection->idle)
+        __sync_sub_and_fetch(&connection->service->idleConnections,1);
+    cancelTimer(&loop->timers,&connection->deadline);
+    if (connection->requestId != -1)
+        releaseRequest(connection->service,connection->requestId);
+    cleanupHttpFraming(&connection->framing);
+    cleanupHttpFraming(&connection->responseFraming);
+    if (connection->leftover)
+        free(connection->leftover);
+    if (connection->in)
+        free(connection->in);
+    if (connection->out)
+        free(connection->out);
+    if (connection->pending)
+        free(connection->pending);
+    if (!loop->ring) {
+        connection->closed = true;
+        connection->nextClosed = loop->closed;
+        loop->closed = connection;
+        return;
+    }
+    free(connection);
+}
 
-                //assignedPipeRoute = pipeRoute;
+/** free the connections closed while handling the last epoll_wait batch
+*/
+void freeClosedConnections(EventLoop *loop) {
+    while (loop->closed) {
+        Connection *connection = loop->closed;
+        loop->closed = connection->nextClosed;
+        free(connection);
+    }
+}
+
+void closeConnection(EventLoop *loop, Connection *connection) {
+    verbose("closeConnection socket(%d)\n",connection->socket);
+    if (!loop->ring)
+        epoll_ctl(loop->epollFd, EPOLL_CTL_DEL, connection->socket, NULL);
+    close(connection->socket);
+    freeConnection(loop, connection);
+}
+
+/** the whole response has been queued, both the request & the response let us keep the connection open
+*/
+bool reusableConnection(Connection *connection) {
+    return connection->service->keepAliveTimeout > 0 && !connection->pending &&
+        httpFramingKeepAlive(&connection->framing) && httpFramingKeepAlive(&connection->responseFraming);
+}
+
+/** the response has been written, get the connection ready for the next request of the consumer (keep-alive).
+* Returns false if it should be closed instead.
+*/
+bool keepConnection(EventLoop *loop, Connection *connection) {
+    Service *service = connection->service;
+    if (!reusableConnection(connection))
+        return false;
+
+    // with a pipelined request already waiting the connection doesn't become idle
+    if (!connection->leftover) {
+        if (__sync_add_and_fetch(&service->idleConnections,1) > service->maxIdleConnections) {
+            __sync_sub_and_fetch(&service->idleConnections,1);
+            verbose("loop(%d) too many idle connections for service(%s)\n",loop->index,service->id);
+            return false;
+        }
+        connection->idle = true;
+        addTimer(&loop->timers,&connection->deadline,service->keepAliveTimeout*1000LL);
+    }
+
+    connection->requestId = -1;
+    cleanupHttpFraming(&connection->framing);
+    initHttpFraming(&connection->framing);
+    connection->part = 0;
+    cleanupHttpFraming(&connection->responseFraming);
+    initHttpResponseFraming(&connection->responseFraming,false);
+    connection->outDone = false;
+    verbose("loop(%d) keeping socket(%d) open for the next request\n",loop->index,connection->socket);
+    return true;
+}
+
+/** an idle keep-alive connection waited too long for the next request, or the request ran out of its TTL
+*/
+void onConnectionDeadline(Timer *timer) {
+    Connection *connection = (Connection*)timer->data;
+    EventLoop *loop = connection->loop;
+
+    if (connection->idle) {
+        verbose("loop(%d) idle socket(%d) timed out\n",loop->index,connection->socket);
+        if (loop->ring)
+            shutdown(connection->socket, SHUT_RDWR); // the pending recv completes & closes the connection
+        else
+            closeConnection(loop, connection);
+        return;
+    }
+    if (connection->requestId == -1)
+        return;
+
+    verbose("loop(%d) request(%lld) timed out\n",loop->index,connection->requestId);
+    releaseRequest(connection->service,connection->requestId);
+    connection->requestId = -1; // late parts of the response don't match anymore
+    if (connection->sending) {
+        // io_uring still owns out, close once the send completes
+        connection->outDone = true;
+        if (connection->pending)
+            free(connection->pending);
+        connection->pending = NULL;
+        connection->pendingLen = 0;
+    } else if (loop->ring && !httpFramingComplete(&connection->framing)) {
+        shutdown(connection->socket, SHUT_RDWR); // still reading the request, the recv completes & closes
+    } else {
+        closeConnection(loop, connection);
+    }
+}
+
+/** queue (a part of) the response, out is written first & parts arriving meanwhile are collected in pending
+*/
+void queueConnection(Connection *connection, char *data, size_t len) {
+    httpFramingFeed(&connection->responseFraming, data, len);
+    if (!connection->out) {
+        connection->out = data;
+        connection->outLen = len;
+        connection->outSent = 0;
+        return;
+    }
+    connection->pending = (char*)realloc(connection->pending, connection->pendingLen+len);
+    memcpy(connection->pending+connection->pendingLen, data, len);
+    connection->pendingLen += len;
+    free(data);
+}
+
+/** out has been written, continue with what was collected in pending
+*/
+void nextConnectionOutput(Connection *connection) {
+    if (connection->out)
+        free(connection->out);
+    connection->out = connection->pending;
+    connection->outLen = connection->pendingLen;
+    connection->outSent = 0;
+    connection->pending = NULL;
+    connection->pendingLen = 0;
+}
+
+void resumeConnection(EventLoop *loop, Connection *connection);
+
+/** write as much of the pending response as the socket takes, the connection is closed or kept for the next
+* request once the whole response is written
+*/
+void flushConnection(EventLoop *loop, Connection *connection) {
+    while (connection->out) {
+        while (connection->outSent < connection->outLen) {
+            ssize_t sent = send(connection->socket, connection->out+connection->outSent,
+                connection->outLen-connection->outSent, MSG_NOSIGNAL);
+            if (sent == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    struct epoll_event event;
+                    event.events = EPOLLOUT;
+                    event.data.ptr = connection;
+                    epoll_ctl(loop->epollFd, EPOLL_CTL_MOD, connection->socket, &event);
+                    return;
+                }
+                if (errno == EINTR)
+                    continue;
+                perror("send");
+                closeConnection(loop, connection);
+                return;
+            }
+            connection->outSent += sent;
+        }
+        nextConnectionOutput(connection);
+    }
+
+    if (!connection->outDone) {
+        // streaming, wait for the next part of the response
+        struct epoll_event event;
+        event.events = 0;
+        event.data.ptr = connection;
+        epoll_ctl(loop->epollFd, EPOLL_CTL_MOD, connection->socket, &event);
+        return;
+    }
+    if (keepConnection(loop, connection))
+        resumeConnection(loop, connection);
+    else
+        closeConnection(loop, connection);
+}
+
+#ifdef SC_ENGINE_URING
+void uringSendResponse(EventLoop *loop, Connection *connection);
+#endif
+
+/** start writing connection->out to the consumer with whichever engine runs the loop
+*/
+void sendConnection(EventLoop *loop, Connection *connection) {
+#ifdef SC_ENGINE_URING
+    if (loop->ring) {
+        uringSendResponse(loop, connection);
+        return;
+    }
+#endif
+    flushConnection(loop, connection);
+}
+
+/** respond directly from the loop without going through the pipe
+*/
+void respondConnection(EventLoop *loop, Connection *connection, const char *response) {
+    queueConnection(connection, strdup(response), strlen(response));
+    connection->outDone = true;
+    sendConnection(loop, connection);
+}
+
+void acceptConnections(EventLoop *loop, Connection *listener) {
+    while (1) {
+        int new_socket = accept(listener->socket, NULL, NULL);
+        if (new_socket == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                perror("accept");
+            return;
+        }
+        setNonBlocking(new_socket);
+
+        Connection *connection = addConnection(loop, listener->service, new_socket);
+
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = connection;
+        if (epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, new_socket, &event) == -1) {
+            perror("epoll_ctl");
+            closeConnection(loop, connection);
+            continue;
+        }
+        verbose("loop(%d) accept socket(%d)\n",loop->index,new_socket);
+    }
+}
+
+/** forward (a part of) a request read from the consumer through the UDP pipe (same as child_ConnectionThread),
+* the Request is created with the first part. Returns false if we answered the consumer right away instead.
+*/
+bool forwardRequest(EventLoop *loop, Connection *connection, const char *buffer, size_t len, bool more) {
+    Service *service = connection->service;
+    int shard = globalSetup.sharding ? loop->index : 0;
+    SlotMap *requests = &service->requests[shard];
+    bool first = connection->requestId == -1;
+
+    if (first && slotMapCount(requests,true)>SC_MAX_REQUESTS/service->nshards) {
+        verbose("    too many running nodes, rejecting\n");
+        respondConnection(loop, connection, "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n");
+        return false;
+    }
+
+    lockUuidMap(&pipes);
+    Pipe *assignedPipe = NULL;
+    if (service->pipeId)
+        assignedPipe = pipeByKey(&service->pipeKey,false);
+    if (!assignedPipe) {
+        unlockUuidMap(&pipes);
+        verbose("warning: no pipe assigned to service(%s)\n",service->id);
+        if (first) {
+            respondConnection(loop, connection, "HTTP/1.1 502 Bad Gateway\r\nContent-Length: 27\r\nContent-Type: text/plain\r\n\r\nBad Gateway: Routing Error.");
+            return false;
+        }
+        return true; // the request times out
+    }
+
+    if (first) {
+        Request *request = (Request*)malloc(sizeof(Request));
+        request->socket = connection->socket;
+        request->pId = -1;
+        request->pipe_fd[0] = -1;
+        request->pipe_fd[1] = -1;
+        request->pipe_fd_rev[0] = -1;
+        request->pipe_fd_rev[1] = -1;
+        request->loop = loop;
+        request->service = service;
+        request->responded = false;
+
+        lockSlotMap(requests);
+        request->id = slotMapInsert(requests,request,false)*service->nshards+shard; // see deliverResponse
+        connection->requestId = request->id;
+        unlockSlotMap(requests);
+        addTimer(&loop->timers,&connection->deadline,service->requestTtl*1000LL);
+    }
+
+    Slice message = requestEnvelope(assignedPipe,service,connection->requestId,buffer,len,connection->part++,more);
+    if (message.data) {
+        udpsendSocket(loop->udpFd != -1 ? loop->udpFd : sockfd,message,&assignedPipe->client_addr);
+        releaseSlice(&message);
+    }
+    unlockUuidMap(&pipes);
+    return true;
+}
+
+#ifdef SC_ENGINE_URING
+void uringArmRecv(EventLoop *loop, Connection *connection);
+#endif
+
+/** wait for more data from the consumer with whichever engine runs the loop
+*/
+void readNext(EventLoop *loop, Connection *connection) {
+#ifdef SC_ENGINE_URING
+    if (loop->ring) {
+        uringArmRecv(loop, connection);
+        return;
+    }
+#endif
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = connection;
+    epoll_ctl(loop->epollFd, EPOLL_CTL_MOD, connection->socket, &event);
+}
+
+/** follow the framing of (a part of) a request read from the consumer & forward it. Anything read past the end
+* of the request (pipelining) waits in leftover until we responded. Returns true if the rest of the request
+* should be read.
+*/
+bool requestData(EventLoop *loop, Connection *connection, char *buffer, size_t len) {
+    if (connection->idle) {
+        connection->idle = false;
+        __sync_sub_and_fetch(&connection->service->idleConnections,1);
+        cancelTimer(&loop->timers,&connection->deadline);
+    }
+
+    size_t used = httpFramingFeed(&connection->framing, buffer, len);
+    bool more = !httpFramingComplete(&connection->framing);
+    connection->responseFraming.head = connection->framing.head;
+    if (connection->framing.state == HTTP_FRAMING_DONE && used < len) {
+        connection->leftover = (char*)malloc(len-used);
+        memcpy(connection->leftover, buffer+used, len-used);
+        connection->leftoverLen = len-used;
+        len = used;
+    }
+    if (!more && !loop->ring) {
+        // we are not interested in anything else from the consumer until we respond
+        struct epoll_event event;
+        event.events = 0;
+        event.data.ptr = connection;
+        epoll_ctl(loop->epollFd, EPOLL_CTL_MOD, connection->socket, &event);
+    }
+
+    return forwardRequest(loop, connection, buffer, len, more) && more;
+}
+
+/** the connection was kept open after a response, continue with the pipelined request if there is one
+*/
+void resumeConnection(EventLoop *loop, Connection *connection) {
+    if (connection->leftover) {
+        char *leftover = connection->leftover;
+        size_t leftoverLen = connection->leftoverLen;
+        connection->leftover = NULL;
+        connection->leftoverLen = 0;
+        verbose("loop(%d) pipelined request on socket(%d)\n",loop->index,connection->socket);
+        bool more = requestData(loop, connection, leftover, leftoverLen);
+        free(leftover);
+        if (more)
+            readNext(loop, connection);
+        return;
+    }
+    readNext(loop, connection);
+}
+
+void readConnection(EventLoop *loop, Connection *connection) {
+    Service *service = connection->service;
+    char buffer[service->requestBuffer];
+
+    ssize_t valread = recv(connection->socket, buffer, service->requestBuffer-1, 0);
+    if (valread == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return;
+    if (valread <= 0) {
+        closeConnection(loop, connection);
+        return;
+    }
+    buffer[valread] = 0x00;
+    verbose("loop(%d) read(%ld) from socket(%d)\n",loop->index,valread,connection->socket);
+
+    requestData(loop, connection, buffer, valread);
+}
+
+/** sharding, drain the shard's own UDP socket
+*/
+void readGrams(EventLoop *loop) {
+    while (1) {
+        int count = receiveGrams(&loop->grams, loop->udpFd, MSG_DONTWAIT);
+        if (count == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("recvmmsg");
+            return;
+        }
+        for (int n = 0; n < count; n++) {
+            unsigned int num_bytes = 0;
+            char *buffer = ringGram(&loop->grams, n, &num_bytes);
+            onDatagram(loop->udpFd,loop->reassembly,buffer,num_bytes,*ringGramSender(&loop->grams, n));
+        }
+        // the socket is drained
+        if (count < loop->grams.size)
+            return;
+    }
+}
+
+void processCompletions(EventLoop *loop) {
+    uint64_t count;
+    read(loop->wakeFd,&count,sizeof(count));
+
+    lockList(&loop->completions);
+    Node *current = loop->completions.head;
+    loop->completions.head = NULL;
+    unlockList(&loop->completions);
+
+    while (current != NULL) {
+        Completion *completion = (Completion*)current->data;
+        Connection *connection = NULL;
+        if (completion->socket >= 0 && completion->socket < loop->nconnections)
+            connection = loop->connections[completion->socket];
+
+        // the consumer might have gone away & the descriptor could have been reused since
+        if (connection && connection->service == completion->service &&
+            connection->requestId == completion->requestId && !connection->outDone) {
+            queueConnection(connection, completion->data, completion->len);
+            completion->data = NULL;
+            connection->outDone = completion->last;
+            if (completion->last) {
+                // responded, the request is done with (the connection may be reused with a new one)
+                cancelTimer(&loop->timers,&connection->deadline);
+                releaseRequest(connection->service,connection->requestId);
+            }
+            sendConnection(loop, connection);
+        }
+
+        if (completion->data)
+            free(completion->data);
+        free(completion);
+        Node *next = current->next;
+        free(current);
+        current = next;
+    }
+}
+
+void *eventLoop(void *arg) {
+    EventLoop *loop = (EventLoop*)arg;
+    struct epoll_event events[64];
+
+    printf("event loop(%d) running\n",loop->index);
+
+    while (1) {
+        int nevents = epoll_wait(loop->epollFd, events, 64, -1);
+        if (nevents == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            break;
+        }
+        for (int n = 0; n < nevents; n++) {
+            Connection *connection = (Connection*)events[n].data.ptr;
+            if (!connection) {
+                processCompletions(loop);
+            } else if (connection->kind == CONNECTION_LISTENER) {
+                acceptConnections(loop, connection);
+            } else if (connection->kind == CONNECTION_UDP) {
+                readGrams(loop);
+            } else if (connection->kind == CONNECTION_TIMER) {
+                runTimers(&loop->timers);
+            } else if (connection->closed) {
+                // closed by an earlier event of this batch
+            } else if (events[n].events & (EPOLLERR|EPOLLHUP)) {
+                closeConnection(loop, connection);
+            } else if (events[n].events & EPOLLOUT) {
+                flushConnection(loop, connection);
+            } else if (events[n].events & EPOLLIN) {
+                readConnection(loop, connection);
+            }
+        }
+        freeClosedConnections(loop);
+    }
+    return NULL;
+}
+
+#ifdef SC_ENGINE_URING
+
+// what a submission was for, kept in the low bits of the user_data pointer
+#define URING_OP_ACCEPT 1
+#define URING_OP_RECV 2
+#define URING_OP_SEND 3
+#define URING_OP_CLOSE 4
+#define URING_OP_WAKE 5
+#define URING_OP_GRAM 6 // sharding, multishot recvmsg on the shard's UDP socket
+#define URING_OP_TIMER 7 // multishot poll on the timerfd of the loop's TimerWheel
+#define URING_OP_MASK 7
+
+#define URING_ENTRIES 256
+#define URING_UDP_BUFFERS 64 // provided buffers for incoming grams, power of 2
+
+#define uringUserData(ptr,op) ((__u64)(uintptr_t)(ptr) | (op))
+
+void uringArmAccept(EventLoop *loop, Connection *listener) {
+    struct io_uring_sqe *sqe = uringGetSqe(loop->ring);
+    if (!sqe)
+        return;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listener->socket;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = uringUserData(listener, URING_OP_ACCEPT);
+}
+
+/** multishot poll for fd to become readable, used for the eventfd & the timerfd
+*/
+void uringArmPoll(struct Uring *ring, int fd, __u64 userData) {
+    struct io_uring_sqe *sqe = uringGetSqe(ring);
+    if (!sqe)
+        return;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = userData;
+}
+
+void uringArmWake(EventLoop *loop) {
+    uringArmPoll(loop->ring, loop->wakeFd, uringUserData(NULL, URING_OP_WAKE));
+}
+
+void uringArmTimer(EventLoop *loop) {
+    uringArmPoll(loop->ring, loop->timers.timerFd, uringUserData(NULL, URING_OP_TIMER));
+}
+
+void uringArmGrams(struct Uring *ring, int fd, UringBufRing *bufRing, struct msghdr *msg, __u64 userData) {
+    struct io_uring_sqe *sqe = uringGetSqe(ring);
+    if (!sqe)
+        return;
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = fd;
+    sqe->addr = (__u64)(uintptr_t)msg;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = bufRing->bgid;
+    sqe->user_data = userData;
+}
+
+/** hand a gram received by a multishot recvmsg to onDatagram & give the buffer back to the ring
+*/
+void uringOnGram(int fd, ReassemblyTable *reassembly, UringBufRing *bufRing, struct msghdr *msg, int res, unsigned int flags) {
+    if (res < 0) {
+        if (res != -ENOBUFS)
+            printf("warning: io_uring recvmsg failed (%d)\n",res);
+        return;
+    }
+    if (!(flags & IORING_CQE_F_BUFFER))
+        return;
+
+    unsigned short bid = flags >> IORING_CQE_BUFFER_SHIFT;
+    char *buffer = uringBuffer(bufRing, bid);
+    struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out*)buffer;
+    char *name = buffer + sizeof(struct io_uring_recvmsg_out);
+    char *payload = name + msg->msg_namelen + msg->msg_controllen;
+
+    if (!(out->flags & MSG_TRUNC) && out->namelen <= sizeof(struct sockaddr_in)) {
+        struct sockaddr_in client_addr;
+        memcpy(&client_addr, name, sizeof(client_addr));
+        onDatagram(fd, reassembly, payload, out->payloadlen, client_addr);
+    } else {
+        printf("warning: dropping truncated gram\n");
+    }
+    uringRecycleBuffer(bufRing, bid);
+}
+
+void uringArmRecv(EventLoop *loop, Connection *connection) {
+    struct io_uring_sqe *sqe = uringGetSqe(loop->ring);
+    if (!sqe) {
+        closeConnection(loop, connection);
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = connection->socket;
+    sqe->addr = (__u64)(uintptr_t)connection->in;
+    sqe->len = connection->service->requestBuffer-1;
+    sqe->user_data = uringUserData(connection, URING_OP_RECV);
+}
+
+/** send what is left of out, once the whole response is queued the close of the consumer socket is linked
+* right after it unless we keep the connection for the next request. Only one send per connection is in
+* flight, streamed parts wait in pending.
+*/
+void uringSendResponse(EventLoop *loop, Connection *connection) {
+    if (connection->sending)
+        return;
+    if (!connection->out) {
+        if (!connection->outDone)
+            return;
+        if (keepConnection(loop, connection))
+            resumeConnection(loop, connection);
+        else
+            closeConnection(loop, connection);
+        return;
+    }
+    bool last = connection->outDone && !connection->pending && !reusableConnection(connection);
+
+    if (uringSqSpace(loop->ring) < 2)
+        uringSubmit(loop->ring, 0);
+    struct io_uring_sqe *sqe = uringGetSqe(loop->ring);
+    if (!sqe) {
+        closeConnection(loop, connection);
+        return;
+    }
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = connection->socket;
+    sqe->addr = (__u64)(uintptr_t)(connection->out+connection->outSent);
+    sqe->len = connection->outLen-connection->outSent;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->user_data = uringUserData(connection, URING_OP_SEND);
+    connection->sending = true;
+    if (!last)
+        return;
+    sqe->flags = IOSQE_IO_LINK;
+    connection->closing = true;
+
+    sqe = uringGetSqe(loop->ring);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = connection->socket;
+    sqe->user_data = uringUserData(connection, URING_OP_CLOSE);
+}
+
+void uringOnCompletion(EventLoop *loop, struct io_uring_cqe *cqe) {
+    int op = cqe->user_data & URING_OP_MASK;
+    Connection *connection = (Connection*)(uintptr_t)(cqe->user_data & ~(__u64)URING_OP_MASK);
+    bool more = cqe->flags & IORING_CQE_F_MORE;
+
+    switch (op) {
+        case URING_OP_ACCEPT:
+            if (cqe->res >= 0) {
+                Connection *accepted = addConnection(loop, connection->service, cqe->res);
+                accepted->in = (char*)malloc(connection->service->requestBuffer);
+                verbose("loop(%d) accept socket(%d)\n",loop->index,cqe->res);
+                uringArmRecv(loop, accepted);
+            } else if (cqe->res != -EAGAIN && cqe->res != -EINTR) {
+                printf("warning: io_uring accept failed (%d)\n",cqe->res);
+            }
+            if (!more)
+                uringArmAccept(loop, connection);
+            break;
+        case URING_OP_RECV:
+            if (cqe->res <= 0 && connection->sending) {
+                // io_uring still owns out, the send (or the close linked after it) completes & closes
+                connection->outDone = true;
+                if (connection->pending)
+                    free(connection->pending);
+                connection->pending = NULL;
+                connection->pendingLen = 0;
+            } else if (cqe->res <= 0) {
+                closeConnection(loop, connection);
+            } else {
+                connection->in[cqe->res] = 0x00;
+                verbose("loop(%d) read(%d) from socket(%d)\n",loop->index,cqe->res,connection->socket);
+                // keep reading the body unless we already answered (503/502)
+                if (requestData(loop, connection, connection->in, cqe->res))
+                    uringArmRecv(loop, connection);
+            }
+            break;
+        case URING_OP_SEND:
+        {
+            bool failed = cqe->res < 0 || (cqe->res == 0 && connection->outSent < connection->outLen);
+            if (failed)
+                verbose("warning: io_uring send failed (%d)\n",cqe->res);
+            else
+                connection->outSent += cqe->res;
+            if (!failed && connection->outSent < connection->outLen) {
+                // short send, the rest is sent from where it stopped. A linked close got cancelled with
+                // it & is queued again behind the rest once that is submitted
+                connection->sending = false;
+                if (connection->closing) {
+                    connection->closing = false;
+                    break;
+                }
+                uringSendResponse(loop, connection);
+                break;
+            }
+            // with the whole response sent the linked close completes next, even if it gets cancelled
+            // because the send failed
+            if (connection->closing)
+                break;
+            connection->sending = false;
+            if (failed) {
+                closeConnection(loop, connection);
+                break;
+            }
+            nextConnectionOutput(connection);
+            uringSendResponse(loop, connection);
+            break;
+        }
+        case URING_OP_CLOSE:
+            if (cqe->res < 0 && !connection->closing) {
+                // cancelled by a short send, continue with the rest of the response
+                uringSendResponse(loop, connection);
+                break;
+            }
+            if (cqe->res < 0)
+                close(connection->socket); // cancelled because the send failed
+            freeConnection(loop, connection);
+            break;
+        case URING_OP_WAKE:
+            processCompletions(loop);
+            if (!more)
+                uringArmWake(loop);
+            break;
+        case URING_OP_GRAM:
+            uringOnGram(loop->udpFd, loop->reassembly, loop->bufRing, &loop->udpMsg, cqe->res, cqe->flags);
+            if (!more)
+                uringArmGrams(loop->ring, loop->udpFd, loop->bufRing, &loop->udpMsg, uringUserData(NULL, URING_OP_GRAM));
+            break;
+        case URING_OP_TIMER:
+            runTimers(&loop->timers);
+            if (!more)
+                uringArmTimer(loop);
+            break;
+    }
+}
+
+void *uringEventLoop(void *arg) {
+    EventLoop *loop = (EventLoop*)arg;
+
+    printf("io_uring event loop(%d) running\n",loop->index);
+
+    uringArmWake(loop);
+    uringArmTimer(loop);
+    if (loop->udpFd != -1)
+        uringArmGrams(loop->ring, loop->udpFd, loop->bufRing, &loop->udpMsg, uringUserData(NULL, URING_OP_GRAM));
+    Node* current = globalSetup.services.head;
+    while (current != NULL) {
+        Service *service = (Service*)current->data;
+        Connection *listener = (Connection*)malloc(sizeof(Connection));
+        memset(listener, 0, sizeof(Connection));
+        listener->kind = CONNECTION_LISTENER;
+        listener->socket = globalSetup.sharding ? createServiceSocket(service,true) : service->listenerFd;
+        listener->service = service;
+        uringArmAccept(loop, listener);
+        current = current->next;
+    }
+
+    while (1) {
+        int ret = uringSubmit(loop->ring, 1);
+        if (ret < 0 && errno != EINTR && errno != EBUSY) {
+            perror("io_uring_enter");
+            break;
+        }
+        struct io_uring_cqe *cqe;
+        while ((cqe = uringPeekCqe(loop->ring)) != NULL) {
+            struct io_uring_cqe copy = *cqe;
+            uringSeenCqe(loop->ring);
+            uringOnCompletion(loop, &copy);
+        }
+    }
+    return NULL;
+}
+
+/** receive grams through io_uring into a provided buffer ring, one multishot recvmsg for the socket
+*/
+void *udpserver_uring_thread(void *arg) {
+    Setup *setup = (Setup*)arg;
+
+    createUdpSocket(setup);
+
+    Uring ring;
+    UringBufRing bufRing;
+    if (!initUring(&ring, URING_ENTRIES) ||
+        !initUringBufRing(&ring, &bufRing, 0, URING_UDP_BUFFERS, MAX_UDP_MSG_SIZE)) {
+        printf("Error: io_uring unavailable for the UDP listener\n");
+        exit(1);
+    }
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_namelen = sizeof(struct sockaddr_in);
+
+    // user_data tells the grams (0) from the reassembly deadlines (1) apart
+    bool armed = false;
+    bool timerArmed = false;
+    while (1) {
+        if (!armed) {
+            uringArmGrams(&ring, sockfd, &bufRing, &msg, 0);
+            armed = true;
+        }
+        if (!timerArmed) {
+            uringArmPoll(&ring, udpTimers.timerFd, 1);
+            timerArmed = true;
+        }
+        int ret = uringSubmit(&ring, 1);
+        if (ret < 0 && errno != EINTR && errno != EBUSY) {
+            perror("io_uring_enter");
+            exit(1);
+        }
+
+        struct io_uring_cqe *cqe;
+        while ((cqe = uringPeekCqe(&ring)) != NULL) {
+            int res = cqe->res;
+            unsigned int flags = cqe->flags;
+            __u64 userData = cqe->user_data;
+            uringSeenCqe(&ring);
+
+            if (userData == 1) {
+                if (!(flags & IORING_CQE_F_MORE))
+                    timerArmed = false;
+                runTimers(&udpTimers);
+                continue;
+            }
+            if (!(flags & IORING_CQE_F_MORE))
+                armed = false;
+            uringOnGram(sockfd, &reassembly, &bufRing, &msg, res, flags);
+        }
+    }
+
+    return NULL;
+}
+
+#endif
+
+/** start the event loops, every loop waits on all service listeners (or on its own ones when sharding)
+*/
+bool runEventLoops(Setup *setup) {
+    Node* current = setup->services.head;
+    while (current != NULL && !setup->sharding) {
+        Service *service = (Service*)current->data;
+        service->listenerFd = createServiceSocket(service,false);
+        // io_uring waits for readiness itself, epoll needs accept() to return EAGAIN
+        if (setup->engine == ENGINE_EPOLL)
+            setNonBlocking(service->listenerFd);
+        current = current->next;
+    }
+
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpus < 1)
+        ncpus = 1;
+
+    eventLoops = (EventLoop*)malloc(sizeof(EventLoop)*setup->engineThreads);
+    for (int n = 0; n < setup->engineThreads; n++) {
+        EventLoop *loop = &eventLoops[n];
+        loop->index = n;
+        loop->epollFd = -1;
+        loop->ring = NULL;
+        loop->udpFd = -1;
+        loop->reassembly = NULL;
+        loop->bufRing = NULL;
+        memset(&loop->udpMsg, 0, sizeof(loop->udpMsg));
+        initLinkedList(&loop->completions,LIST_USEMUTEX);
+        loop->nconnections = 1024;
+        loop->connections = (Connection**)calloc(loop->nconnections, sizeof(Connection*));
+        initTimerWheel(&loop->timers, TIMER_TICK_MS, TIMERWHEEL_NOMUTEX);
+        loop->closed = NULL;
+
+        if ((loop->wakeFd = eventfd(0, EFD_NONBLOCK)) == -1) {
+            perror("eventfd");
+            return false;
+        }
+
+        if (setup->sharding) {
+            loop->udpFd = bindUdpSocket(setup,true);
+            loop->reassembly = (ReassemblyTable*)malloc(sizeof(ReassemblyTable));
+            initReassembly(loop->reassembly, &loop->timers, setup->nshards, loop->udpFd);
+        }
+
+#ifdef SC_ENGINE_URING
+        if (setup->engine == ENGINE_URING) {
+            loop->ring = (Uring*)malloc(sizeof(Uring));
+            if (!initUring(loop->ring, URING_ENTRIES)) {
+                printf("Error: could not set up io_uring for event loop(%d)\n",n);
+                return false;
+            }
+            if (loop->udpFd != -1) {
+                loop->bufRing = (UringBufRing*)malloc(sizeof(UringBufRing));
+                if (!initUringBufRing(loop->ring, loop->bufRing, 0, URING_UDP_BUFFERS, MAX_UDP_MSG_SIZE)) {
+                    printf("Error: could not set up io_uring buffers for event loop(%d)\n",n);
+                    return false;
+                }
+                loop->udpMsg.msg_namelen = sizeof(struct sockaddr_in);
+            }
+            if (pthread_create(&loop->threadId, NULL, uringEventLoop, loop) != 0) {
+                perror("pthread_create");
+                return false;
+            }
+        }
+#endif
+
+        if (!loop->ring) {
+            if ((loop->epollFd = epoll_create1(0)) == -1) {
+                perror("epoll_create1");
+                return false;
+            }
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.ptr = NULL;
+            epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, loop->wakeFd, &event);
+
+            Connection *timer = (Connection*)malloc(sizeof(Connection));
+            memset(timer, 0, sizeof(Connection));
+            timer->kind = CONNECTION_TIMER;
+            timer->socket = loop->timers.timerFd;
+            event.events = EPOLLIN;
+            event.data.ptr = timer;
+            if (epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, timer->socket, &event) == -1) {
+                perror("epoll_ctl");
+                return false;
+            }
+
+            if (loop->udpFd != -1) {
+                setNonBlocking(loop->udpFd);
+                if (!initGramRing(&loop->grams, GRAMRING_SIZE, MAX_UDP_MSG_SIZE)) {
+                    printf("error: could not allocate the gram buffers of shard(%d)\n",n);
+                    return false;
+                }
+                Connection *udp = (Connection*)malloc(sizeof(Connection));
+                memset(udp, 0, sizeof(Connection));
+                udp->kind = CONNECTION_UDP;
+                udp->socket = loop->udpFd;
+                event.events = EPOLLIN;
+                event.data.ptr = udp;
+                if (epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, loop->udpFd, &event) == -1) {
+                    perror("epoll_ctl");
+                    return false;
+                }
+            }
+
+            current = setup->services.head;
+            while (current != NULL) {
+                Service *service = (Service*)current->data;
+                Connection *listener = (Connection*)malloc(sizeof(Connection));
+                memset(listener, 0, sizeof(Connection));
+                listener->kind = CONNECTION_LISTENER;
+                listener->service = service;
+                if (setup->sharding) {
+                    listener->socket = createServiceSocket(service,true);
+                    setNonBlocking(listener->socket);
+                    event.events = EPOLLIN;
+                } else {
+                    listener->socket = service->listenerFd;
+                    event.events = EPOLLIN | EPOLLEXCLUSIVE; // only wake up one of the loops per connection
+                }
+                event.data.ptr = listener;
+                if (epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, listener->socket, &event) == -1) {
+                    perror("epoll_ctl");
+                    return false;
+                }
+                current = current->next;
+            }
+
+            if (pthread_create(&loop->threadId, NULL, eventLoop, loop) != 0) {
+                perror("pthread_create");
+                return false;
+            }
+        }
+
+        // the group is complete, from now on every gram of a message goes to the same shard
+        if (setup->sharding && n == setup->engineThreads-1 && setup->engineThreads > 1) {
+            if (!attachGramSteering(loop->udpFd, setup->nshards))
+                printf("warning: grams are steered to shards by address, an SP's messages won't spread\n");
+        }
+
+        if (setup->sharding) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(n % ncpus, &cpus);
+            if (pthread_setaffinity_np(loop->threadId, sizeof(cpus), &cpus) != 0)
+                printf("warning: could not pin shard(%d) to cpu(%ld)\n",n,n % ncpus);
+        }
+    }
+
+    return true;
+}
+
+#endif
+
+typedef struct ParseResult {
+    Slice message; // the acknowledgement, borrowed from the builder passed in
+    bool havePipe; // the message named a pipe or asked for one
+    Uuid assignedPipeKey; // the pipe found, zero if there is none
+} ParseResult;
+
+/**
+* #todo - too long, too complicated, too many levels
+*
+* #todo - decide if we lock pipes for this method since it returns either one or id in the implementation
+*/
+/** pass (a part of) a response on to whoever serves the consumer connection of the request, the event
+* loop owning the socket or the forked child through its pipe. Takes ownership of data.
+*/
+bool deliverResponse(Service *service, long long requestId, char *data, size_t len, bool last) {
+    bool delivered = false;
+
+    // the shard owning the request is encoded in its id, see forwardRequest. The rest is the slot handle,
+    // a response to a request that has been removed (timed out) doesn't match the generation of the slot
+    if (requestId < 0) {
+        if (data)
+            free(data);
+        return false;
+    }
+    SlotMap *requests = &service->requests[requestId % service->nshards];
+    lockSlotMap(requests);
+
+    Request *request = (Request*)slotMapGet(requests,requestId / service->nshards,false);
+    if (!request) {
+        verbose("Warning: got response for Request node that is no longer registered\n");
+    } else if (request->loop) {
+        if (!request->responded) {
+            // the event loop takes over the data
+            postCompletion(request->loop,service,request->id,request->socket,data,len,last);
+            data = NULL;
+            request->responded = last;
+            delivered = true;
+        }
+    } else if (request->pipe_fd[1]>-1) {
+        verbose("attempting to write to pipe to send child process response\n");
+        // length prefixed parts, a zero length ends the response (see serviceListener)
+        size_t end = 0;
+        if (len > 0) {
+            writeAll(request->pipe_fd[1], (const char*)&len, sizeof(len));
+            writeAll(request->pipe_fd[1], data, len);
+        }
+        if (last)
+            writeAll(request->pipe_fd[1], (const char*)&end, sizeof(end));
+        verbose("write to pipe finished\n");
+
+        if (last) {
+            close(request->pipe_fd[1]); // close pipe immediately so we don't reach the limit
+            request->pipe_fd[1] = -1;
+            // the child exits once it relayed the response, reap it
+            addTimer(&requestTimers,&request->deadline,REAP_INTERVAL_MS);
+        }
+        delivered = true;
+    }
+
+    unlockSlotMap(requests);
+
+    if (data)
+        free(data);
+    return delivered;
+}
+
+/** streamed - the response payload has already been passed on while its grams were arriving (streamResponse)
+*
+* The envelope is read in place (see envelope.hpp) & the acknowledgement goes into ack, which the caller
+* keeps from message to message. False if the message isn't an envelope, the result is empty then.
+*/
+bool parseUDPXmlMessage(const char* xmlMessage, size_t len, bool streamed, Buffer *ack, ParseResult *parseResult) {
+        
+        verbose("ParseXmlMessage\n");
+        
+        parseResult->message = borrowSlice(NULL,0);
+        parseResult->havePipe = false;
+        memset(&parseResult->assignedPipeKey, 0, sizeof(Uuid));
+
+        Pipe *assignedPipe = NULL;
+
+        Envelope envelope;
+        if (!parseEnvelope(xmlMessage, len, &envelope)) {
+            verbose("error parsing XML\n");
+            // #todo
+            //result.response = CreateErrorResponse(xmlDoc.ErrorStr());
+            return false;
+        }
+
+        // Check if the message has a pipe ID
+        if (envelope.pipeId.data) {
+
+            verbose("have pipeId(%.*s)\n",(int)envelope.pipeId.len,envelope.pipeId.data);
+            
+            Uuid pipeKey;
+            if (parseUuidLen(envelope.pipeId.data,envelope.pipeId.len,&pipeKey))
+                assignedPipe = pipeByKey(&pipeKey,true);
+            if (!assignedPipe) {
+                verbose("didn't find pipe\n");
             }
+            parseResult->havePipe = true;
+
+            // #todo - error response on pipeId not found
+        } else if (envelope.requestPipe) {
+            // Create a new pipe route if necessary
+                
+            verbose("create new pipe\n");
+
+            assignedPipe = (Pipe*)malloc(sizeof(Pipe));
+            initializePipe(assignedPipe);
+
+            // the SP offers the binary frames, we answer with the same if we take them
+            if (globalSetup.binaryWire && envelope.wire.len == strlen(WIRE_BINARY) && memcmp(envelope.wire.data,WIRE_BINARY,envelope.wire.len)==0)
+                assignedPipe->binary = true;
+
+            parseResult->havePipe = true;
+            printf("have new pipeid(%s)\n",assignedPipe->id);
+
+            uuidMapPut(&pipes,&assignedPipe->key,assignedPipe,true);
         }
+
+        beginEnvelopeAck(ack,assignedPipe ? textSlice(assignedPipe->id) : borrowSlice(NULL,0),assignedPipe && assignedPipe->binary);
+
         if (assignedPipe) {
 
             verbose("have assigned pipe\n");
+            parseResult->assignedPipeKey = assignedPipe->key;
 
-            strcat(result,assignedPipe->id);
-            strcat(result,"</pipe_id>\n");
+            if (!envelope.services)
+                verbose("missing data <services>\n");
 
-            tinyxml2::XMLElement* servicesElement = xmlDoc.FirstChildElement("message")->FirstChildElement("services");
-            if (servicesElement) {
-                for (tinyxml2::XMLElement* serviceElement = servicesElement->FirstChildElement("service");
-                    serviceElement; serviceElement = serviceElement->NextSiblingElement("service")) {
+            EnvelopeService entry;
+            while (nextEnvelopeService(&envelope,&entry)) {
 
-                        verbose("process service\n");
+                verbose("process service\n");
 
-                        const char* service_uuid = serviceElement->Attribute("uuid");
-                        const char* service_name = serviceElement->Attribute("name");
-                        const char* service_type = serviceElement->Attribute("type");
-                        /**
-                        if (!service_uuid || !service_name || !service_type) {
-                            response += "  <error reason=\"Missing attribute(s) in <service> element\"/>\n";
-                            continue;
-                        } else {
-                            //printf("parsing service uuid(%s) name(%s) type(%s)\n",service_uuid,service_name,service_type);
-                        } */
-    
+                Uuid serviceKey;
+                if (!parseUuidLen(entry.uuid.data,entry.uuid.len,&serviceKey)) {
+                    verbose("warning: invalid service uuid(%.*s)\n",(int)entry.uuid.len,entry.uuid.data ? entry.uuid.data : "");
+                    continue;
+                }
 
-                        ServiceDef *serviceDef = serviceDefByIdInPipe(assignedPipe,service_uuid);
-                        if (!serviceDef) {
-
-                            serviceDef = (ServiceDef*)malloc(sizeof(ServiceDef));
-                            serviceDef->id = (char*)malloc(strlen(service_uuid)+1);
-                            strcpy(serviceDef->id,service_uuid);
-                            Node *snode = getNode();
-                            snode->data = serviceDef;
-                            addNode(&assignedPipe->serviceDefs,snode,true);
-
-                            // we assign a pipe to a service. This doesn't survive any cleanup for now.
-                            // In the next versions add a list of assigned pipes, so that we can 
-                            // implement load balancing.
-                            //
-                            Service *service = serviceByServiceDef(&globalSetup.services,serviceDef,false);
-                            service->pipeId = (char*)malloc(strlen(pipeId)+1); // #todo - must always be uuid, add checks & just alloc that size
-                            strcpy(service->pipeId,pipeId); // #todo - there should be pipeDefs in service (plan to add load balancing)
-                            printf("SERVICE ASSIGNED pipeId(%s)\n",service->pipeId);
-
-                            strcat(result,"  <service uuid=\"");
-                            strcat(result,service_uuid);
-                            strcat(result,"\" status=\"ServiceRouteRegistered\">\n");
-                        } else {
-                            // #todo - do we acknowledge that we received response? (circular logic?)
-
-                            strcat(result,"  <service uuid=\"");
-                            strcat(result,serviceDef->id);
-                            strcat(result,"\">");
-
-                            // #todo - #refactoring
-                            tinyxml2::XMLElement* responseElement = serviceElement->FirstChildElement("response");
-                            if (responseElement) {
-                                verbose("got response - try to forward to consumer request_id(%d)\n",atoi(responseElement->Attribute("request_id")));
-                                
-                                tinyxml2::XMLElement* payloadElement = responseElement->FirstChildElement("payload");
-                                if (payloadElement) {
-
-                                    const char *payloadData = payloadElement->GetText();
-                                    const char *httpResponse = NULL;
-                                    char *payloadDataDecoded = NULL;
-                                    if (payloadData) {
-                                        payloadDataDecoded = base64Decode(payloadData);
-                                    }
-                                    if (payloadDataDecoded) {
-                                        httpResponse = payloadDataDecoded;
-                                    } else {
-                                        // #todo - evaluate if this should be 502, 500 or other
-                                        //httpResponse = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\nContent-Type: text/plain\r\n\r\n";
-                                        httpResponse = "HTTP/1.1 502 Bad Gateway\r\nContent-Length: 25\r\nContent-Type: text/plain\r\n\r\nBad Gateway: Routing Error.";
-                                    }
-
-                                    lockList(&globalSetup.services);
-
-                                    
-                                    Service *service = serviceByServiceDef(&globalSetup.services,serviceDef,false);
-                                    /**service->pipeId = (char*)malloc(strlen(pipeId)+1); // #todo - must always be uuid, add checks & just alloc that size
-                                    strcpy(service->pipeId,pipeId); // #todo - there should be pipeDefs in service (plan to add load balancing)
-                                    */
-
-                                    lockList(&service->requests);
-
-                                    // atol
-                                    Node *node = getNodeById(&service->requests,atoll(responseElement->Attribute("request_id")),false);
-                                    if (node) {
-                                        Request *request = (Request*)node->data;
-                                        
-                                        if (request) {
-
-                                            if (request->pipe_fd[1]>-1) {
-                                                verbose("attempting to write to pipe to send child process response\n");
-                                                write(request->pipe_fd[1], httpResponse, strlen(httpResponse));
-                                                // to close the pipe we need to make sure that access to other pipes is synced
-                                                verbose("write to pipe finished\n");
-
-                                                close(request->pipe_fd[1]); // close pipe immediately so we don't reach the limit
-                                                request->pipe_fd[1] = -1;
-                                                // theoretically there should only be one place to handle this
-                                            }
-                                        } else {
-                                            verbose("Warning: Request node without data\n");
-                                        }
-                                    } else {
-                                        verbose("Warning: got response for Request node that is no longer registered\n");
-                                    }
-                                    
-                                    unlockList(&service->requests);
-
-                                    unlockList(&globalSetup.services);
-
-                                    if (payloadDataDecoded)
-                                        free(payloadDataDecoded);
+                ServiceDef *serviceDef = (ServiceDef*)uuidMapGet(&assignedPipe->serviceDefs,&serviceKey,true);
+                if (!serviceDef) {
+
+                    // only services we are configured for can be routed
+                    Service *service = serviceByKey(&serviceKey);
+                    if (!service) {
+                        verbose("warning: unknown service(%.*s)\n",(int)entry.uuid.len,entry.uuid.data);
+                        continue;
+                    }
+
+                    char serviceId[UUID4_LEN];
+                    memcpy(serviceId,entry.uuid.data,entry.uuid.len);
+                    serviceId[entry.uuid.len] = 0x00;
 
+                    serviceDef = (ServiceDef*)malloc(sizeof(ServiceDef));
+                    initializeService(serviceDef,serviceId);
+                    uuidMapPut(&assignedPipe->serviceDefs,&serviceDef->key,serviceDef,true);
+
+                    // we assign a pipe to a service. This doesn't survive any cleanup for now.
+                    // In the next versions add a list of assigned pipes, so that we can 
+                    // implement load balancing.
+                    //
+                    service->pipeId = (char*)malloc(UUID4_LEN);
+                    strcpy(service->pipeId,assignedPipe->id); // #todo - there should be pipeDefs in service (plan to add load balancing)
+                    service->pipeKey = assignedPipe->key;
+                    printf("SERVICE ASSIGNED pipeId(%s)\n",service->pipeId);
+
+                    addEnvelopeAckService(ack,entry.uuid,true);
+                } else {
+                    // #todo - do we acknowledge that we received response? (circular logic?)
+
+                    addEnvelopeAckService(ack,entry.uuid,false);
+
+                    // #todo - #refactoring
+                    if (entry.response) {
+                        long long requestId = envelopeNumber(entry.requestId);
+                        verbose("got response - try to forward to consumer request_id(%lld)\n",requestId);
+                        
+                        if (streamed) {
+                            verbose("response request_id(%lld) already streamed\n",requestId);
+                        } else if (entry.payload) {
+
+                            const char *httpResponse = NULL;
+                            char *payloadDataDecoded = NULL;
+                            size_t payloadDecodedLen = 0;
+                            if (entry.payloadData.len > 0) {
+                                payloadDataDecoded = (char*)malloc(base64DecodedLen(entry.payloadData.len)+1);
+                                if (base64DecodeTo(entry.payloadData.data,entry.payloadData.len,payloadDataDecoded,&payloadDecodedLen)) {
+                                    payloadDataDecoded[payloadDecodedLen] = 0x00;
                                 } else {
-                                    verbose("warning: <response> didn't include <payload>\n");
+                                    free(payloadDataDecoded);
+                                    payloadDataDecoded = NULL;
                                 }
                             }
-                        }
+                            if (payloadDataDecoded) {
+                                httpResponse = payloadDataDecoded;
+                            } else {
+                                // #todo - evaluate if this should be 502, 500 or other
+                                //httpResponse = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\nContent-Type: text/plain\r\n\r\n";
+                                httpResponse = "HTTP/1.1 502 Bad Gateway\r\nContent-Length: 25\r\nContent-Type: text/plain\r\n\r\nBad Gateway: Routing Error.";
+                            }
+
+                            Service *service = serviceByServiceDef(serviceDef);
+                            char *data = payloadDataDecoded ? payloadDataDecoded : strdup(httpResponse);
+                            deliverResponse(service,requestId,data,payloadDataDecoded ? payloadDecodedLen : strlen(data),true);
 
-                        strcat(result,"  </service>\n");
+                        } else {
+                            verbose("warning: <response> didn't include <payload>\n");
+                        }
+                    }
                 }
-            } else {
-                verbose("missing data <services>\n");
             }
 
         }
 
-        strcat(result,"</response>\n");
-        strcat(result,"</message>\n");
+        endEnvelopeAck(ack);
+        parseResult->message = borrowSlice(ack->data,ack->len);
 
-        //parseResult->assignedPipe = assignedPipe;
-        return parseResult;
+        return true;
     }
 
-void *udpserver_thread(void *arg) {
-
-    Setup *setup = (Setup*)arg;
-
-    char buffer[MAX_UDP_MSG_SIZE]; // #todo
+/** create & bind a UDP socket on the listener port, shards share the port through SO_REUSEPORT
+*/
+int bindUdpSocket(Setup *setup, bool reusePort) {
+    int fd;
 
     // Create a UDP socket
-    if ((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
+    if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
         perror("socket");
         exit(1);
     }
 
+    int opt = 1;
+    if (reusePort && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1) {
+        perror("setsockopt(SO_REUSEPORT)");
+        exit(1);
+    }
+
     // Set up the server address
     memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
@@ -1265,158 +2486,412 @@ void *udpserver_thread(void *arg) {
     server_addr.sin_port = htons(setup->listenerPort);
     
     // Bind the socket to the server address
-    if (bind(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr)) == -1) {
+    if (bind(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) == -1) {
         perror("bind");
         exit(1);
     }
 
-    // Allocate memory for the buffer dynamically
-    //buffer = (char *)malloc(MAX_UDP_MSG_SIZE * sizeof(char));
-    //if (buffer == NULL) {
-    //    perror("malloc");
-    //    exit(1);
-    //}
-
-    printf("UDP server is listening on port %d...\n", setup->listenerPort);
-
-    for(int n = 0; n < NREQUESTS; n++) {
-        initializeRQMSG(&rqmsgs[n]);
-    }
+    enablePathMtuDiscovery(&pathMtu, fd);
+    setGramSocketBuffers(fd);
 
     //setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout)); // doesn't work
     struct timeval timeout;
     timeout.tv_sec = globalSetup.requestTtl;
     timeout.tv_usec = 0;
-    if (setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == -1) {
+    if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == -1) {
         perror("setsockopt");
         exit(1);
     }
-    
-    char *completemsg = NULL;
-    //addr_len = sizeof(client_addr); // #todo
-    
-    struct sockaddr_in client_addr;
-    socklen_t addr_len = sizeof(client_addr); // #todo
 
-    while (1) {
-        // Receive a message from a client
-        //addr_len = sizeof(client_addr);
-        unsigned int num_bytes = (unsigned int)recvfrom(sockfd, buffer, MAX_UDP_MSG_SIZE - 1, 0, (struct sockaddr *)&client_addr, &addr_len);
-        if (getpid()!=parentPid) {
-            continue;
-        }
-        if (num_bytes == -1) {
-            perror("recvfrom"); // #todo
-            //exit(1); // or break; // #todo
-            //break;
-            continue; // in case of non blocking
-        }
+    return fd;
+}
 
-        buffer[num_bytes] = '\0';
+/** sharding, steer grams to the shard sockets by their msgid instead of the default hash of the
+* addresses. All grams of a message then land on the same shard & reassemble in its own table, while
+* the messages of a single SP still spread over all shards.
+*
+* The classic BPF program runs on the UDP payload & returns the index of the socket in the
+* SO_REUSEPORT group, which is the order the shards bound their sockets in (runEventLoops).
+*/
+bool attachGramSteering(int fd, int nshards) {
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    const unsigned int low = 7; // least significant bytes of the msgid, see udpsend
+    const unsigned int high = 6;
+#else
+    const unsigned int low = 0;
+    const unsigned int high = 1;
+#endif
+    // A = (msgid & 0xffff) % nshards, grams shorter than the header fail the load & go to shard 0
+    struct sock_filter code[] = {
+        { BPF_LD  | BPF_B   | BPF_ABS, 0, 0, high },
+        { BPF_ALU | BPF_LSH | BPF_K,   0, 0, 8 },
+        { BPF_MISC | BPF_TAX,          0, 0, 0 },
+        { BPF_LD  | BPF_B   | BPF_ABS, 0, 0, low },
+        { BPF_ALU | BPF_ADD | BPF_X,   0, 0, 0 },
+        { BPF_ALU | BPF_MOD | BPF_K,   0, 0, (unsigned int)nshards },
+        { BPF_RET | BPF_A,             0, 0, 0 },
+    };
+    struct sock_fprog program;
+    program.len = sizeof(code)/sizeof(code[0]);
+    program.filter = code;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) == -1) {
+        perror("setsockopt(SO_ATTACH_REUSEPORT_CBPF)");
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
 
-        // put the data in the right format
-        RQMSGRAW *rqmsgraw = (RQMSGRAW*)malloc(sizeof(RQMSGRAW));
-        unsigned int index = 0;
-        memcpy(&rqmsgraw->msgid,buffer,sizeof(unsigned long long));
-        index+=sizeof(unsigned long long);
-        memcpy(&rqmsgraw->ngrams,buffer+index,sizeof(unsigned int));
-        index+=sizeof(unsigned int);
-        memcpy(&rqmsgraw->index,buffer+index,sizeof(unsigned int));
-        index+=sizeof(unsigned int);
-        unsigned int chunksize = num_bytes-index;
-        rqmsgraw->data = (char*)malloc(chunksize+1);
-        memcpy(rqmsgraw->data,buffer+index,chunksize);
-        rqmsgraw->data[chunksize]=0x00;
-        printf("in(%s) size(%d) ngrams(%d)\n",rqmsgraw->data,chunksize,rqmsgraw->ngrams);
-
-        RQMSG *rqmsg = NULL;
-        for(int n = 0; n < NREQUESTS; n++) {
-            if (rqmsgs[n].timestamp+globalSetup.requestTtl<time(NULL)) {
-                invalidateRQMSG(&rqmsgs[n]);
-                continue;
+/** create & bind the UDP socket SPs connect their pipes to
+*/
+void createUdpSocket(Setup *setup) {
+    sockfd = bindUdpSocket(setup,false);
+
+    printf("UDP server is listening on port %d...\n", setup->listenerPort);
+
+    initTimerWheel(&udpTimers, TIMER_TICK_MS, TIMERWHEEL_NOMUTEX);
+    initReassembly(&reassembly, &udpTimers, 1, sockfd);
+}
+
+/** timers is the wheel of the thread receiving the grams on fd, the configured bounds are split between the shards
+*/
+void initReassembly(ReassemblyTable *reassembly, TimerWheel *timers, int nshards, int fd) {
+    initReassemblyTable(reassembly, globalSetup.maxPartialMessages/nshards, globalSetup.maxPartialMemory/nshards,
+        globalSetup.requestTtl*1000LL, timers, fd);
+}
+
+/** a multi-gram response passed on to the consumer while its grams are still arriving, instead of only
+* once the whole message is reassembled & parsed
+*/
+typedef struct ResponseStream {
+    Service *service;
+    long long requestId;
+    unsigned int gram; // next gram to decode
+    unsigned int offset; // where the payload continues in that gram
+    char carry[4]; // base64 characters that don't make up a whole block yet
+    int ncarry;
+    bool raw; // a wire frame, the payload goes on as it is
+    unsigned int remaining; // raw, bytes of the payload still to come
+    bool finished; // reached the end of the payload
+    bool done; // the last part has been delivered
+} ResponseStream;
+
+/** find the request a response is for from the envelope header at the start of its first gram
+* (the SP leaves room for the header in every gram, so it is never split)
+*/
+ResponseStream *openResponseStream(const char *header, size_t len) {
+    if (isWireFrame(header,len)) {
+        WIRE_HEADER frame;
+        if (!parseWireHeader(header,len,&frame) || frame.kind != WIRE_KIND_RESPONSE)
+            return NULL;
+        Service *service = serviceByKey(&frame.service);
+        if (!service || !service->pipeId || !uuidEqual(&service->pipeKey,&frame.pipe))
+            return NULL;
+
+        ResponseStream *stream = (ResponseStream*)malloc(sizeof(ResponseStream));
+        memset(stream, 0, sizeof(ResponseStream));
+        stream->service = service;
+        stream->requestId = frame.requestId;
+        stream->raw = true;
+        stream->remaining = frame.length;
+        stream->offset = sizeof(frame);
+        return stream;
+    }
+
+    const char *pipeTag = strstr(header,"<pipe_id>");
+    const char *serviceTag = strstr(header,"<service uuid=\"");
+    const char *responseTag = strstr(header,"<response request_id=\"");
+    const char *payloadTag = strstr(header,"<payload>");
+    if (!pipeTag || !serviceTag || !responseTag || !payloadTag || responseTag > payloadTag)
+        return NULL;
+
+    pipeTag += strlen("<pipe_id>");
+    serviceTag += strlen("<service uuid=\"");
+    const char *pipeEnd = strchr(pipeTag,'<');
+    const char *serviceEnd = strchr(serviceTag,'"');
+    if (!pipeEnd || !serviceEnd)
+        return NULL;
+
+    // only stream for the pipe the service is routed through, same as parseUDPXmlMessage
+    Uuid pipeKey;
+    Uuid serviceKey;
+    if (!parseUuidLen(pipeTag,pipeEnd-pipeTag,&pipeKey) || !parseUuidLen(serviceTag,serviceEnd-serviceTag,&serviceKey))
+        return NULL;
+    Service *service = serviceByKey(&serviceKey);
+    if (!service || !service->pipeId || !uuidEqual(&service->pipeKey,&pipeKey))
+        return NULL;
+
+    ResponseStream *stream = (ResponseStream*)malloc(sizeof(ResponseStream));
+    memset(stream, 0, sizeof(ResponseStream));
+    stream->service = service;
+    stream->requestId = atoll(responseTag+strlen("<response request_id=\""));
+    stream->offset = (payloadTag+strlen("<payload>"))-header;
+    return stream;
+}
+
+/** decode the payload of the grams that are available in order & deliver it, the message's grams stay
+* around until it is complete (the envelope is still parsed as a whole afterwards, so call this before
+* dataFromRQMSG takes the buffer)
+*/
+void streamResponse(RQMSG *rqmsg, bool complete) {
+    ResponseStream *stream = (ResponseStream*)rqmsg->stream;
+    if (!stream) {
+        RQGRAM first = rqgramAt(rqmsg,0);
+        if (rqmsg->ngrams < 2 || !first.data)
+            return;
+        // the gram is followed by the rest of the buffer, not a terminator
+        char saved = first.data[first.size];
+        first.data[first.size] = 0x00;
+        stream = openResponseStream(first.data,first.size);
+        first.data[first.size] = saved;
+        if (!stream)
+            return;
+        verbose("streaming response request_id(%lld)\n",stream->requestId);
+        rqmsg->stream = stream;
+    }
+
+    while (!stream->finished && stream->gram < rqmsg->ngrams && rqgramPresent(rqmsg,stream->gram)) {
+        RQGRAM gram = rqgramAt(rqmsg,stream->gram);
+        const char *start = gram.data+stream->offset;
+        size_t avail = gram.size-stream->offset;
+        char *data = NULL;
+        size_t len = 0;
+        if (stream->raw) {
+            // the frame tells how long its payload is
+            if (avail >= stream->remaining) {
+                avail = stream->remaining;
+                stream->finished = true;
             }
-            if (rqmsgs[n].msgid==rqmsgraw->msgid && !rqmsg) {
-                rqmsg = &rqmsgs[n];
-                break;
+            stream->remaining -= avail;
+            data = (char*)malloc(avail+1);
+            memcpy(data,start,avail);
+            len = avail;
+        } else {
+            const char *end = (const char*)memchr(start,'<',avail); // not part of the base64 alphabet
+            if (end) {
+                avail = end-start;
+                stream->finished = true;
             }
-        }
-        if (!rqmsg) {
-            for(int n = 0; n < NREQUESTS; n++) {
-                if (rqmsgs[n].msgid==0) {
-                    rqmsg = &rqmsgs[n];
-                    rqmsg->timestamp = time(NULL);
-                    rqmsg->ngrams = rqmsgraw->ngrams;
-                    rqmsg->msgid = rqmsgraw->msgid;
-                    break;
-                }
+
+            data = (char*)malloc((stream->ncarry+avail)/4*3+3);
+            // complete the block left over from the previous gram
+            while (stream->ncarry > 0 && stream->ncarry < 4 && avail > 0) {
+                stream->carry[stream->ncarry++] = *start++;
+                avail--;
             }
-        }
-        completemsg = NULL;
-        if (rqmsg) {
-            printf("rqmsg ngrams(%d)\n",rqmsg->ngrams);
-            if (rqmsg->grams[rqmsgraw->index].data) {
-                // something went wrong - there shouldn't be data at this index
-                rqmsg = NULL;
-                free(rqmsgraw->data);
-                rqmsgraw->data = NULL;
-            } else {
-                rqmsg->grams[rqmsgraw->index].size = chunksize;
-                rqmsg->grams[rqmsgraw->index].data = rqmsgraw->data; // freed in invalidateRQMSG
-                completemsg = dataFromRQMSG(rqmsg);
+            if (stream->ncarry == 4) {
+                len += base64DecodeBlock(stream->carry,4,data);
+                stream->ncarry = 0;
             }
+            if (stream->ncarry == 0) {
+                size_t blocks = avail/4*4;
+                len += base64DecodeBlock(start,blocks,data+len);
+                stream->ncarry = avail-blocks;
+                memcpy(stream->carry,start+blocks,stream->ncarry);
+            }
+        }
+
+        bool last = stream->finished && complete;
+        if (len > 0 || last) {
+            deliverResponse(stream->service,stream->requestId,data,len,last);
+            stream->done = last;
         } else {
-            printf("warning: didn't find an rqmsg slot\n");
-            free(rqmsgraw->data);
-            rqmsgraw->data = NULL;
+            free(data);
+        }
+        if (!stream->finished) {
+            stream->gram++;
+            stream->offset = 0;
         }
-        //free(rqmsgraw->data);
-        free(rqmsgraw);
+    }
+
+    // the payload ended in an earlier gram (or never did), still let the consumer know we are done
+    if (complete && !stream->done) {
+        deliverResponse(stream->service,stream->requestId,(char*)malloc(1),0,true);
+        stream->done = true;
+    }
+}
+
+/** a response in a wire frame (see wire.hpp), streamed if its payload has already been passed on
+*/
+void onWireFrame(const char *data, size_t len, bool streamed, const struct sockaddr_in *addr) {
+    WIRE_HEADER header;
+    const char *payload = NULL;
+    if (!parseWireFrame(data, len, &header, &payload) || header.kind != WIRE_KIND_RESPONSE) {
+        verbose("warning: dropping a wire frame we don't understand\n");
+        return;
+    }
+
+    lockUuidMap(&pipes);
+    Pipe *pipe = pipeByKey(&header.pipe, false);
+    if (pipe)
+        pipe->client_addr = *addr;
+    unlockUuidMap(&pipes);
+    if (!pipe) {
+        printf("could not deduct pipe id\n");
+        return;
+    }
+
+    // only for the pipe the service is routed through, same as parseUDPXmlMessage
+    Service *service = serviceByKey(&header.service);
+    if (!service || !service->pipeId || !uuidEqual(&service->pipeKey, &header.pipe)) {
+        verbose("warning: response for a service that isn't routed through the pipe\n");
+        return;
+    }
+    if (streamed) {
+        verbose("response request_id(%lld) already streamed\n", header.requestId);
+        return;
+    }
+
+    char *response = (char*)malloc(header.length+1);
+    memcpy(response, payload, header.length);
+    response[header.length] = 0x00;
+    deliverResponse(service, header.requestId, response, header.length, true);
+}
 
-        if (!completemsg) {
+/** process a single gram received from an SP, once a message is complete we act on it
+*/
+void onDatagram(int fd, ReassemblyTable *reassembly, const char *buffer, unsigned int num_bytes, struct sockaddr_in client_addr) {
+    char *assembled = NULL;
+    PartialMessage *message = NULL;
+    bool streamed = false;
+
+    // acknowledgements of what we sent
+    if (onControlGram(&outbound, &client_addr, buffer, num_bytes))
+        return;
+
+    // a message that is a single gram is parsed right where it was received
+    unsigned int completelen = 0;
+    const char *completemsg = singleGramData(reassembly, &client_addr, buffer, num_bytes, &completelen);
+    if (!completemsg) {
+        // messages that aren't completed in time are dropped by their deadline
+        message = addGram(reassembly, &client_addr, buffer, num_bytes);
+        if (!message)
+            return;
+        RQMSG *rqmsg = &message->rqmsg;
+        printf("in size(%d) ngrams(%d) received(%d)\n",num_bytes,rqmsg->ngrams,rqmsg->received);
+
+        // pass a response on while the rest of it is still arriving
+        if (rqmsg->msgid)
+            streamResponse(rqmsg, partialMessageComplete(message));
+        if (!partialMessageComplete(message)) {
             printf("    msg not complete\n");
-            continue;
+            return;
+        }
+        streamed = rqmsg->stream != NULL;
+        completelen = rqmsg->size;
+        completemsg = assembled = dataFromRQMSG(rqmsg);
+    }
+
+    if (isWireFrame(completemsg, completelen)) {
+        // a response in a wire frame, there is nothing to answer
+        onWireFrame(completemsg, completelen, streamed, &client_addr);
+        if (message) {
+            free(assembled);
+            removePartialMessage(reassembly, message);
         }
+        return;
+    }
 
-        printf("Received message from client: (%s)\n", completemsg);
+    printf("Received message from client: (%.*s)\n", (int)completelen, completemsg);
 
-        //char *result = parseUDPXmlMessage(completemsg); // #todo - add returning of a struct with the needed data
-        
-        ParseResult *parseResult = parseUDPXmlMessage(completemsg);
-        
-        lockList(&pipes);
-        if (parseResult->assignedPipeId) {
-            Pipe *pipe = pipeById(parseResult->assignedPipeId,false);
-            if (pipe) {
-                pipe->client_addr = client_addr;
-            } else {
-                printf("could not deduct pipe id\n");
-            }
-            free(parseResult->assignedPipeId);
+    // every thread receiving grams acknowledges into its own builder, it lives as long as the thread
+    static __thread Buffer *ack = NULL;
+    if (!ack)
+        ack = newBuffer(1024);
+
+    ParseResult parseResult;
+    parseUDPXmlMessage(completemsg, completelen, streamed, ack, &parseResult);
+    
+    lockUuidMap(&pipes);
+    if (parseResult.havePipe) {
+        Pipe *pipe = pipeByKey(&parseResult.assignedPipeKey,false);
+        if (pipe) {
+            pipe->client_addr = client_addr;
         } else {
-            printf("missing pipe id\n");
-            exit(2);
+            printf("could not deduct pipe id\n");
         }
-        unlockList(&pipes);
+    } else {
+        printf("missing pipe id\n");
+        exit(2);
+    }
+    unlockUuidMap(&pipes);
 
-        if (parseResult->message) {
-            printf("response using(%s)\n",parseResult->message);
+    if (parseResult.message.data) {
+        printf("response using(%s)\n",parseResult.message.data);
 
-            printf("run udpsend from parent thread\n");
-            
-            udpsend(parseResult->message,&client_addr,addr_len); // #todo
-            
-            printf("run udpsend from parent thread after\n");
-            free(parseResult->message);
+        printf("run udpsend from parent thread\n");
+        
+        // borrowed from the builder, the reliability layer keeps its own copy if it retransmits
+        udpsendSocket(fd,parseResult.message,&client_addr); // #todo
+        
+        printf("run udpsend from parent thread after\n");
+    }
+
+    if (message) {
+        free(assembled);
+        removePartialMessage(reassembly, message);
+    }
+}
+
+void *udpserver_thread(void *arg) {
+
+    Setup *setup = (Setup*)arg;
+
+    createUdpSocket(setup);
+
+    GramRing grams;
+    if (!initGramRing(&grams, GRAMRING_SIZE, MAX_UDP_MSG_SIZE)) {
+        printf("error: could not allocate the gram buffers\n");
+        exit(1);
+    }
+
+    struct pollfd pfds[2];
+    pfds[0].fd = sockfd;
+    pfds[0].events = POLLIN;
+    pfds[1].fd = udpTimers.timerFd;
+    pfds[1].events = POLLIN;
+    int nfds = udpTimers.timerFd == -1 ? 1 : 2;
+
+    while (1) {
+        // wait for a gram or for the next reassembly deadline
+        pfds[0].revents = 0;
+        pfds[1].revents = 0;
+        if (poll(pfds, nfds, nfds == 1 ? timerWheelTimeout(&udpTimers) : -1) == -1) {
+            if (errno != EINTR)
+                perror("poll");
+            continue;
+        }
+        if (nfds == 1 || pfds[1].revents & POLLIN)
+            runTimers(&udpTimers);
+        if (!(pfds[0].revents & POLLIN))
+            continue;
+
+        // Receive the messages queued up since, up to a ring full
+        int count = receiveGrams(&grams, sockfd, MSG_DONTWAIT);
+        if (getpid()!=parentPid) {
+            continue;
+        }
+        if (count == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("recvmmsg"); // #todo
+            //exit(1); // or break; // #todo
+            //break;
+            continue; // in case of non blocking
         }
-        free(parseResult);
 
-        free(completemsg);
-        invalidateRQMSG(rqmsg);
-        
+        for (int n = 0; n < count; n++) {
+            unsigned int num_bytes = 0;
+            char *buffer = ringGram(&grams, n, &num_bytes);
+            onDatagram(sockfd,&reassembly,buffer,num_bytes,*ringGramSender(&grams, n));
+        }
     }
 
-    //free(buffer);
     //close(sockfd);
+    cleanupGramRing(&grams);
 
     return NULL;
 }
@@ -1453,6 +2928,78 @@ bool loadConfigurationFile(const char *filename, Setup *setup) {
             setup->requestTtl = request_ttl_elem->IntText();
         }
 
+        // keep-alive is only implemented by the event loops, the fork engine closes after every response
+        tinyxml2::XMLElement* keepalive_timeout_elem = sc_elem->FirstChildElement("keepalive_timeout");
+        if (!keepalive_timeout_elem) {
+            setup->keepAliveTimeout = 5; // default if no setup
+        } else {
+            setup->keepAliveTimeout = keepalive_timeout_elem->IntText();
+        }
+
+        tinyxml2::XMLElement* max_idle_connections_elem = sc_elem->FirstChildElement("max_idle_connections");
+        if (!max_idle_connections_elem) {
+            setup->maxIdleConnections = setup->maxConnections; // default if no setup
+        } else {
+            setup->maxIdleConnections = max_idle_connections_elem->IntText();
+        }
+
+        // bounds of the reassembly of messages out of grams, split between the shards when sharding
+        tinyxml2::XMLElement* max_partial_messages_elem = sc_elem->FirstChildElement("max_partial_messages");
+        if (!max_partial_messages_elem) {
+            setup->maxPartialMessages = REASSEMBLY_DEFAULT_MESSAGES; // default if no setup
+        } else {
+            setup->maxPartialMessages = max_partial_messages_elem->IntText();
+        }
+
+        tinyxml2::XMLElement* max_partial_memory_elem = sc_elem->FirstChildElement("max_partial_memory");
+        if (!max_partial_memory_elem) {
+            setup->maxPartialMemory = REASSEMBLY_DEFAULT_MEMORY; // default if no setup
+        } else {
+            setup->maxPartialMemory = max_partial_memory_elem->Int64Text();
+        }
+
+        setup->engine = ENGINE_FORK;
+        tinyxml2::XMLElement* engine_elem = sc_elem->FirstChildElement("engine");
+        if (engine_elem && engine_elem->GetText()) {
+            if (strcmp(engine_elem->GetText(),"epoll")==0) {
+#ifdef SC_ENGINE_EPOLL
+                setup->engine = ENGINE_EPOLL;
+#else
+                printf("Warning: epoll engine not available on this platform, using fork\n");
+#endif
+            } else if (strcmp(engine_elem->GetText(),"io_uring")==0) {
+#ifdef SC_ENGINE_URING
+                setup->engine = ENGINE_URING;
+#else
+                printf("Warning: io_uring engine not available on this platform, using fork\n");
+#endif
+            } else if (strcmp(engine_elem->GetText(),"fork")!=0) {
+                printf("Warning: unknown engine(%s), using fork\n",engine_elem->GetText());
+            }
+        }
+
+        tinyxml2::XMLElement* engine_threads_elem = sc_elem->FirstChildElement("engine_threads");
+        if (!engine_threads_elem) {
+            setup->engineThreads = 1; // default if no setup
+        } else {
+            setup->engineThreads = engine_threads_elem->IntText();
+            if (setup->engineThreads < 1)
+                setup->engineThreads = 1;
+        }
+
+        // optional, needs to be known before the services are set up (per shard request tables)
+        setup->sharding = false;
+        setup->nshards = 1;
+        tinyxml2::XMLElement* sharding_elem = sc_elem->FirstChildElement("sharding");
+        if (sharding_elem && sharding_elem->GetText() && strcmp(sharding_elem->GetText(),"yes")==0) {
+            if (setup->engine == ENGINE_FORK) {
+                printf("Warning: sharding needs the epoll or io_uring engine, ignoring\n");
+            } else {
+                setup->sharding = true;
+                setup->nshards = setup->engineThreads;
+            }
+        }
+
         tinyxml2::XMLElement* listener_elem = sc_elem->FirstChildElement("listener");
         if (!listener_elem) {
             printf("Error: could not find listener element\n");
@@ -1476,6 +3023,13 @@ bool loadConfigurationFile(const char *filename, Setup *setup) {
             }
         }
 
+        tinyxml2::XMLElement* gram_size_elem = listener_elem->FirstChildElement("gram_size");
+        setup->gramSize = gram_size_elem ? gram_size_elem->IntText() : PATHMTU_AUTO;
+        tinyxml2::XMLElement* fec_elem = listener_elem->FirstChildElement("fec");
+        setup->fec = !fec_elem || !fec_elem->GetText() || strcmp(fec_elem->GetText(),"no")!=0;
+        tinyxml2::XMLElement* wire_elem = listener_elem->FirstChildElement("wire");
+        setup->binaryWire = !wire_elem || !wire_elem->GetText() || strcmp(wire_elem->GetText(),"xml")!=0;
+
         tinyxml2::XMLElement* services_elem = sc_elem->FirstChildElement("services");
         if (!services_elem) {
             printf("Error: could not find services element\n");
@@ -1503,8 +3057,13 @@ bool loadConfigurationFile(const char *filename, Setup *setup) {
             }
 
             const char* uuid = uuid_elem->GetText();
-            if (strlen(uuid)!=36) {
-                printf("invalid service id(%s)\n",uuid);
+            Uuid key;
+            if (!parseUuid(uuid,&key)) {
+                printf("invalid service id(%s)\n",uuid ? uuid : "");
+                continue;
+            }
+            if (uuidMapGet(&setup->servicesById,&key,false)) {
+                printf("duplicate service id(%s)\n",uuid);
                 continue;
             }
             const char* name = name_elem->GetText(); // #todo - use for service name
@@ -1516,6 +3075,8 @@ bool loadConfigurationFile(const char *filename, Setup *setup) {
             int service_max_connections = 0;
             int service_request_buffer = 0;
             int service_request_ttl = 0;
+            int service_keepalive_timeout = 0;
+            int service_max_idle_connections = 0;
 
             tinyxml2::XMLElement* service_max_connections_elem = services_elem->FirstChildElement("max_connections");
             if (!service_max_connections_elem) {
@@ -1538,16 +3099,33 @@ bool loadConfigurationFile(const char *filename, Setup *setup) {
                 service_request_ttl = service_request_ttl_elem->IntText();
             }
 
+            tinyxml2::XMLElement* service_keepalive_timeout_elem = service_elem->FirstChildElement("keepalive_timeout");
+            if (!service_keepalive_timeout_elem) {
+                service_keepalive_timeout = setup->keepAliveTimeout; // default if no setup
+            } else {
+                service_keepalive_timeout = service_keepalive_timeout_elem->IntText();
+            }
+
+            tinyxml2::XMLElement* service_max_idle_connections_elem = service_elem->FirstChildElement("max_idle_connections");
+            if (!service_max_idle_connections_elem) {
+                service_max_idle_connections = setup->maxIdleConnections; // default if no setup
+            } else {
+                service_max_idle_connections = service_max_idle_connections_elem->IntText();
+            }
+
             // #todo - implement initService() with arguments
 
             Service *service = (Service*)malloc(sizeof(Service));
             
-            initService(service,uuid,name,service_port);
+            initService(service,uuid,name,service_port,setup->nshards);
 
             // optionals? #todo - include in service initialization
             service->maxConnections = service_max_connections;
             service->requestBuffer = service_request_buffer;
             service->requestTtl = service_request_ttl;
+            service->keepAliveTimeout = service_keepalive_timeout;
+            service->maxIdleConnections = service_max_idle_connections;
+            service->idleConnections = 0;
             service->pipeId = NULL; // #todo
             // todo
             service->inaddrAny = false;
@@ -1561,13 +3139,14 @@ bool loadConfigurationFile(const char *filename, Setup *setup) {
             Node *node = (Node*)malloc(sizeof(Node));
             node->data = service;
             addNode(&setup->services,node,false); // list locked around loop
+            uuidMapPut(&setup->servicesById,&service->key,service,false);
         }
         unlockList(&setup->services);
 
     return true;
 }
 
-bool initService(Service *service, const char *uuid, const char *name, int port) {
+bool initService(Service *service, const char *uuid, const char *name, int port, int nshards) {
     if (!service || !uuid || !name) {
         verbose("error: missing attributes to register service\n");
         return false;
@@ -1575,9 +3154,14 @@ bool initService(Service *service, const char *uuid, const char *name, int port)
     
     service->id = (const char*)malloc(37);
     strcpy((char*)service->id,uuid);
+    parseUuid(service->id,&service->key);
     service->port = port; // todo - add checks prior
+    service->listenerFd = -1;
 
-    initLinkedList(&service->requests,true);
+    service->nshards = nshards;
+    service->requests = (SlotMap*)malloc(sizeof(SlotMap)*nshards);
+    for (int shard = 0; shard < nshards; shard++)
+        initSlotMap(&service->requests[shard],SC_MAX_REQUESTS/nshards+1,SLOTMAP_USEMUTEX);
 
     return true;
 }
@@ -1599,18 +3183,48 @@ bool runSetup(Setup *setup) {
     if (!setup)
         return false;
 
-    pthread_t watchdog_thread;
-    if (pthread_create(&watchdog_thread, NULL, watchdog, NULL) != 0) {
-        perror("pthread_create");
-        return false;
+    // the event loops keep the deadlines of their requests themselves
+    if (setup->engine == ENGINE_FORK) {
+        initTimerWheel(&requestTimers, TIMER_TICK_MS, TIMERWHEEL_USEMUTEX);
+        pthread_t watchdog_thread;
+        if (pthread_create(&watchdog_thread, NULL, watchdog, NULL) != 0) {
+            perror("pthread_create");
+            return false;
+        }
+    }
+
+#ifdef SC_ENGINE_URING
+    if (setup->engine == ENGINE_URING) {
+        // fall back to epoll if the kernel (or a seccomp policy) doesn't let us use io_uring
+        Uring probe;
+        if (!initUring(&probe, 2)) {
+            printf("Warning: io_uring not available, using the epoll engine\n");
+            setup->engine = ENGINE_EPOLL;
+        } else {
+            cleanupUring(&probe);
+        }
     }
+#endif
 
+    void *(*udpThread)(void*) = udpserver_thread;
+#ifdef SC_ENGINE_URING
+    if (setup->engine == ENGINE_URING)
+        udpThread = udpserver_uring_thread;
+#endif
     pthread_t server_thread;
-    if (pthread_create(&server_thread, NULL, udpserver_thread, setup) != 0) {
+    // shards receive grams on their own sockets
+    if (!setup->sharding && pthread_create(&server_thread, NULL, udpThread, setup) != 0) {
         perror("pthread_create");
         return false;
     }
 
+#ifdef SC_ENGINE_EPOLL
+    if (setup->engine == ENGINE_EPOLL || setup->engine == ENGINE_URING) {
+        printf("running %d event loop(s)\n",setup->engineThreads);
+        return runEventLoops(setup);
+    }
+#endif
+
     Node* current = setup->services.head;
     while (current != NULL) {
         Service *service = (Service*)current->data;
@@ -1643,30 +3257,38 @@ int main(int argc, char *argv[]) {
     uuid4_init();
 
     initLinkedList(&globalSetup.services,LIST_USEMUTEX);
+    initUuidMap(&globalSetup.servicesById,16,UUIDMAP_NOMUTEX);
     if (!loadConfigurationFile(argv[1],&globalSetup)) {
         printf("Error: failed to load configuration file\n");
         return 1;
     }
+    initPathMtu(&pathMtu,globalSetup.gramSize);
+    // message ids start somewhere else on every run, so that an SP doesn't take them for ones it already has
+    msgid = (sig_atomic_t)(getCurrentTimeMillis() & 0x3fffffff);
+    if (!initOutbound(&outbound,0,globalSetup.fec)) {
+        printf("Error: failed to start retransmissions\n");
+        return 1;
+    }
 
     srand(time(NULL));
 
     parentPid = getpid();
 
     //initLinkedList(&list,LIST_USEMUTEX);
-    initLinkedList(&pipes,LIST_USEMUTEX);
+    initUuidMap(&pipes,16,UUIDMAP_USEMUTEX);
 
     // Create and open the named semaphore
     char *randomStr = mkrndstr(8);
     char *semName = (char*)malloc(14);
     snprintf(semName,13,"/sem_%s",randomStr);
     free(randomStr);
-    free(semName);
 
     binarySemaphore = sem_open(semName, O_CREAT, 0644, 1);
     if (binarySemaphore == SEM_FAILED) {
         perror("sem_open");
         exit(EXIT_FAILURE);
     }
+    free(semName);
 
     // Set up the signal handler for SIGINT (Ctrl+C)
     //signal(SIGTERM, handleSignal);
@@ -1683,8 +3305,19 @@ int main(int argc, char *argv[]) {
     //    usleep(100000); // Sleep for 100 ms (adjust as needed)
     //}
 
-    while(1)
-        sleep(1);
+    ReassemblyStats lastStats = reassemblyStats;
+    ReliabilityStats lastReliability = reliabilityStats;
+    while(1) {
+        sleep(REASSEMBLY_STATS_INTERVAL);
+        if (memcmp(&lastStats,&reassemblyStats,sizeof(lastStats))) {
+            lastStats = reassemblyStats;
+            printReassemblyStats();
+        }
+        if (memcmp(&lastReliability,&reliabilityStats,sizeof(lastReliability))) {
+            lastReliability = reliabilityStats;
+            printReliabilityStats();
+        }
+    }
     
     //printf("return from process\n");
 
@@ -31,6 +31,13 @@
 #include <semaphore.h>
 #include <tinyxml2.h>
 #include "msggram.hpp"
+#include "reassembly.hpp"
+#include "reliability.hpp"
+#include "pathmtu.hpp"
+#include "wire.hpp"
+#include "buffer.hpp"
+#include "envelope.hpp"
+#include "gramring.hpp"
 #include <string.h>
 #include "base64.hpp"
 #include <signal.h>
@@ -39,19 +46,19 @@
 #include "time.hpp"
 #include "common.hpp"
 #include <arpa/inet.h>
-#include <stdarg.h>
+#include <errno.h>
 
 #define NMSG_CONSTRUCTS 100
+#define SP_REASSEMBLY_TTL_MS 3000 // #todo - add a TTL param into SP as is in SC
 #define UDP_BUFFER_SIZE 1024*64
 #define TCP_READ_BUFFER_SIZE 4096 // 64*1024
 
 #define _DYNAMIC_TIMEOUT_DEFAULT_SEC 3 // in seconds
 #define _DYNAMIC_TIMEOUT_DEFAULT_USEC 0 // in milliseconds
 
-RQMSG inrqmsgs[NMSG_CONSTRUCTS]; // max number of messages we reconstruct at any given time
-
 typedef struct SpService {
     const char id[37]; // UUID
+    Uuid key; // id parsed
     bool registered; // is the service registered at SC?
 
     int port;
@@ -60,125 +67,92 @@ typedef struct SpService {
 
 typedef struct SpPipe {
     const char id[37]; // UUID
+    Uuid key; // id parsed, once the SC assigned it
     int sockfd;
     struct sockaddr_in consumerAddr;
     socklen_t addrLen;
     LinkedList services;
     pthread_mutex_t sendMutex;
+    unsigned long long msgid; // last outgoing message, a sharded SC steers grams to its shards by it
+    LinkedList streams; // SpRequest that the SC forwards in parts
+    ReassemblyTable reassembly; // messages being put together out of grams, only used by udpreceive_thread
+    PathMtu pathMtu; // size of the grams sent to the SC, <gram_size> of the pipe
+    bool fec; // parity grams along when the grams to the SC get lost, <fec> of the pipe
+    Outbound outbound; // messages sent to the SC until it acknowledges them
+    bool offerBinary; // ask the SC for the binary frames (see wire.hpp), <wire> of the pipe
+    bool binary; // the SC took them, requests & responses are wire frames from then on
     bool initialized; // initialized
 } SpPipe;
 
 typedef struct SpSetup {
     LinkedList pipes;
+    int maxPartialMessages; // per pipe
+    long long maxPartialMemory;
 } SpSetup;
 
+typedef struct SpRequestPart {
+    int part;
+    bool more; // not the last part
+    char *data; // decoded
+    size_t len;
+} SpRequestPart;
+
 // #todo - we shouldn't be holding another instance of the XML
 typedef struct SpRequest {
     SpService *service;
     SpPipe *pipe;
     pthread_t thread_id;
-    char *request_id;
-    char *payload;
+    long long requestId;
+    char *payload; // decoded, handed over to runServiceRequest
+    size_t payloadLen;
+    // a request the SC forwards in parts while it is still reading it from the consumer
+    bool streamed;
+    int nextPart; // next part to send to the service
+    LinkedList parts; // SpRequestPart that arrived but weren't sent yet
+    pthread_cond_t partsCond;
 } SpRequest;
 
 SpSetup globalSpSetup;
 
-char* dynamic_sprintf(const char* format, ...);
-void udpsend(SpPipe *pipe, const char *message);
+void udpsend(SpPipe *pipe, Slice message);
 void *udpreceive_thread(void *arg);
 bool runPipe(SpPipe *pipe);
 bool loadConfigurationFile(const char *filename, SpSetup *setup);
 void runServiceRequest(SpRequest *sprequest);
+bool nextRequestPart(SpRequest *sprequest, char **data, size_t *len, bool *more);
+void addRequestPart(SpPipe *pipe, SpService *service, long long requestId, int part, bool more, char *data, size_t len);
+void closeRequestStream(SpRequest *sprequest);
 void* processRequest_thread(void* requestptr);
 void onMsg(SpPipe *pipe, const char *payload, int pl_len);
+void onWireFrame(SpPipe *pipe, const char *data, size_t len);
+void onDatagram(SpPipe *pipe, const char *buffer, unsigned int num_bytes);
+void startRequest(SpPipe *pipe, SpService *service, long long requestId, char *payload, size_t payloadLen);
+char *decodePayload(const char *text, size_t *len);
 
-char* dynamic_sprintf(const char* format, ...) {
-    printf("dynamic_sprintf\n");
-    va_list args;
-    int len;
-
-    va_start(args, format);
-
-    // compute the complete length
-    len = vsnprintf(NULL, 0, format, args);
-
-    // allocate memmory+1
-    char* buffer = (char*)malloc(len + 1);
-    if (!buffer) {
-        va_end(args);
-        return NULL;
-    }
-
-    // write to the allocated buffer
-    vsnprintf(buffer, len + 1, format, args);
-
-    va_end(args);
-
-    printf("dynamic_sprintf end\n");
-    return buffer; // free upstream
-}
-
-void udpsend(SpPipe *pipe, const char *message) {
-    verbose("udpsend message(%s)\n",message);
+void udpsend(SpPipe *pipe, Slice message) {
+    verbose("udpsend message(%.*s)\n",isWireFrame(message.data,message.len) ? 6 : (int)message.len,isWireFrame(message.data,message.len) ? "binary" : message.data);
 
     pthread_mutex_lock(&pipe->sendMutex);
 
-    int msgidcopy = 1;
-
-    unsigned int gramsize = (64*1024)-1024;
-    unsigned int msglen = (unsigned int)strlen(message);
-    unsigned int countdown = msglen;
-    unsigned int size = gramsize;
-    unsigned int gramindex = 0;
-    unsigned int dataindex = 0;
-    unsigned int ngrams = 0;
-    unsigned int dataoffset = 0;
-
-    while(countdown!=0) {
-        if (countdown<size)
-            size = countdown;
-        countdown-=size;
-        ngrams++;
-    }
-    size = gramsize;
-    countdown = msglen;
-
-    while(countdown!=0) {
-        if (countdown<size)
-            size = countdown;
-
-        // #todo - change from just raw pointing to a position in data to using msggram.hpp - RQMSGRAW
-        unsigned int index = 0;
-        char *rqmsgraw = (char*)malloc(size+1024);
-        memcpy(rqmsgraw,&msgidcopy,sizeof(unsigned long long));
-        index+=sizeof(unsigned long long);
-        memcpy(rqmsgraw+index,&ngrams,sizeof(unsigned int));
-        index+=sizeof(unsigned int);
-        unsigned int thisindex = gramindex;
-        memcpy(rqmsgraw+index,&thisindex,sizeof(unsigned int));
-        index+=sizeof(unsigned int);
-        dataoffset = index;
-        memcpy(rqmsgraw+index,message+dataindex,size);
-        index+=size;
-        rqmsgraw[index]=0x00;
-
-        verbose("    sending msgid(%d) ngrams(%d) index(%d) data(%s) size(%d)\n",msgidcopy,ngrams,thisindex,rqmsgraw+dataoffset,index);
-        
-        if (sendto(pipe->sockfd, rqmsgraw, index, 0, (struct sockaddr *)&pipe->consumerAddr, pipe->addrLen) == -1) {
-            perror("sendto");
+    // a gram too large for the path fails as a whole, the message then goes again in smaller grams
+    // under a new msgid & the grams sent so far expire at the receiver
+    int attempt;
+    for (attempt = 0; attempt < 3; attempt++) {
+        unsigned long long msgidcopy = ++pipe->msgid; // never 0, that marks a free reassembly slot
 
+        int error = sendMessage(&pipe->outbound,pipe->sockfd,&pipe->consumerAddr,msgidcopy,message,gramPayload(&pipe->pathMtu,&pipe->consumerAddr));
+        if (error == 0)
+            break;
+        if (error != EMSGSIZE) {
+            errno = error;
+            perror("sendto");
             verbose("failed to send data\n");
             exit(EXIT_SUCCESS); // #todo - evaluate
-        } else {
-            
         }
-
-        free(rqmsgraw);
-
-        countdown-=size;
-        gramindex++;
-        dataindex+=size;
+        pathMtuExceeded(&pipe->pathMtu,&pipe->consumerAddr);
     }
+    if (attempt == 3)
+        printf("warning: could not fit message into the path MTU, dropping it\n");
     pthread_mutex_unlock(&pipe->sendMutex);
 
     verbose("udpsend finish\n");
@@ -188,11 +162,18 @@ void runServiceRequest(SpRequest *sprequest) {
     if (!sprequest)
         return;
 
-    char *decoded_request_payload = base64Decode(sprequest->payload);
-
-    if (!decoded_request_payload) {    
-        printf("error parsing XML message & payload payload(%s)\n",sprequest->payload);
-        return;
+    char *decoded_request_payload = NULL;
+    size_t decoded_len = 0;
+    bool more = false;
+
+    if (sprequest->streamed) {
+        // don't connect to the service before the request starts arriving
+        if (!nextRequestPart(sprequest,&decoded_request_payload,&decoded_len,&more))
+            return;
+    } else {
+        decoded_request_payload = sprequest->payload;
+        decoded_len = sprequest->payloadLen;
+        sprequest->payload = NULL;
     }
 
     //
@@ -247,62 +228,82 @@ void runServiceRequest(SpRequest *sprequest) {
         return;
     }
         
-    // Send payload to server
-    if (send(sock, decoded_request_payload, strlen(decoded_request_payload), 0) < 0) {
-        perror("send error");
+    // Send payload to server, a streamed request part by part as the parts arrive
+    while (1) {
+        if (send(sock, decoded_request_payload, decoded_len, 0) < 0) {
+            perror("send error");
+            free(decoded_request_payload);
+            close(sock);
+            return;
+        }
+        if (!more)
+            break;
+        free(decoded_request_payload);
+        decoded_request_payload = NULL;
+        if (!nextRequestPart(sprequest,&decoded_request_payload,&decoded_len,&more)) {
+            close(sock);
+            return;
+        }
+    }
+
+    // the frame header goes in front of the response once we know its length, so the response is
+    // read in place & sent on from the same memory
+    Buffer *response = newBuffer(sizeof(WIRE_HEADER)+TCP_READ_BUFFER_SIZE);
+    if (!response) {
         free(decoded_request_payload);
         close(sock);
         return;
     }
-
-    char* buffer = new char[TCP_READ_BUFFER_SIZE + 1]; // +1 for null terminator
+    response->len = sizeof(WIRE_HEADER);
     ssize_t bytesRead = 0;
     int totalBytesRead = 0;
-    int bufferSize = TCP_READ_BUFFER_SIZE + 1; // +1 for null terminator
     int cycle = 0; // #todo - limit by number of cycles too
 
-    while ((bytesRead = read(sock, buffer + totalBytesRead, bufferSize - totalBytesRead - 1)) > 0) { // -1 to account for null terminator
+    while ((bytesRead = read(sock, response->data + response->len, TCP_READ_BUFFER_SIZE)) > 0) {
         totalBytesRead += bytesRead;
+        response->len += bytesRead;
 
         // Null-terminate the buffer at the current end of data
-        buffer[totalBytesRead] = '\0'; 
+        response->data[response->len] = '\0';
 
-        // Check if the buffer is full (excluding the null terminator)
-        if (totalBytesRead == bufferSize - 1) {
+        // Check if the buffer is full
+        if (bytesRead == TCP_READ_BUFFER_SIZE) {
             // #todo - make max size consistent - this is just a very simple calculation
             if (totalBytesRead + TCP_READ_BUFFER_SIZE > TCP_READ_BUFFER_SIZE * (NMSG_CONSTRUCTS-1)) {
                 break;
             }
-            // Resize the buffer to make it larger
-            bufferSize += TCP_READ_BUFFER_SIZE;
-            char* newBuffer = new char[bufferSize + 1]; // +1 for null terminator
-            memcpy(newBuffer, buffer, totalBytesRead);
-            delete[] buffer;
-            buffer = newBuffer;
+            // room for the next read, the buffer grows geometrically so the response is copied only a few times
+            if (!reserveBuffer(response, response->len + TCP_READ_BUFFER_SIZE))
+                break;
         } else {
             // In case the bytes read is smaller than the initial buffer, assume that we got everything
             break;
         }
         cycle++;
     }
-
-    char *b64 = base64Encode(buffer);
-    if (b64) {
+    char *buffer = response->data + sizeof(WIRE_HEADER);
+
+    if (sprequest->pipe->binary) {
+        writeWireHeader(response->data,WIRE_KIND_RESPONSE,0,0,sprequest->requestId,&sprequest->pipe->key,&sprequest->service->key,totalBytesRead);
+        printf("respond: request_id(%lld) length(%d)\n",sprequest->requestId,totalBytesRead);
+        Slice frame = sliceBuffer(response,0,response->len);
+        udpsend(sprequest->pipe,frame);
+        releaseSlice(&frame);
+    } else {
         //const char *request_id = sprequest->service_elem->FirstChildElement("request")->Attribute("id");
-        char *responsePayload = dynamic_sprintf("<?xml version=\"1.0\" encoding=\"UTF-8\"?><message><pipe_id>%s</pipe_id><services><service uuid=\"%s\" name=\"service_name\" type=\"tcp\"><response request_id=\"%s\"><payload>%s</payload></response></service></services></message>\n",sprequest->pipe->id,sprequest->service->id,sprequest->request_id,b64);
-        if (responsePayload) {
-            printf("respond:(%s)\n",responsePayload);
-            udpsend(sprequest->pipe,responsePayload);
-            free(responsePayload);
+        Slice message = responseEnvelope(textSlice(sprequest->pipe->id),textSlice(sprequest->service->id),sprequest->requestId,buffer,totalBytesRead);
+        if (message.data) {
+            printf("respond:(%s)\n",message.data);
+            udpsend(sprequest->pipe,message);
+            releaseSlice(&message);
         } else {
             // #todo - add message if needed
             printf("error: could not construct response\n");
         }
-        free(b64);
     }
 
     free(decoded_request_payload);
-    delete[] buffer;
+    releaseBuffer(response);
     close(sock);
 }
 
@@ -313,17 +314,229 @@ void* processRequest_thread(void* requestptr) {
 
     SpRequest *sprequest = (SpRequest*)requestptr;
     runServiceRequest(sprequest);
+    if (sprequest->streamed)
+        closeRequestStream(sprequest);
 
-    free(sprequest->request_id);
     free(sprequest->payload);
     free(sprequest);
 
     return NULL;
 }
 
+/** wait for the next part of a streamed request & take its data, false if it didn't arrive in time
+*/
+bool nextRequestPart(SpRequest *sprequest, char **data, size_t *len, bool *more) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += _DYNAMIC_TIMEOUT_DEFAULT_SEC;
+
+    lockList(&sprequest->parts);
+    while (1) {
+        Node *current = sprequest->parts.head;
+        while (current != NULL && ((SpRequestPart*)current->data)->part != sprequest->nextPart)
+            current = current->next;
+
+        if (current) {
+            SpRequestPart *requestPart = (SpRequestPart*)current->data;
+            removeNode(&sprequest->parts,current,false);
+            unlockList(&sprequest->parts);
+
+            *data = requestPart->data;
+            *len = requestPart->len;
+            *more = requestPart->more;
+            sprequest->nextPart++;
+
+            free(requestPart);
+            return true;
+        }
+
+        if (pthread_cond_timedwait(&sprequest->partsCond,&sprequest->parts.mutex,&deadline) == ETIMEDOUT) {
+            unlockList(&sprequest->parts);
+            printf("warning: part(%d) of request(%lld) didn't arrive in time\n",sprequest->nextPart,sprequest->requestId);
+            return false;
+        }
+    }
+}
+
+/** hand a part of a streamed request over to the thread sending it to the service. The thread is started
+* with whichever part arrives first, since UDP doesn't keep them in order. Takes ownership of data.
+*/
+void addRequestPart(SpPipe *pipe, SpService *service, long long requestId, int part, bool more, char *data, size_t len) {
+    lockList(&pipe->streams);
+
+    SpRequest *sprequest = NULL;
+    Node *current = pipe->streams.head;
+    while (current != NULL) {
+        SpRequest *stream = (SpRequest*)current->data;
+        if (stream->service == service && stream->requestId == requestId) {
+            sprequest = stream;
+            break;
+        }
+        current = current->next;
+    }
+
+    if (!sprequest) {
+        sprequest = (SpRequest*)malloc(sizeof(SpRequest));
+        sprequest->service = service;
+        sprequest->pipe = pipe;
+        sprequest->requestId = requestId;
+        sprequest->payload = NULL;
+        sprequest->payloadLen = 0;
+        sprequest->streamed = true;
+        sprequest->nextPart = 0;
+        initLinkedList(&sprequest->parts,LIST_USEMUTEX);
+        pthread_cond_init(&sprequest->partsCond, NULL);
+
+        Node *node = getNode();
+        node->data = sprequest;
+        addNode(&pipe->streams,node,false);
+
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&sprequest->thread_id, &attr, processRequest_thread, sprequest) != 0) {
+            perror("pthread_create");
+            removeNode(&pipe->streams,node,false);
+            pthread_cond_destroy(&sprequest->partsCond);
+            cleanupLinkedList(&sprequest->parts);
+            free(sprequest);
+            free(data);
+            pthread_attr_destroy(&attr);
+            unlockList(&pipe->streams);
+            return;
+        }
+        pthread_attr_destroy(&attr);
+    }
+
+    SpRequestPart *requestPart = (SpRequestPart*)malloc(sizeof(SpRequestPart));
+    requestPart->part = part;
+    requestPart->more = more;
+    requestPart->data = data;
+    requestPart->len = len;
+    Node *node = getNode();
+    node->data = requestPart;
+
+    lockList(&sprequest->parts);
+    addNode(&sprequest->parts,node,false);
+    pthread_cond_signal(&sprequest->partsCond);
+    unlockList(&sprequest->parts);
+
+    unlockList(&pipe->streams);
+}
+
+/** the streamed request is done, parts arriving from now on start a new (short lived) stream
+*/
+void closeRequestStream(SpRequest *sprequest) {
+    SpPipe *pipe = sprequest->pipe;
+
+    lockList(&pipe->streams);
+    Node *current = pipe->streams.head;
+    while (current != NULL) {
+        if (current->data == sprequest) {
+            removeNode(&pipe->streams,current,false);
+            break;
+        }
+        current = current->next;
+    }
+    unlockList(&pipe->streams);
+
+    current = sprequest->parts.head;
+    while (current != NULL) {
+        SpRequestPart *requestPart = (SpRequestPart*)current->data;
+        free(requestPart->data);
+        free(requestPart);
+        current = current->next;
+    }
+    cleanupLinkedList(&sprequest->parts);
+    pthread_cond_destroy(&sprequest->partsCond);
+}
+
+/** the payload of an XML envelope, base64 decoded
+*/
+char *decodePayload(const char *text, size_t *len) {
+    size_t b64len = strlen(text);
+    char *data = (char*)malloc(base64DecodedLen(b64len)+1);
+    if (!base64DecodeTo(text,b64len,data,len)) {
+        printf("warning: payload isn't base64\n");
+        free(data);
+        return NULL;
+    }
+    data[*len] = 0x00;
+    return data;
+}
+
+/** run a request the SC forwarded in one go on its own thread, takes ownership of payload
+*/
+void startRequest(SpPipe *pipe, SpService *service, long long requestId, char *payload, size_t payloadLen) {
+    SpRequest *sprequest = (SpRequest*)malloc(sizeof(SpRequest));
+    sprequest->service = service;
+    sprequest->pipe = pipe;
+    sprequest->requestId = requestId;
+    sprequest->payload = payload;
+    sprequest->payloadLen = payloadLen;
+    sprequest->streamed = false;
+
+    pthread_attr_t attr;
+    int rc;
+    rc = pthread_attr_init(&attr);
+    rc = pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    if (pthread_create(&sprequest->thread_id, &attr, processRequest_thread, sprequest) != 0) {
+        perror("pthread_create");
+        free(sprequest->payload);
+        free(sprequest);
+    }
+
+    pthread_attr_destroy(&attr);
+}
+
+/** a request in a wire frame (see wire.hpp), no text to parse & the payload is taken as it is
+*/
+void onWireFrame(SpPipe *pipe, const char *data, size_t len) {
+    WIRE_HEADER header;
+    const char *payload = NULL;
+    if (!parseWireFrame(data,len,&header,&payload) || header.kind != WIRE_KIND_REQUEST) {
+        printf("warning: dropping a wire frame we don't understand\n");
+        return;
+    }
+    if (!pipe->initialized || !uuidEqual(&header.pipe,&pipe->key)) {
+        printf("warning: wire frame for another pipe\n");
+        return;
+    }
+
+    lockList(&pipe->services);
+    SpService *service = NULL;
+    for (Node *current = pipe->services.head; current != NULL; current = current->next) {
+        if (uuidEqual(&((SpService*)current->data)->key,&header.service)) {
+            service = (SpService*)current->data;
+            break;
+        }
+    }
+    unlockList(&pipe->services);
+    if (!service) {
+        printf("warning: wire frame for an unknown service\n");
+        return;
+    }
+
+    char *copy = (char*)malloc(header.length+1);
+    memcpy(copy,payload,header.length);
+    copy[header.length] = 0x00;
+    if (header.flags & WIRE_FLAG_PART) {
+        // the SC forwards a request it can't read in one go in parts
+        addRequestPart(pipe,service,header.requestId,header.part,(header.flags & WIRE_FLAG_MORE) != 0,copy,header.length);
+    } else {
+        startRequest(pipe,service,header.requestId,copy,header.length);
+    }
+}
+
 void onMsg(SpPipe *pipe, const char *payload, int pl_len) {
     if (!payload)
         return;
+
+    if (isWireFrame(payload,pl_len)) {
+        onWireFrame(pipe,payload,pl_len);
+        return;
+    }
     
     // #todo - do not do this double, just once
     tinyxml2::XMLDocument doc; // = new tinyxml2::XMLDocument(); // #todo #refactoring - parsing is done twice
@@ -380,42 +593,29 @@ void onMsg(SpPipe *pipe, const char *payload, int pl_len) {
 
                         printf("found service\n");
 
-                        char *request_id = NULL;
+                        bool haveRequest = false;
+                        long long requestId = 0;
                         char *payload = NULL;
+                        size_t payloadLen = 0;
                         tinyxml2::XMLElement *request_elem = service_elem->FirstChildElement("request");
-                        if (request_elem) {
-                            request_id = (char*)malloc(sizeof(request_elem->Attribute("id"))+1);
-                            strcpy(request_id,request_elem->Attribute("id"));
+                        if (request_elem && request_elem->Attribute("id")) {
+                            haveRequest = true;
+                            requestId = atoll(request_elem->Attribute("id"));
                             tinyxml2::XMLElement *payload_elem = request_elem->FirstChildElement("payload");
                             if (payload_elem) {
                                 if (payload_elem->GetText()) {
-                                    payload = (char*)malloc(strlen(payload_elem->GetText())+1);
-                                    strcpy(payload,payload_elem->GetText());
+                                    payload = decodePayload(payload_elem->GetText(),&payloadLen);
                                 }
                             }
                         }
 
-                        if (request_id && payload) {
-                            SpRequest *sprequest = (SpRequest*)malloc(sizeof(SpRequest));
-                            sprequest->service = service;
-                            sprequest->pipe = pipe;
-                            sprequest->request_id = request_id;
-                            sprequest->payload = payload;
-
-                            pthread_attr_t attr;
-                            int rc;
-                            rc = pthread_attr_init(&attr);
-                            rc = pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-                                                    
-                            if (pthread_create(&sprequest->thread_id, &attr, processRequest_thread, sprequest) != 0) {
-                                perror("pthread_create");
-                                free(sprequest);
-                                return;
-                            } else {
-                                //msg->thread_id = thread_id;
-                            }
-
-                            pthread_attr_destroy(&attr);
+                        if (haveRequest && payload && request_elem->Attribute("part")) {
+                            // the SC forwards a request it can't read in one go in parts
+                            const char *more = request_elem->Attribute("more");
+                            addRequestPart(pipe,service,requestId,request_elem->IntAttribute("part"),
+                                more && strcmp(more,"yes")==0,payload,payloadLen);
+                        } else if (haveRequest && payload) {
+                            startRequest(pipe,service,requestId,payload,payloadLen);
                         }
 
                     }
@@ -440,18 +640,23 @@ void onMsg(SpPipe *pipe, const char *payload, int pl_len) {
         return;
     }
     strcpy((char*)pipe->id,pipe_id_element->GetText());
+    parseUuid(pipe->id,&pipe->key);
 
-    printf("Received pipe_id(%s)\n",pipe->id);
+    // the SC answers with the same <wire> if it takes the binary frames we offered
+    tinyxml2::XMLElement* wire_element = doc.FirstChildElement("message")->FirstChildElement("response")->FirstChildElement("wire");
+    pipe->binary = pipe->offerBinary && wire_element && wire_element->GetText() && strcmp(wire_element->GetText(),WIRE_BINARY)==0;
+
+    printf("Received pipe_id(%s) wire(%s)\n",pipe->id,pipe->binary ? WIRE_BINARY : "xml");
 
     // register our services
     Node* current = pipe->services.head;
     while (current != NULL) {
         SpService *service = (SpService*)current->data;
         
-        char *registerServicePayload = dynamic_sprintf("<?xml version=\"1.0\" encoding=\"UTF-8\"?><message><pipe_id>%s</pipe_id><services><service uuid=\"%s\" name=\"service_name\" type=\"tcp\"></service></services></message>\n",pipe->id,service->id);
-        if (registerServicePayload) {
-            udpsend(pipe,registerServicePayload);
-            free(registerServicePayload);
+        Slice message = registerEnvelope(textSlice(pipe->id),textSlice(service->id));
+        if (message.data) {
+            udpsend(pipe,message);
+            releaseSlice(&message);
         } else {
             // #todo - add message if needed
             printf("error: could not construct response\n");
@@ -464,102 +669,66 @@ void onMsg(SpPipe *pipe, const char *payload, int pl_len) {
     
 }
 
+/** a gram from the SC, a message that is a single gram is parsed right where it was received
+*/
+void onDatagram(SpPipe *pipe, const char *buffer, unsigned int num_bytes) {
+    unsigned int completelen = 0;
+    if (onControlGram(&pipe->outbound,&pipe->consumerAddr,buffer,num_bytes))
+        return;
+    const char *single = singleGramData(&pipe->reassembly,&pipe->consumerAddr,buffer,num_bytes,&completelen);
+    PartialMessage *message = NULL;
+    char *completemsg = NULL;
+    if (!single) {
+        // stale messages are dropped as grams arrive
+        message = addGram(&pipe->reassembly,&pipe->consumerAddr,buffer,num_bytes);
+        if (!message)
+            return;
+        printf("in size(%u) ngrams(%d) received(%d)\n",num_bytes,message->rqmsg.ngrams,message->rqmsg.received);
+
+        if (!partialMessageComplete(message))
+            return;
+        completelen = message->rqmsg.size;
+        single = completemsg = dataFromRQMSG(&message->rqmsg);
+    }
+
+    printf("Received message from server: length(%u)\n", num_bytes);
+    //printHex(completemsg,num_bytes);
+    // process message
+
+    onMsg(pipe,single,completelen);
+
+    if (message) {
+        free(completemsg);
+        removePartialMessage(&pipe->reassembly,message);
+    }
+}
+
 void *udpreceive_thread(void *arg) {
     SpPipe *pipe = (SpPipe*)arg;
 
-    socklen_t addr_len;
-    char buffer[UDP_BUFFER_SIZE+1];
-
-    char *completemsg = NULL;
+    GramRing grams;
+    if (!initGramRing(&grams, GRAMRING_SIZE, UDP_BUFFER_SIZE)) {
+        printf("error: could not allocate the gram buffers\n");
+        return NULL;
+    }
 
     while (1) {
-        // Receive a message
-        addr_len = sizeof(pipe->consumerAddr);
-        ssize_t num_bytes = recvfrom(pipe->sockfd, &buffer, UDP_BUFFER_SIZE, 0, (struct sockaddr *)&pipe->consumerAddr, &addr_len);
-        if (num_bytes == -1) {
-            perror("recvfrom");
+        // Receive what has queued up, waiting for at least one message
+        int count = receiveGrams(&grams, pipe->sockfd, MSG_WAITFORONE);
+        if (count == -1) {
+            perror("recvmmsg");
             break;
         }
 
-        buffer[num_bytes] = '\0';
-
-        // put the data in the right format
-        RQMSGRAW *rqmsgraw = (RQMSGRAW*)malloc(sizeof(RQMSGRAW));
-        unsigned int index = 0;
-        memcpy(&rqmsgraw->msgid,buffer,sizeof(unsigned long long));
-        index+=sizeof(unsigned long long);
-        memcpy(&rqmsgraw->ngrams,buffer+index,sizeof(unsigned int));
-        index+=sizeof(unsigned int);
-        memcpy(&rqmsgraw->index,buffer+index,sizeof(unsigned int));
-        index+=sizeof(unsigned int);
-        unsigned int chunksize = num_bytes-index;
-        rqmsgraw->data = (char*)malloc(chunksize+1);
-        memcpy(rqmsgraw->data,buffer+index,chunksize);
-        rqmsgraw->data[chunksize]=0x00;
-        printf("in(%s) size(%d) ngrams(%d)\n",rqmsgraw->data,chunksize,rqmsgraw->ngrams);
-
-        int TTL = 3; // #todo - add a TTL param into SP as is in SC
-
-        RQMSG *rqmsg = NULL;
-        for(int n = 0; n < NMSG_CONSTRUCTS; n++) {
-            
-            if (inrqmsgs[n].timestamp+TTL<time(NULL)) {
-                invalidateRQMSG(&inrqmsgs[n]);
-                continue;
-            }
-            if (!rqmsg) {
-                if (inrqmsgs[n].msgid==rqmsgraw->msgid && !rqmsg) {
-                    rqmsg = &inrqmsgs[n];
-                    //break; // we do not break so that the TTL check continues in this loop
-                }
-            }
-        }
-        if (!rqmsg) {
-            for(int n = 0; n < NMSG_CONSTRUCTS; n++) {
-                if (inrqmsgs[n].msgid==0) {
-                    rqmsg = &inrqmsgs[n];
-                    rqmsg->timestamp = time(NULL);
-                    rqmsg->ngrams = rqmsgraw->ngrams;
-                    rqmsg->msgid = rqmsgraw->msgid;
-                    break;
-                }
-            }
-        }
-        completemsg = NULL;
-        if (rqmsg) {
-            printf("rqmsg ngrams(%d)\n",rqmsg->ngrams);
-            if (rqmsg->grams[rqmsgraw->index].data) {
-                // something went wrong - there shouldn't be data at this index
-                rqmsg = NULL;
-                free(rqmsgraw->data);
-                rqmsgraw->data = NULL;
-            } else {
-                rqmsg->grams[rqmsgraw->index].size = chunksize;
-                rqmsg->grams[rqmsgraw->index].data = rqmsgraw->data; // freed in invalidateRQMSG
-                completemsg = dataFromRQMSG(rqmsg);
-            }
-        } else {
-            printf("warning: didn't find an rqmsg slot\n");
-            free(rqmsgraw->data);
-            rqmsgraw->data = NULL;
+        for (int n = 0; n < count; n++) {
+            unsigned int num_bytes = 0;
+            const char *buffer = ringGram(&grams, n, &num_bytes);
+            pipe->consumerAddr = *ringGramSender(&grams, n);
+            onDatagram(pipe,buffer,num_bytes);
         }
-        //free(rqmsgraw->data);
-        free(rqmsgraw);
-
-        if (!completemsg)
-            continue;
-
-        printf("Received message from server: length(%ld)\n", num_bytes);
-        //printHex(completemsg,num_bytes);
-        // process message
-
-        onMsg(pipe,completemsg,strlen(completemsg)); // #todo - just send the number of bytes we read, don't count again
-
-        free(completemsg);
-        invalidateRQMSG(rqmsg);
-
     }
 
+    cleanupGramRing(&grams);
     return NULL;
 }
 
@@ -585,6 +754,13 @@ bool runPipe(SpPipe *pipe) {
         exit(1);
     }
     pipe->addrLen = sizeof(pipe->consumerAddr);
+    enablePathMtuDiscovery(&pipe->pathMtu,pipe->sockfd);
+    setGramSocketBuffers(pipe->sockfd);
+    pipe->reassembly.fd = pipe->sockfd;
+    if (!initOutbound(&pipe->outbound,0,pipe->fec)) {
+        printf("Error: failed to start retransmissions\n");
+        exit(1);
+    }
     
     pthread_t receiveThread;
 
@@ -601,8 +777,10 @@ bool runPipe(SpPipe *pipe) {
 
     pthread_attr_destroy(&attr);
 
-    const char *msg = "<?xml version=\"1.0\" encoding=\"UTF-8\"?><message><request_pipe_id></request_pipe_id></message>";
-    udpsend(pipe,msg);
+    const char *msg = pipe->offerBinary ?
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?><message><request_pipe_id></request_pipe_id><wire>" WIRE_BINARY "</wire></message>" :
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?><message><request_pipe_id></request_pipe_id></message>";
+    udpsend(pipe,textSlice(msg));
 
     printf("finished\n");
 
@@ -621,6 +799,12 @@ bool loadConfigurationFile(const char *filename, SpSetup *setup) {
         return false;
     }
 
+    // bounds of the reassembly of messages out of grams, for each pipe
+    tinyxml2::XMLElement* max_partial_messages_elem = sp_elem->FirstChildElement("max_partial_messages");
+    setup->maxPartialMessages = max_partial_messages_elem ? max_partial_messages_elem->IntText() : REASSEMBLY_DEFAULT_MESSAGES;
+    tinyxml2::XMLElement* max_partial_memory_elem = sp_elem->FirstChildElement("max_partial_memory");
+    setup->maxPartialMemory = max_partial_memory_elem ? max_partial_memory_elem->Int64Text() : REASSEMBLY_DEFAULT_MEMORY;
+
     tinyxml2::XMLElement* pipes_elem = sp_elem->FirstChildElement("pipes");
     if (!pipes_elem) {
         printf("Error: could not find <pipes> element\n");
@@ -632,6 +816,18 @@ bool loadConfigurationFile(const char *filename, SpSetup *setup) {
         // #todo - add pipe initialization
         initLinkedList(&pipe->services,LIST_USEMUTEX);
         pthread_mutex_init(&pipe->sendMutex, NULL);
+        // message ids start somewhere else on every run, so that the SC doesn't take them for ones it already has
+        pipe->msgid = (unsigned long long)getCurrentTimeMillis() & 0x3fffffff;
+        initLinkedList(&pipe->streams,LIST_USEMUTEX);
+        // acknowledgements go out through the pipe's socket once runPipe created it
+        initReassemblyTable(&pipe->reassembly,setup->maxPartialMessages,setup->maxPartialMemory,SP_REASSEMBLY_TTL_MS,NULL,-1);
+        tinyxml2::XMLElement* gram_size_elem = pipe_elem->FirstChildElement("gram_size");
+        initPathMtu(&pipe->pathMtu,gram_size_elem ? gram_size_elem->IntText() : PATHMTU_AUTO);
+        tinyxml2::XMLElement* fec_elem = pipe_elem->FirstChildElement("fec");
+        pipe->fec = !fec_elem || !fec_elem->GetText() || strcmp(fec_elem->GetText(),"no")!=0;
+        tinyxml2::XMLElement* wire_elem = pipe_elem->FirstChildElement("wire");
+        pipe->offerBinary = !wire_elem || !wire_elem->GetText() || strcmp(wire_elem->GetText(),"xml")!=0;
+        pipe->binary = false;
 
         // parse services
 		tinyxml2::XMLElement* services_elem = pipe_elem->FirstChildElement("services");
@@ -674,6 +870,7 @@ bool loadConfigurationFile(const char *filename, SpSetup *setup) {
             service->port = service_port;
 
             strcpy((char*)service->id,uuid_elem->GetText());
+            parseUuid(service->id,&service->key);
             Node *node = (Node*)malloc(sizeof(Node));
             node->data = service;
             addNode(&pipe->services,node,LIST_USEMUTEX);
@@ -697,8 +894,19 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    while(1)
-        sleep(1);
+    ReassemblyStats lastStats = reassemblyStats;
+    ReliabilityStats lastReliability = reliabilityStats;
+    while(1) {
+        sleep(REASSEMBLY_STATS_INTERVAL);
+        if (memcmp(&lastStats,&reassemblyStats,sizeof(lastStats))) {
+            lastStats = reassemblyStats;
+            printReassemblyStats();
+        }
+        if (memcmp(&lastReliability,&reliabilityStats,sizeof(lastReliability))) {
+            lastReliability = reliabilityStats;
+            printReliabilityStats();
+        }
+    }
 
     return 0;
 }
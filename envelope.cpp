@@ -0,0 +1,305 @@
+/*
+ * Copyright (C) [2023] Milan Kazarka
+ * Email: milan.kazarka.office@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "envelope.hpp"
+#include "wire.hpp"
+#include "base64.hpp"
+
+#define appendLiteral(buffer, text) appendBuffer(buffer, text, sizeof(text)-1)
+
+static const char *findText(const char *from, const char *end, const char *text, size_t len) {
+    if (!from || from >= end)
+        return NULL;
+    return (const char*)memmem(from, end-from, text, len);
+}
+
+#define findLiteral(from, end, text) findText(from, end, text, sizeof(text)-1)
+
+/** the text of <tag>text</tag> between from & end, text runs up to the next '<' (nothing we read
+* contains one). False if there is no such tag.
+*/
+static bool elementText(const char *from, const char *end, const char *open, size_t openlen, Slice *text) {
+    const char *start = findText(from, end, open, openlen);
+    if (!start)
+        return false;
+    start += openlen;
+    const char *stop = (const char*)memchr(start, '<', end-start);
+    if (!stop)
+        return false;
+    *text = borrowSlice(start, stop-start);
+    return true;
+}
+
+#define elementLiteral(from, end, open, text) elementText(from, end, open, sizeof(open)-1, text)
+
+/** the value of name="value" inside the tag that runs from tag to tagEnd
+*/
+static bool attribute(const char *tag, const char *tagEnd, const char *name, size_t namelen, Slice *value) {
+    const char *at = tag;
+    while ((at = findText(at, tagEnd, name, namelen))) {
+        const char *quote = at+namelen;
+        // a whole attribute name, not the end of a longer one
+        if ((at[-1] == ' ' || at[-1] == '\t' || at[-1] == '\n') && quote+1 < tagEnd && quote[0] == '=' && quote[1] == '"') {
+            const char *start = quote+2;
+            const char *stop = (const char*)memchr(start, '"', tagEnd-start);
+            if (!stop)
+                return false;
+            *value = borrowSlice(start, stop-start);
+            return true;
+        }
+        at = quote;
+    }
+    return false;
+}
+
+#define attributeLiteral(tag, tagEnd, name, value) attribute(tag, tagEnd, name, sizeof(name)-1, value)
+
+bool parseEnvelope(const char *data, size_t len, Envelope *envelope) {
+    memset(envelope, 0, sizeof(Envelope));
+    if (!data)
+        return false;
+    const char *end = data+len;
+    const char *message = findLiteral(data, end, "<message>");
+    if (!message)
+        return false;
+    const char *messageEnd = findLiteral(message, end, "</message>");
+    if (!messageEnd)
+        return false;
+
+    // the header elements come before the services, the payloads can't be mistaken for them as they
+    // don't contain '<'
+    const char *services = findLiteral(message, messageEnd, "<services>");
+    const char *headerEnd = services ? services : messageEnd;
+
+    elementLiteral(message, headerEnd, "<pipe_id>", &envelope->pipeId);
+    if (findLiteral(message, headerEnd, "<request_pipe_id")) {
+        envelope->requestPipe = true;
+        elementLiteral(message, headerEnd, "<wire>", &envelope->wire);
+    }
+
+    if (services) {
+        envelope->cursor = services+strlen("<services>");
+        envelope->servicesEnd = findLiteral(envelope->cursor, messageEnd, "</services>");
+        if (!envelope->servicesEnd)
+            return false;
+        envelope->services = true;
+    }
+    return true;
+}
+
+bool nextEnvelopeService(Envelope *envelope, EnvelopeService *service) {
+    memset(service, 0, sizeof(EnvelopeService));
+    if (!envelope->services)
+        return false;
+
+    const char *end = envelope->servicesEnd;
+    const char *tag = envelope->cursor;
+    // <service followed by its attributes, not <services>
+    while ((tag = findLiteral(tag, end, "<service")) && tag[8] != ' ' && tag[8] != '>' && tag[8] != '/')
+        tag += 8;
+    if (!tag)
+        return false;
+    const char *tagEnd = (const char*)memchr(tag, '>', end-tag);
+    if (!tagEnd)
+        return false;
+    attributeLiteral(tag, tagEnd, "uuid", &service->uuid);
+
+    if (tagEnd[-1] == '/') {
+        envelope->cursor = tagEnd+1;
+        return true;
+    }
+    const char *body = tagEnd+1;
+    const char *bodyEnd = findLiteral(body, end, "</service>");
+    if (!bodyEnd)
+        return false;
+    envelope->cursor = bodyEnd+strlen("</service>");
+
+    const char *response = findLiteral(body, bodyEnd, "<response");
+    if (response) {
+        const char *responseEnd = (const char*)memchr(response, '>', bodyEnd-response);
+        if (responseEnd) {
+            service->response = true;
+            attributeLiteral(response, responseEnd, "request_id", &service->requestId);
+            service->payload = elementLiteral(responseEnd, bodyEnd, "<payload>", &service->payloadData);
+        }
+    }
+    return true;
+}
+
+long long envelopeNumber(Slice text) {
+    long long number = 0;
+    bool negative = text.len > 0 && text.data[0] == '-';
+    for (size_t n = negative ? 1 : 0; n < text.len && text.data[n] >= '0' && text.data[n] <= '9'; n++)
+        number = number*10+(text.data[n]-'0');
+    return negative ? -number : number;
+}
+
+#define SEGMENT_LITERAL 0
+#define SEGMENT_FIELD 1 // copied as it is
+#define SEGMENT_BASE64 2 // a field that is encoded on the way
+
+typedef struct EnvelopeSegment {
+    int kind;
+    const char *text; // of a literal
+    size_t len;
+} EnvelopeSegment;
+
+#define LITERAL(text) { SEGMENT_LITERAL, text, sizeof(text)-1 }
+#define FIELD { SEGMENT_FIELD, NULL, 0 }
+#define BASE64 { SEGMENT_BASE64, NULL, 0 }
+
+#define XML_DECLARATION "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+
+// the pipe id is quoted in requests, the SP doesn't read it from there
+static constexpr EnvelopeSegment requestFormat[] = {
+    LITERAL(XML_DECLARATION "<message><pipe_id>\""), FIELD,
+    LITERAL("\"</pipe_id><services><service uuid=\""), FIELD,
+    LITERAL("\"><request id=\""), FIELD,
+    LITERAL("\"><payload>"), BASE64,
+    LITERAL("</payload></request></service></services></message>\n"),
+};
+
+static constexpr EnvelopeSegment requestPartFormat[] = {
+    LITERAL(XML_DECLARATION "<message><pipe_id>\""), FIELD,
+    LITERAL("\"</pipe_id><services><service uuid=\""), FIELD,
+    LITERAL("\"><request id=\""), FIELD,
+    LITERAL("\" part=\""), FIELD,
+    LITERAL("\" more=\""), FIELD,
+    LITERAL("\"><payload>"), BASE64,
+    LITERAL("</payload></request></service></services></message>\n"),
+};
+
+static constexpr EnvelopeSegment responseFormat[] = {
+    LITERAL(XML_DECLARATION "<message><pipe_id>"), FIELD,
+    LITERAL("</pipe_id><services><service uuid=\""), FIELD,
+    LITERAL("\" name=\"service_name\" type=\"tcp\"><response request_id=\""), FIELD,
+    LITERAL("\"><payload>"), BASE64,
+    LITERAL("</payload></response></service></services></message>\n"),
+};
+
+static constexpr EnvelopeSegment registerFormat[] = {
+    LITERAL(XML_DECLARATION "<message><pipe_id>"), FIELD,
+    LITERAL("</pipe_id><services><service uuid=\""), FIELD,
+    LITERAL("\" name=\"service_name\" type=\"tcp\"></service></services></message>\n"),
+};
+
+#define SEGMENTS(format) format, sizeof(format)/sizeof(format[0])
+
+/** fill the fields of format in order, terminated so that it can still be printed
+*/
+static Slice serializeEnvelope(const EnvelopeSegment *format, int nsegments, const Slice *fields) {
+    size_t size = 0;
+    int field = 0;
+    for (int n = 0; n < nsegments; n++) {
+        if (format[n].kind == SEGMENT_LITERAL)
+            size += format[n].len;
+        else if (format[n].kind == SEGMENT_FIELD)
+            size += fields[field++].len;
+        else
+            size += base64EncodedLen(fields[field++].len);
+    }
+
+    Buffer *buffer = newBuffer(size);
+    if (!buffer)
+        return borrowSlice(NULL, 0);
+    char *out = buffer->data;
+    field = 0;
+    for (int n = 0; n < nsegments; n++) {
+        if (format[n].kind == SEGMENT_LITERAL) {
+            memcpy(out, format[n].text, format[n].len);
+            out += format[n].len;
+        } else if (format[n].kind == SEGMENT_FIELD) {
+            if (fields[field].len > 0)
+                memcpy(out, fields[field].data, fields[field].len);
+            out += fields[field++].len;
+        } else {
+            out += base64EncodeTo(fields[field].data, fields[field].len, out);
+            field++;
+        }
+    }
+    *out = 0x00;
+    buffer->len = size;
+
+    Slice message = sliceBuffer(buffer, 0, size);
+    releaseBuffer(buffer);
+    return message;
+}
+
+/** number as decimal digits at the end of digits, which has room for any long long
+*/
+static Slice formatNumber(long long number, char digits[24]) {
+    char *at = digits+24;
+    unsigned long long value = number < 0 ? 0ULL-(unsigned long long)number : (unsigned long long)number;
+    do {
+        *--at = '0'+value%10;
+        value /= 10;
+    } while (value > 0);
+    if (number < 0)
+        *--at = '-';
+    return borrowSlice(at, digits+24-at);
+}
+
+Slice requestEnvelopeXml(Slice pipeId, Slice serviceId, long long requestId, const char *payload, size_t len, int part, bool more) {
+    char requestDigits[24];
+    Slice request = formatNumber(requestId, requestDigits);
+    if (part == 0 && !more) {
+        Slice fields[] = { pipeId, serviceId, request, borrowSlice(payload, len) };
+        return serializeEnvelope(SEGMENTS(requestFormat), fields);
+    }
+    char partDigits[24];
+    Slice fields[] = { pipeId, serviceId, request, formatNumber(part, partDigits), more ? textSlice("yes") : textSlice("no"),
+        borrowSlice(payload, len) };
+    return serializeEnvelope(SEGMENTS(requestPartFormat), fields);
+}
+
+Slice responseEnvelope(Slice pipeId, Slice serviceId, long long requestId, const char *payload, size_t len) {
+    char requestDigits[24];
+    Slice fields[] = { pipeId, serviceId, formatNumber(requestId, requestDigits), borrowSlice(payload, len) };
+    return serializeEnvelope(SEGMENTS(responseFormat), fields);
+}
+
+Slice registerEnvelope(Slice pipeId, Slice serviceId) {
+    Slice fields[] = { pipeId, serviceId };
+    return serializeEnvelope(SEGMENTS(registerFormat), fields);
+}
+
+void beginEnvelopeAck(Buffer *ack, Slice pipeId, bool binary) {
+    ack->len = 0;
+    appendLiteral(ack, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<message>\n<response>\n<pipe_id>");
+    appendBuffer(ack, pipeId.data, pipeId.len);
+    appendLiteral(ack, "</pipe_id>\n");
+    if (binary)
+        appendLiteral(ack, "<wire>" WIRE_BINARY "</wire>\n");
+    ack->data[ack->len] = 0x00;
+}
+
+void addEnvelopeAckService(Buffer *ack, Slice uuid, bool registered) {
+    appendLiteral(ack, "  <service uuid=\"");
+    appendBuffer(ack, uuid.data, uuid.len);
+    if (registered)
+        appendLiteral(ack, "\" status=\"ServiceRouteRegistered\">\n  </service>\n");
+    else
+        appendLiteral(ack, "\">  </service>\n");
+    ack->data[ack->len] = 0x00;
+}
+
+void endEnvelopeAck(Buffer *ack) {
+    appendLiteral(ack, "</response>\n</message>\n");
+    ack->data[ack->len] = 0x00;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) [2023] Milan Kazarka
+ * Email: milan.kazarka.office@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __ENVELOPE_HPP__
+#define __ENVELOPE_HPP__
+
+#include <stdlib.h>
+#include "buffer.hpp"
+
+/** the XML envelopes an SP sends the SC, read in place. The SP only ever sends a few fixed shapes
+* (asking for a pipe, registering services, responses), so instead of building a document we look for
+* the tags we know & hand back views into the message. The views are borrowed, they live as long as
+* the message does & aren't terminated.
+*
+*   <message><request_pipe_id></request_pipe_id><wire>binary</wire></message>
+*   <message><pipe_id>..</pipe_id><services><service uuid=".." ..>
+*       <response request_id=".."><payload>..</payload></response></service>..</services></message>
+*/
+
+typedef struct Envelope {
+    Slice pipeId; // empty if there is none
+    bool requestPipe; // asks for a new pipe
+    Slice wire; // the framing the SP offers with request_pipe_id, empty if none
+    bool services; // has <services>, walk them with nextEnvelopeService
+    const char *cursor; // where the next <service> is looked for
+    const char *servicesEnd;
+} Envelope;
+
+typedef struct EnvelopeService {
+    Slice uuid;
+    bool response; // has <response>
+    Slice requestId;
+    bool payload; // the response has <payload>, which may still be empty
+    Slice payloadData; // base64
+} EnvelopeService;
+
+bool parseEnvelope(const char *data, size_t len, Envelope *envelope); // false if it isn't an envelope we know
+bool nextEnvelopeService(Envelope *envelope, EnvelopeService *service); // false after the last one
+long long envelopeNumber(Slice text); // the digits of an attribute, 0 if there are none
+
+/** the acknowledgement of an envelope, built in a buffer that is reused from message to message so it
+* only grows as far as the largest one. The buffer stays terminated.
+*/
+void beginEnvelopeAck(Buffer *ack, Slice pipeId, bool binary);
+void addEnvelopeAckService(Buffer *ack, Slice uuid, bool registered);
+void endEnvelopeAck(Buffer *ack);
+
+/** the envelopes we send. Each is a constant list of literal pieces with the fields between them, so a
+* message is measured by adding up a few lengths known at compile time & written into one allocation of
+* exactly its size, the payload base64 encoded straight into place. The slices own the messages, they
+* are empty if there is no memory.
+*/
+Slice requestEnvelopeXml(Slice pipeId, Slice serviceId, long long requestId, const char *payload, size_t len, int part, bool more); // SC to SP, part 0 without more is a request in one piece
+Slice responseEnvelope(Slice pipeId, Slice serviceId, long long requestId, const char *payload, size_t len); // SP to SC
+Slice registerEnvelope(Slice pipeId, Slice serviceId); // SP to SC
+
+#endif
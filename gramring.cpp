@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) [2023] Milan Kazarka
+ * Email: milan.kazarka.office@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "gramring.hpp"
+
+bool initGramRing(GramRing *ring, int size, unsigned int bufferSize) {
+    ring->size = size;
+    ring->bufferSize = bufferSize;
+    ring->buffers = (char*)malloc((size_t)size*(bufferSize+1));
+    ring->addrs = (struct sockaddr_in*)calloc(size, sizeof(struct sockaddr_in));
+    ring->iov = (struct iovec*)calloc(size, sizeof(struct iovec));
+    ring->msgs = (struct mmsghdr*)calloc(size, sizeof(struct mmsghdr));
+    if (!ring->buffers || !ring->addrs || !ring->iov || !ring->msgs) {
+        cleanupGramRing(ring);
+        return false;
+    }
+    for (int n = 0; n < size; n++) {
+        ring->iov[n].iov_base = ring->buffers+(size_t)n*(bufferSize+1);
+        ring->iov[n].iov_len = bufferSize;
+        ring->msgs[n].msg_hdr.msg_iov = &ring->iov[n];
+        ring->msgs[n].msg_hdr.msg_iovlen = 1;
+        ring->msgs[n].msg_hdr.msg_name = &ring->addrs[n];
+    }
+    return true;
+}
+
+void cleanupGramRing(GramRing *ring) {
+    free(ring->buffers);
+    free(ring->addrs);
+    free(ring->iov);
+    free(ring->msgs);
+    ring->buffers = NULL;
+    ring->addrs = NULL;
+    ring->iov = NULL;
+    ring->msgs = NULL;
+}
+
+int receiveGrams(GramRing *ring, int fd, int flags) {
+    // the kernel shortens these to what it wrote
+    for (int n = 0; n < ring->size; n++) {
+        ring->msgs[n].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        ring->msgs[n].msg_hdr.msg_flags = 0;
+    }
+    int count;
+    do {
+        count = recvmmsg(fd, ring->msgs, ring->size, flags, NULL);
+    } while (count == -1 && errno == EINTR);
+    return count;
+}
+
+char *ringGram(GramRing *ring, int n, unsigned int *len) {
+    char *gram = (char*)ring->iov[n].iov_base;
+    *len = ring->msgs[n].msg_len;
+    gram[*len] = 0x00;
+    return gram;
+}
+
+const struct sockaddr_in *ringGramSender(GramRing *ring, int n) {
+    return &ring->addrs[n];
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) [2023] Milan Kazarka
+ * Email: milan.kazarka.office@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GRAMRING_HPP__
+#define __GRAMRING_HPP__
+
+#include <stdlib.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define GRAMRING_SIZE 32 // grams taken from a socket with one recvmmsg
+
+/** buffers allocated once for a thread receiving grams, filled by a single recvmmsg with as many grams
+* as the socket has queued (up to size) instead of a recvfrom each. A gram stays in its buffer until
+* the next receiveGrams, so it is handled before the ring is filled again.
+*/
+typedef struct GramRing {
+    int size;
+    unsigned int bufferSize; // largest gram, each buffer has room for a terminator on top
+    char *buffers;
+    struct sockaddr_in *addrs;
+    struct iovec *iov;
+    struct mmsghdr *msgs;
+} GramRing;
+
+bool initGramRing(GramRing *ring, int size, unsigned int bufferSize);
+void cleanupGramRing(GramRing *ring);
+int receiveGrams(GramRing *ring, int fd, int flags); // grams received, -1 with errno. MSG_DONTWAIT or MSG_WAITFORONE for a blocking socket
+char *ringGram(GramRing *ring, int n, unsigned int *len); // the nth gram of the last receiveGrams, terminated
+const struct sockaddr_in *ringGramSender(GramRing *ring, int n);
+
+#endif
@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) [2023] Milan Kazarka
+ * Email: milan.kazarka.office@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include "http.hpp"
+
+void initHttpFraming(HttpFraming *framing) {
+    framing->state = HTTP_FRAMING_HEADERS;
+    framing->header = NULL;
+    framing->headerLen = 0;
+    framing->remaining = 0;
+    framing->chunkExtension = false;
+    framing->lineEmpty = true;
+    framing->response = false;
+    framing->head = false;
+    framing->keepAlive = false;
+}
+
+void initHttpResponseFraming(HttpFraming *framing, bool head) {
+    initHttpFraming(framing);
+    framing->response = true;
+    framing->head = head;
+}
+
+void cleanupHttpFraming(HttpFraming *framing) {
+    if (framing->header)
+        free(framing->header);
+    framing->header = NULL;
+    framing->headerLen = 0;
+}
+
+/** the headers are complete, decide how the body is framed
+*/
+static int httpFramingHeaders(HttpFraming *framing) {
+    char *header = framing->header;
+    header[framing->headerLen] = 0x00;
+
+    char *lineEnd = strchr(header,'\n');
+    if (!lineEnd)
+        return HTTP_FRAMING_ERROR;
+
+    // request line "GET /path HTTP/1.1", status line "HTTP/1.1 200 OK"
+    char *version = framing->response ? header : strstr(header," HTTP/1.");
+    if (!version || version > lineEnd || strncmp(version+(framing->response ? 0 : 1),"HTTP/1.",7)!=0)
+        return HTTP_FRAMING_ERROR;
+    bool http10 = strncmp(version+(framing->response ? 0 : 1),"HTTP/1.0",8)==0;
+    int status = framing->response ? atoi(header+8) : 0;
+    if (!framing->response)
+        framing->head = strncmp(header,"HEAD ",5)==0;
+
+    bool chunked = false;
+    bool close = http10;
+    unsigned long long contentLength = 0;
+    bool hasLength = false;
+    for (char *line = lineEnd+1; *line; ) {
+        char *next = strchr(line,'\n');
+        char *value = strchr(line,':');
+        size_t valueLen = 0;
+        if (value && (!next || value < next)) {
+            value++;
+            valueLen = next ? (size_t)(next-value) : strlen(value);
+        } else {
+            value = NULL;
+        }
+        if (value && strncasecmp(line,"Content-Length:",15)==0) {
+            contentLength = strtoull(value,NULL,10);
+            hasLength = true;
+        } else if (value && strncasecmp(line,"Transfer-Encoding:",18)==0) {
+            // chunked is always the final encoding when present
+            for (size_t n = 0; n+7 <= valueLen; n++) {
+                if (strncasecmp(value+n,"chunked",7)==0)
+                    chunked = true;
+            }
+        } else if (value && strncasecmp(line,"Connection:",11)==0) {
+            for (size_t n = 0; n < valueLen; n++) {
+                if (n+5 <= valueLen && strncasecmp(value+n,"close",5)==0)
+                    close = true;
+                else if (n+10 <= valueLen && strncasecmp(value+n,"keep-alive",10)==0)
+                    close = false;
+            }
+        }
+        if (!next)
+            break;
+        line = next+1;
+    }
+
+    cleanupHttpFraming(framing);
+    framing->keepAlive = !close;
+
+    if (framing->response) {
+        if (status >= 100 && status < 200) // interim response, the final one follows
+            return HTTP_FRAMING_HEADERS;
+        if (framing->head || status == 204 || status == 304)
+            return HTTP_FRAMING_DONE;
+    }
+    if (chunked) {
+        framing->remaining = 0;
+        framing->chunkExtension = false;
+        return HTTP_FRAMING_CHUNK_SIZE;
+    }
+    if (contentLength > 0) {
+        framing->remaining = contentLength;
+        return HTTP_FRAMING_LENGTH;
+    }
+    if (framing->response && !hasLength) {
+        framing->keepAlive = false;
+        return HTTP_FRAMING_UNTIL_CLOSE;
+    }
+    return HTTP_FRAMING_DONE;
+}
+
+static int hexValue(char c) {
+    if (c >= '0' && c <= '9')
+        return c-'0';
+    if (c >= 'a' && c <= 'f')
+        return c-'a'+10;
+    if (c >= 'A' && c <= 'F')
+        return c-'A'+10;
+    return -1;
+}
+
+size_t httpFramingFeed(HttpFraming *framing, const char *data, size_t len) {
+    size_t i = 0;
+    while (i < len && !httpFramingComplete(framing)) {
+        switch (framing->state) {
+            case HTTP_FRAMING_HEADERS: {
+                if (!framing->header)
+                    framing->header = (char*)malloc(HTTP_MAX_HEADER+1);
+                if (framing->headerLen == HTTP_MAX_HEADER) {
+                    cleanupHttpFraming(framing);
+                    framing->state = HTTP_FRAMING_ERROR;
+                    break;
+                }
+                char c = data[i++];
+                framing->header[framing->headerLen++] = c;
+                size_t n = framing->headerLen;
+                if (c == '\n' && ((n >= 4 && memcmp(framing->header+n-4,"\r\n\r\n",4)==0) ||
+                    (n >= 2 && framing->header[n-2] == '\n')))
+                    framing->state = httpFramingHeaders(framing);
+                break;
+            }
+            case HTTP_FRAMING_LENGTH:
+            case HTTP_FRAMING_CHUNK_DATA: {
+                size_t take = len-i;
+                if (take > framing->remaining)
+                    take = (size_t)framing->remaining;
+                i += take;
+                framing->remaining -= take;
+                if (framing->remaining == 0)
+                    framing->state = framing->state == HTTP_FRAMING_LENGTH ? HTTP_FRAMING_DONE : HTTP_FRAMING_CHUNK_END;
+                break;
+            }
+            case HTTP_FRAMING_CHUNK_SIZE: {
+                char c = data[i++];
+                if (c == '\n') {
+                    framing->state = framing->remaining ? HTTP_FRAMING_CHUNK_DATA : HTTP_FRAMING_TRAILER;
+                    framing->lineEmpty = true;
+                } else if (c == ';') {
+                    framing->chunkExtension = true;
+                } else if (!framing->chunkExtension && hexValue(c) >= 0) {
+                    framing->remaining = framing->remaining*16+hexValue(c);
+                }
+                break;
+            }
+            case HTTP_FRAMING_CHUNK_END:
+                if (data[i++] == '\n') {
+                    framing->state = HTTP_FRAMING_CHUNK_SIZE;
+                    framing->remaining = 0;
+                    framing->chunkExtension = false;
+                }
+                break;
+            case HTTP_FRAMING_UNTIL_CLOSE:
+                i = len;
+                break;
+            case HTTP_FRAMING_TRAILER: {
+                char c = data[i++];
+                if (c == '\n') {
+                    if (framing->lineEmpty)
+                        framing->state = HTTP_FRAMING_DONE;
+                    framing->lineEmpty = true;
+                } else if (c != '\r') {
+                    framing->lineEmpty = false;
+                }
+                break;
+            }
+        }
+    }
+    return i;
+}
+
+bool httpFramingComplete(HttpFraming *framing) {
+    return framing->state == HTTP_FRAMING_DONE || framing->state == HTTP_FRAMING_ERROR;
+}
+
+bool httpFramingKeepAlive(HttpFraming *framing) {
+    return framing->state == HTTP_FRAMING_DONE && framing->keepAlive;
+}
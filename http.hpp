@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) [2023] Milan Kazarka
+ * Email: milan.kazarka.office@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __HTTP_HPP__
+#define __HTTP_HPP__
+
+#include <stdlib.h>
+
+// where we are in a request read from a consumer (or in the response to it), we only follow the framing
+// & never change the data
+#define HTTP_FRAMING_HEADERS 0 // request line & headers
+#define HTTP_FRAMING_LENGTH 1 // body with a Content-Length
+#define HTTP_FRAMING_CHUNK_SIZE 2 // chunked body, size line of the next chunk
+#define HTTP_FRAMING_CHUNK_DATA 3
+#define HTTP_FRAMING_CHUNK_END 4 // CRLF after the chunk data
+#define HTTP_FRAMING_TRAILER 5 // trailer lines after the last chunk
+#define HTTP_FRAMING_DONE 6 // the request is complete
+#define HTTP_FRAMING_ERROR 7 // not HTTP (or headers too large), treat what was read as the whole request
+#define HTTP_FRAMING_UNTIL_CLOSE 8 // response body without a length, it ends when the connection closes
+
+#define HTTP_MAX_HEADER 8192
+
+typedef struct HttpFraming {
+    int state;
+    char *header; // request line & headers until they are complete
+    size_t headerLen;
+    unsigned long long remaining; // body or chunk bytes left, the chunk size while reading its line
+    bool chunkExtension; // skipping a chunk extension until the end of the size line
+    bool lineEmpty; // no characters on the current trailer line yet
+    bool response; // following a response instead of a request
+    bool head; // a request - HEAD method, a response - to a HEAD request (no body)
+    bool keepAlive; // the headers allow another request on the same connection
+} HttpFraming;
+
+void initHttpFraming(HttpFraming *framing);
+void initHttpResponseFraming(HttpFraming *framing, bool head);
+void cleanupHttpFraming(HttpFraming *framing);
+size_t httpFramingFeed(HttpFraming *framing, const char *data, size_t len); // returns how much of data belongs to this message
+bool httpFramingComplete(HttpFraming *framing); // nothing more to read for this request
+bool httpFramingKeepAlive(HttpFraming *framing); // complete & the connection may be used for the next request
+
+#endif
@@ -93,6 +93,7 @@ void addNode(LinkedList* list, Node *node, bool lock) {
     }
     
     node->id = list->lastId++;
+    node->next = NULL; // always appended at the tail
 
     if (list->head == NULL) {
         list->head = node;
@@ -152,10 +153,6 @@ void removeNode(LinkedList* list, Node* target, bool lock) {
         }
         if (current != NULL) {
             current->next = target->next;
-            if (current->data) {
-                free(current->data);
-                current->data = NULL;
-            }
             free(target);
         }
     }
@@ -23,15 +23,7 @@
 #include <time.h>
 #include "msggram.hpp"
 #include "list.hpp"
-
-void invalidateRQGRAM( RQGRAM *rqgram ) {
-    if (!rqgram)
-        return;
-    if (rqgram->data)
-        free(rqgram->data);
-    rqgram->data = NULL;
-    rqgram->size = 0;
-}
+#include "common.hpp"
 
 void initializeRQMSG( RQMSG *rqmsg ) {
     if (!rqmsg)
@@ -39,67 +31,197 @@ void initializeRQMSG( RQMSG *rqmsg ) {
     
     rqmsg->msgid = 0;
     rqmsg->ngrams = 0;
+    rqmsg->received = 0;
     rqmsg->timestamp = 0;
-    for(int n = 0; n < MAXGRAMS; n++) {
-        rqmsg->grams[n].data = NULL;
-        rqmsg->grams[n].size = 0;
-    }
+    rqmsg->stream = NULL;
+    rqmsg->data = NULL;
+    rqmsg->capacity = 0;
+    rqmsg->stride = 0;
+    rqmsg->size = 0;
+    rqmsg->presentInline = 0;
+    rqmsg->present = NULL;
 }
 
 void invalidateRQMSG( RQMSG *rqmsg ) {
-    printf("invalidateRQMSG\n");
+    verbose("invalidateRQMSG\n");
     if (!rqmsg)
         return;
-    rqmsg->msgid = 0;
-    rqmsg->ngrams = 0;
-    rqmsg->timestamp = 0;
-    for(int n = 0; n < MAXGRAMS; n++) {
-        invalidateRQGRAM(&rqmsg->grams[n]);
-    }
+    if (rqmsg->stream)
+        free(rqmsg->stream);
+    if (rqmsg->data)
+        free(rqmsg->data);
+    if (rqmsg->present)
+        free(rqmsg->present);
+    initializeRQMSG(rqmsg);
 }
 
-// reconstruct data from grams in a message
-//
-char *dataFromRQMSG( RQMSG *rqmsg ) {
-    printf("dataFromRQMSG\n");
-    if (!rqmsg)
-        return NULL;
-    if (rqmsg->timestamp+3<=time(NULL)) {
-        printf("    invalidate\n");
-        invalidateRQMSG(rqmsg);
-        return NULL;
+static inline const uint64_t *presentBits( const RQMSG *rqmsg ) {
+    return rqmsg->present ? rqmsg->present : &rqmsg->presentInline;
+}
+
+bool rqgramPresent( const RQMSG *rqmsg, unsigned int index ) {
+    return index < rqmsg->ngrams && (presentBits(rqmsg)[index/64] & (1ULL << (index%64)));
+}
+
+/** every gram but the last carries exactly stride bytes, so each one knows where it goes without
+* waiting for the ones before it
+*/
+bool addGramToRQMSG( RQMSG *rqmsg, unsigned int index, unsigned int ngrams, const char *data, unsigned int size ) {
+    if (ngrams == 0 || ngrams > MAXGRAMS || index >= ngrams || size > RQGRAM_PAYLOAD)
+        return false;
+    bool last = index == ngrams-1;
+    if (!last && size == 0)
+        return false;
+    if (rqmsg->ngrams == 0) {
+        if (ngrams > 64) {
+            rqmsg->present = (uint64_t*)calloc((ngrams+63)/64, sizeof(uint64_t));
+            if (!rqmsg->present)
+                return false;
+        }
+        rqmsg->ngrams = ngrams;
     }
-    unsigned int totalsize = 0;
-    for(int n = 0; n < rqmsg->ngrams; n++) {
-        if (!rqmsg->grams[n].data || rqmsg->grams[n].size==0) {
-            return NULL;
+    if (ngrams != rqmsg->ngrams || rqgramPresent(rqmsg, index))
+        return false;
+    if (rqmsg->stride && (last ? size > rqmsg->stride : size != rqmsg->stride))
+        return false;
+
+    if (!last && !rqmsg->stride) {
+        // the first gram that isn't the last one tells the gram size, a last gram that came before it
+        // is moved to its place
+        bool tail = rqmsg->data != NULL;
+        if (tail && rqmsg->size > size)
+            return false;
+        size_t capacity = (size_t)(ngrams-1)*size + (tail ? rqmsg->size : size);
+        char *buffer = (char*)realloc(rqmsg->data, capacity+1);
+        if (!buffer)
+            return false;
+        if (tail) {
+            memmove(buffer+(size_t)(ngrams-1)*size, buffer, rqmsg->size);
+            rqmsg->size += (ngrams-1)*size;
         }
-        totalsize += rqmsg->grams[n].size;
+        rqmsg->data = buffer;
+        rqmsg->capacity = capacity;
+        rqmsg->stride = size;
+    } else if (!rqmsg->data) {
+        // a single gram, or the last one arriving first, waits at the start until the stride is known
+        rqmsg->data = (char*)malloc(size+1);
+        if (!rqmsg->data)
+            return false;
+        rqmsg->capacity = size;
     }
-    unsigned int index = 0;
-    char *data = (char*)malloc(totalsize+1);
-    for(int n = 0; n < rqmsg->ngrams; n++) {
-        memcpy(data+index,rqmsg->grams[n].data,rqmsg->grams[n].size);
-        index+=rqmsg->grams[n].size;
+
+    size_t offset = (size_t)index*rqmsg->stride;
+    if (offset+size > rqmsg->capacity)
+        return false;
+
+    memcpy(rqmsg->data+offset, data, size);
+    ((uint64_t*)presentBits(rqmsg))[index/64] |= 1ULL << (index%64);
+    rqmsg->received++;
+    if (last)
+        rqmsg->size = offset+size;
+    return true;
+}
+
+RQGRAM rqgramAt( const RQMSG *rqmsg, unsigned int index ) {
+    RQGRAM rqgram = {0, NULL};
+    if (!rqgramPresent(rqmsg, index))
+        return rqgram;
+    size_t offset = (size_t)index*rqmsg->stride;
+    rqgram.data = rqmsg->data+offset;
+    rqgram.size = index == rqmsg->ngrams-1 ? rqmsg->size-offset : rqmsg->stride;
+    return rqgram;
+}
+
+void xorGram( char *parity, const char *data, unsigned int size ) {
+    unsigned int n = 0;
+    // a word at a time, the compiler vectorizes this further
+    for (; n+sizeof(uint64_t) <= size; n += sizeof(uint64_t)) {
+        uint64_t a, b;
+        memcpy(&a, parity+n, sizeof(a));
+        memcpy(&b, data+n, sizeof(b));
+        a ^= b;
+        memcpy(parity+n, &a, sizeof(a));
+    }
+    for (; n < size; n++)
+        parity[n] ^= data[n];
+}
+
+/** the missing gram is the parity with every other gram of the group XORed out of it
+*/
+bool rebuildGramFromParity( RQMSG *rqmsg, const RQGRAM_PARITY *group, const char *parity, unsigned int size, unsigned int *index ) {
+    if (rqmsg->ngrams == 0 || group->ngrams != rqmsg->ngrams || group->count < 2 || group->first >= group->ngrams ||
+        group->count > group->ngrams-group->first || group->lastSize > size || size > RQGRAM_PAYLOAD)
+        return false;
+    if (rqmsg->stride && size != rqmsg->stride)
+        return false;
+
+    unsigned int missing = group->ngrams;
+    for (unsigned int n = group->first; n < group->first+group->count; n++) {
+        if (rqgramPresent(rqmsg, n))
+            continue;
+        if (missing != group->ngrams)
+            return false;
+        missing = n;
+    }
+    if (missing == group->ngrams)
+        return false;
+
+    char *data = (char*)malloc(size);
+    if (!data)
+        return false;
+    memcpy(data, parity, size);
+    for (unsigned int n = group->first; n < group->first+group->count; n++) {
+        if (n == missing)
+            continue;
+        RQGRAM gram = rqgramAt(rqmsg, n);
+        if (gram.size > size) {
+            free(data);
+            return false;
+        }
+        xorGram(data, gram.data, gram.size);
     }
-    data[totalsize]=0x00;
-    printf("dataFromRQMSG returning size(%d)\n",totalsize);
+    unsigned int missingSize = missing == group->first+group->count-1 ? group->lastSize : size;
+    bool added = addGramToRQMSG(rqmsg, missing, group->ngrams, data, missingSize);
+    free(data);
+    if (added)
+        *index = missing;
+    return added;
+}
+
+bool rqmsgComplete( const RQMSG *rqmsg ) {
+    return rqmsg->ngrams > 0 && rqmsg->received == rqmsg->ngrams;
+}
+
+// the grams are already in place, the buffer is passed on as is
+//
+char *dataFromRQMSG( RQMSG *rqmsg ) {
+    if (!rqmsg || !rqmsgComplete(rqmsg))
+        return NULL;
+    char *data = rqmsg->data;
+    data[rqmsg->size]=0x00;
+    rqmsg->data = NULL;
+    rqmsg->capacity = 0;
+    verbose("dataFromRQMSG returning size(%d)\n",rqmsg->size);
     return data; // free upstream
 }
 
+Slice sliceFromRQMSG( RQMSG *rqmsg ) {
+    return adoptSlice(dataFromRQMSG(rqmsg),rqmsg->size);
+}
+
 // #todo - check that we don't surpass MAXGRAMS
 // #todo - separate functions for handling header & headerdata
 //
-LinkedList *splitRawDataIntoGrams( const char *message, int mymsgid ) {
+LinkedList *splitRawDataIntoGrams( Slice message, int mymsgid ) {
     
-    if (!message)
+    if (!message.data)
         return NULL;
     
     LinkedList *list = (LinkedList*)malloc(sizeof(LinkedList));
     initLinkedList(list,LIST_NOMUTEX);
 
-    unsigned short gramsize = (64*1024)-1024; // very rough, we just assume max 1024 for header by default
-    unsigned int msglen = (unsigned int)strlen(message);
+    unsigned int gramsize = RQGRAM_PAYLOAD;
+    unsigned int msglen = (unsigned int)message.len;
     unsigned int countdown = msglen;
     unsigned int size = gramsize;
     unsigned int gramindex = 0;
@@ -120,16 +242,10 @@ LinkedList *splitRawDataIntoGrams( const char *message, int mymsgid ) {
             size = countdown;
 
         RQGRAM_HEADERDATA *headerdata = (RQGRAM_HEADERDATA*)malloc(sizeof(RQGRAM_HEADERDATA));
-        // we store the header inside of the data as well
-        headerdata->data = (char*)malloc(sizeof(RQGRAM_HEADER)+size+1);
-        RQGRAM_HEADER *header = (RQGRAM_HEADER*)headerdata->data;
-        header->msgid = mymsgid;
-        header->ngrams = ngrams;
-        header->index = gramindex;
-
-        memcpy(headerdata->data+sizeof(RQGRAM_HEADER),message+dataindex,size);
-        headerdata->data[sizeof(RQGRAM_HEADER)+size] = 0x00;
-        headerdata->datalen = sizeof(RQGRAM_HEADER)+size;
+        headerdata->header.msgid = mymsgid;
+        headerdata->header.ngrams = ngrams;
+        headerdata->header.index = gramindex;
+        headerdata->data = subSlice(message,dataindex,size);
 
         Node *node = (Node*)malloc(sizeof(Node));
         node->data = headerdata;
@@ -20,23 +20,39 @@
 #define __MSGGRAM_HPP__
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <time.h>
+#include "buffer.hpp"
 
 struct Node;
 struct LinkedList;
 
-#define MAXGRAMS 200 // 64kB*MAXGRAMS
+#define MAXGRAMS 16384 // grams in a message, enough for what 200 of the largest grams used to carry at the smallest gram size
+#define RQGRAM_PAYLOAD ((64*1024)-1024) // the most data in a gram, very rough, we just assume max 1024 for header by default
 
+/** a view of one gram's data inside of its message
+*/
 typedef struct {
     unsigned int size;
     char *data;
 } RQGRAM;
 
+/** the grams of a message are received straight into one buffer, gram n at n*stride, which is handed
+* on as is once they are all there. Every gram but the last is the size the sender chose for the
+* message (see pathmtu.hpp), so the first of those to arrive tells the stride.
+*/
 typedef struct {
     unsigned long long msgid;
     unsigned int ngrams;
+    unsigned int received; // grams
     time_t timestamp;
-    RQGRAM grams[MAXGRAMS];
+    void *stream; // receiver state while the message is passed on before it is complete, freed with the message
+    char *data; // allocated by the first gram
+    unsigned int capacity;
+    unsigned int stride; // 0 until a gram other than the last one arrived
+    unsigned int size; // known once the last gram arrived
+    uint64_t presentInline; // bitmap of the grams received, enough for messages of up to 64 grams
+    uint64_t *present; // NULL unless the message has more grams than that
 } RQMSG;
 
 typedef struct {
@@ -55,14 +71,35 @@ typedef struct {
 } RQGRAM_HEADER;
 
 typedef struct {
-    char *data; // have the RQMSGRAW_HEADER part of the data
-    int datalen;
+    RQGRAM_HEADER header;
+    Slice data; // of the message, borrowed from it
 } RQGRAM_HEADERDATA;
 
-void invalidateRQGRAM( RQGRAM *rqgram );
+// a gram with ngrams 0 isn't part of a message, it tells the sender of msgid how its grams arrived,
+// the kind is in index (see reliability.hpp)
+#define RQGRAM_CONTROL_ACK 1 // the message is complete
+#define RQGRAM_CONTROL_SACK 2 // followed by ngrams, from (every gram below it arrived) & parityEnd (unsigned int each, the end of
+                              // the furthest group whose parity arrived) & a bitmap of the grams received from there on, LSB first
+#define RQGRAM_CONTROL_PARITY 3 // followed by RQGRAM_PARITY & the XOR of a group of grams of the message, each padded to the
+                                // size of the parity, the receiver rebuilds one gram of the group that went missing from it
+
+typedef struct {
+    unsigned int ngrams; // of the message
+    unsigned int first;
+    unsigned int count;
+    unsigned int lastSize; // of the group's last gram, the others are as large as the parity
+} RQGRAM_PARITY;
+
 void initializeRQMSG( RQMSG *rqmsg );
-void invalidateRQMSG( RQMSG *rqmsg );
-char *dataFromRQMSG( RQMSG *rqmsg ); // reconstruct data from grams in a message
-LinkedList *splitRawDataIntoGrams( const char *message, int mymsgid );
+void invalidateRQMSG( RQMSG *rqmsg ); // frees what it holds, the message can be reused afterwards
+bool addGramToRQMSG( RQMSG *rqmsg, unsigned int index, unsigned int ngrams, const char *data, unsigned int size ); // false if the gram doesn't belong
+bool rqgramPresent( const RQMSG *rqmsg, unsigned int index );
+RQGRAM rqgramAt( const RQMSG *rqmsg, unsigned int index );
+void xorGram( char *parity, const char *data, unsigned int size ); // parity ^= data
+bool rebuildGramFromParity( RQMSG *rqmsg, const RQGRAM_PARITY *group, const char *parity, unsigned int size, unsigned int *index ); // false unless exactly one gram of the group was missing, index is the one rebuilt // data is NULL if the gram didn't arrive yet
+bool rqmsgComplete( const RQMSG *rqmsg );
+char *dataFromRQMSG( RQMSG *rqmsg ); // hand over the data of a complete message, NULL until then
+Slice sliceFromRQMSG( RQMSG *rqmsg ); // same, as a slice that owns the data, empty until then
+LinkedList *splitRawDataIntoGrams( Slice message, int mymsgid ); // the grams point into message, which has to outlive them
 
 #endif
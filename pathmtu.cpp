@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) [2023] Milan Kazarka
+ * Email: milan.kazarka.office@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/ip.h>
+#include <arpa/inet.h>
+#include "pathmtu.hpp"
+#include "time.hpp"
+#include "common.hpp"
+
+void initPathMtu(PathMtu *pmtu, unsigned int gramSize) {
+    if (gramSize != PATHMTU_AUTO && gramSize < PATHMTU_MIN_PAYLOAD)
+        gramSize = PATHMTU_MIN_PAYLOAD;
+    if (gramSize > RQGRAM_PAYLOAD)
+        gramSize = RQGRAM_PAYLOAD;
+    pmtu->gramSize = gramSize;
+    initUuidMap(&pmtu->peers, 16, UUIDMAP_USEMUTEX);
+}
+
+void cleanupPathMtu(PathMtu *pmtu) {
+    for (int n = 0; n < pmtu->peers.capacity; n++) {
+        PeerMtu *peer = (PeerMtu*)uuidMapAt(&pmtu->peers, n);
+        if (peer)
+            free(peer);
+    }
+    cleanupUuidMap(&pmtu->peers);
+}
+
+/** with IP_PMTUDISC_DO the kernel sets DF on every gram & learns the path MTU from the ICMP
+* "fragmentation needed" replies of routers along the way
+*/
+void enablePathMtuDiscovery(PathMtu *pmtu, int fd) {
+    if (pmtu->gramSize != PATHMTU_AUTO)
+        return;
+#ifdef IP_MTU_DISCOVER
+    int mode = IP_PMTUDISC_DO;
+    if (setsockopt(fd, IPPROTO_IP, IP_MTU_DISCOVER, &mode, sizeof(mode)) == -1)
+        perror("setsockopt(IP_MTU_DISCOVER)");
+#endif
+}
+
+void setGramSocketBuffers(int fd) {
+    int size = PATHMTU_SOCKET_BUFFER;
+    socklen_t len = sizeof(size);
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    if (getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, &len) == 0 && size < PATHMTU_SOCKET_BUFFER)
+        printf("warning: UDP receive buffer is %d bytes, raise net.core.rmem_max for fewer dropped grams\n",size);
+}
+
+/** IP_MTU is only there for a connected socket, a throwaway one connected to the peer reads what the
+* kernel knows about the route (the device MTU or what it has learned since)
+*/
+static unsigned int discoverPayload(const struct sockaddr_in *peer) {
+    unsigned int payload = RQGRAM_PAYLOAD;
+#ifdef IP_MTU
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd == -1)
+        return payload;
+    int mtu = 0;
+    socklen_t len = sizeof(mtu);
+    if (connect(fd, (const struct sockaddr*)peer, sizeof(*peer)) == 0 &&
+        getsockopt(fd, IPPROTO_IP, IP_MTU, &mtu, &len) == 0 && mtu > (int)PATHMTU_GRAM_OVERHEAD) {
+        payload = mtu-PATHMTU_GRAM_OVERHEAD;
+    }
+    close(fd);
+#endif
+    if (payload > RQGRAM_PAYLOAD)
+        payload = RQGRAM_PAYLOAD;
+    if (payload < PATHMTU_MIN_PAYLOAD)
+        payload = PATHMTU_MIN_PAYLOAD;
+    return payload;
+}
+
+static Uuid peerKey(const struct sockaddr_in *peer) {
+    Uuid key;
+    key.hi = ((uint64_t)peer->sin_addr.s_addr << 16) | peer->sin_port;
+    key.lo = 0;
+    return key;
+}
+
+unsigned int gramPayload(PathMtu *pmtu, const struct sockaddr_in *peer) {
+    if (pmtu->gramSize != PATHMTU_AUTO)
+        return pmtu->gramSize;
+
+    Uuid key = peerKey(peer);
+    long long now = getMonotonicMillis();
+    lockUuidMap(&pmtu->peers);
+    PeerMtu *entry = (PeerMtu*)uuidMapGet(&pmtu->peers, &key, false);
+    if (!entry) {
+        entry = (PeerMtu*)malloc(sizeof(PeerMtu));
+        entry->payload = 0;
+        entry->expires = 0;
+        uuidMapPut(&pmtu->peers, &key, entry, false);
+    }
+    if (entry->expires <= now) {
+        unsigned int payload = discoverPayload(peer);
+        if (entry->expires == 0 || payload != entry->payload)
+            verbose("grams to %s:%d carry %u bytes\n",inet_ntoa(peer->sin_addr),ntohs(peer->sin_port),payload);
+        entry->payload = payload;
+        entry->expires = now+PATHMTU_TTL_MS;
+    }
+    unsigned int payload = entry->payload;
+    unlockUuidMap(&pmtu->peers);
+    return payload;
+}
+
+void pathMtuExceeded(PathMtu *pmtu, const struct sockaddr_in *peer) {
+    Uuid key = peerKey(peer);
+    lockUuidMap(&pmtu->peers);
+    PeerMtu *entry = (PeerMtu*)uuidMapGet(&pmtu->peers, &key, false);
+    if (entry)
+        entry->expires = 0;
+    unlockUuidMap(&pmtu->peers);
+    printf("warning: gram to %s:%d exceeded the path MTU\n",inet_ntoa(peer->sin_addr),ntohs(peer->sin_port));
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) [2023] Milan Kazarka
+ * Email: milan.kazarka.office@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PATHMTU_HPP__
+#define __PATHMTU_HPP__
+
+#include <stdlib.h>
+#include <netinet/in.h>
+#include "uuidmap.hpp"
+#include "msggram.hpp"
+
+#define PATHMTU_AUTO 0 // gram size, discover it for each peer
+#define PATHMTU_MIN_PAYLOAD 512 // grams don't get smaller than this, whatever the path says (IPv4 guarantees 576)
+#define PATHMTU_TTL_MS (10*60*1000) // a discovered MTU is looked up again after this long, in case the path changed
+#define PATHMTU_SOCKET_BUFFER (4*1024*1024) // a message in small grams is many packets, the socket buffers need to hold a burst of them
+#define PATHMTU_GRAM_OVERHEAD (20+8+sizeof(RQGRAM_HEADER)+sizeof(RQGRAM_PARITY)) // IPv4 & UDP headers, a parity gram carries its group on top
+
+typedef struct PeerMtu {
+    unsigned int payload; // data in a gram to this peer
+    long long expires; // getMonotonicMillis()
+} PeerMtu;
+
+/** the size of the grams sent to each peer, so that a gram fits in a single IP packet on the path &
+* a lost fragment doesn't cost the whole gram. Shared by the threads sending grams.
+*/
+typedef struct PathMtu {
+    UuidMap peers; // PeerMtu by address & port, never removed so a sender can keep reading its entry
+    unsigned int gramSize; // configured data in a gram, PATHMTU_AUTO to discover it per peer
+} PathMtu;
+
+void initPathMtu(PathMtu *pmtu, unsigned int gramSize);
+void cleanupPathMtu(PathMtu *pmtu);
+void enablePathMtuDiscovery(PathMtu *pmtu, int fd); // don't fragment grams sent through fd, too large ones fail with EMSGSIZE
+void setGramSocketBuffers(int fd); // PATHMTU_SOCKET_BUFFER or what the kernel allows (net.core.rmem_max, wmem_max)
+unsigned int gramPayload(PathMtu *pmtu, const struct sockaddr_in *peer); // data that fits a gram to peer
+void pathMtuExceeded(PathMtu *pmtu, const struct sockaddr_in *peer); // a gram to peer failed with EMSGSIZE, look again
+
+#endif
@@ -0,0 +1,340 @@
+/*
+ * Copyright (C) [2023] Milan Kazarka
+ * Email: milan.kazarka.office@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "reassembly.hpp"
+#include "reliability.hpp"
+#include "time.hpp"
+#include "common.hpp"
+
+ReassemblyStats reassemblyStats = {0, 0, 0, 0, 0};
+
+static void onPartialMessageDeadline(Timer *timer) {
+    PartialMessage *message = (PartialMessage*)timer->data;
+    verbose("reassembly of msgid(%llu) timed out\n",message->rqmsg.msgid);
+    removePartialMessage(message->table, message);
+}
+
+void initReassemblyTable(ReassemblyTable *table, int maxMessages, size_t maxBytes, long long ttlMs, TimerWheel *timers, int fd) {
+    table->maxMessages = maxMessages > 0 ? maxMessages : REASSEMBLY_DEFAULT_MESSAGES;
+    table->maxBytes = maxBytes > 0 ? maxBytes : REASSEMBLY_DEFAULT_MEMORY;
+    table->ttlMs = ttlMs;
+    table->timers = timers;
+    table->oldest = NULL;
+    table->newest = NULL;
+    table->count = 0;
+    table->bytes = 0;
+    table->spare = NULL;
+    table->nspare = 0;
+    table->fd = fd;
+    initUuidMap(&table->index, table->maxMessages < 1024 ? table->maxMessages : 1024, UUIDMAP_NOMUTEX);
+    initUuidMap(&table->doneIndex, 1024, UUIDMAP_NOMUTEX);
+    table->done = (DoneMessage*)calloc(REASSEMBLY_DONE_MESSAGES, sizeof(DoneMessage));
+    table->doneHead = 0;
+}
+
+void cleanupReassemblyTable(ReassemblyTable *table) {
+    while (table->oldest)
+        removePartialMessage(table, table->oldest);
+    while (table->spare) {
+        PartialMessage *spare = table->spare;
+        table->spare = spare->newer;
+        free(spare);
+    }
+    table->nspare = 0;
+    cleanupUuidMap(&table->index);
+    cleanupUuidMap(&table->doneIndex);
+    free(table->done);
+    table->done = NULL;
+}
+
+static Uuid messageKey(const struct sockaddr_in *peer, unsigned long long msgid) {
+    Uuid key;
+    key.hi = ((uint64_t)peer->sin_addr.s_addr << 16) | peer->sin_port;
+    key.lo = msgid;
+    return key;
+}
+
+/** remember a completed message, in place of the oldest one remembered
+*/
+static void markDone(ReassemblyTable *table, const Uuid *key) {
+    DoneMessage *done = &table->done[table->doneHead];
+    if (uuidMapGet(&table->doneIndex, &done->key, false) == done)
+        uuidMapRemove(&table->doneIndex, &done->key, false);
+    done->key = *key;
+    done->ms = getMonotonicMillis();
+    uuidMapPut(&table->doneIndex, key, done, false);
+    table->doneHead = (table->doneHead+1)%REASSEMBLY_DONE_MESSAGES;
+}
+
+static bool isDone(ReassemblyTable *table, const Uuid *key, long long now) {
+    DoneMessage *done = (DoneMessage*)uuidMapGet(&table->doneIndex, key, false);
+    return done && now-done->ms <= REASSEMBLY_DONE_MS;
+}
+
+static void unlinkPartialMessage(ReassemblyTable *table, PartialMessage *message) {
+    if (message->older)
+        message->older->newer = message->newer;
+    else
+        table->oldest = message->newer;
+    if (message->newer)
+        message->newer->older = message->older;
+    else
+        table->newest = message->older;
+    message->older = NULL;
+    message->newer = NULL;
+}
+
+static void linkNewest(ReassemblyTable *table, PartialMessage *message) {
+    message->older = table->newest;
+    message->newer = NULL;
+    if (table->newest)
+        table->newest->newer = message;
+    else
+        table->oldest = message;
+    table->newest = message;
+}
+
+void removePartialMessage(ReassemblyTable *table, PartialMessage *message) {
+    if (table->timers)
+        cancelTimer(table->timers, &message->deadline);
+    uuidMapRemove(&table->index, &message->key, false);
+    unlinkPartialMessage(table, message);
+    table->count--;
+    table->bytes -= message->bytes;
+    invalidateRQMSG(&message->rqmsg);
+    if (table->nspare < REASSEMBLY_SPARE_MESSAGES) {
+        message->newer = table->spare;
+        table->spare = message;
+        table->nspare++;
+    } else {
+        free(message);
+    }
+}
+
+/** make room by dropping the least recently used messages, except keep
+*/
+static void evictPartialMessages(ReassemblyTable *table, PartialMessage *keep, int count, size_t bytes) {
+    while (table->oldest && (table->count > count || table->bytes > bytes)) {
+        PartialMessage *oldest = table->oldest;
+        if (oldest == keep) {
+            if (!oldest->newer)
+                return;
+            oldest = oldest->newer;
+        }
+        printf("warning: reassembly table full, dropping msgid(%llu)\n",oldest->rqmsg.msgid);
+        removePartialMessage(table, oldest);
+    }
+}
+
+/** without a timer wheel, stale messages are dropped from the least recently used end as grams arrive
+*/
+static void expirePartialMessages(ReassemblyTable *table, long long now) {
+    while (table->oldest && now-table->oldest->lastGramMs > table->ttlMs) {
+        verbose("reassembly of msgid(%llu) timed out\n",table->oldest->rqmsg.msgid);
+        removePartialMessage(table, table->oldest);
+    }
+}
+
+/** account for a gram that made it into the message & tell the sender how it is going, NULL if the
+* message was dropped
+*/
+static PartialMessage *gramAdded(ReassemblyTable *table, const struct sockaddr_in *peer, PartialMessage *message, unsigned int index) {
+    RQMSG *rqmsg = &message->rqmsg;
+    if (index >= message->end)
+        message->end = index+1;
+    while (message->firstMissing < rqmsg->ngrams && rqgramPresent(rqmsg, message->firstMissing))
+        message->firstMissing++;
+
+    // the whole message is accounted for as soon as its buffer exists
+    table->bytes += rqmsg->capacity-message->bytes;
+    message->bytes = rqmsg->capacity;
+
+    evictPartialMessages(table, message, table->maxMessages, table->maxBytes);
+    if (table->bytes > table->maxBytes) {
+        printf("warning: msgid(%llu) doesn't fit the reassembly memory, dropping it\n",rqmsg->msgid);
+        removePartialMessage(table, message);
+        return NULL;
+    }
+    if (partialMessageComplete(message)) {
+        __sync_add_and_fetch(&reassemblyStats.reassembled,1);
+        markDone(table, &message->key);
+        if (table->fd != -1)
+            sendAck(table->fd, peer, rqmsg->msgid, message->recovered);
+    } else if ((index == rqmsg->ngrams-1 || rqmsg->received%RELIABILITY_SACK_EVERY == 0) && table->fd != -1) {
+        // the grams are sent in order, the last one arriving before the others means some got lost,
+        // meanwhile the sender learns every so often how far the message got to open its window
+        sendSack(table->fd, peer, rqmsg, message->firstMissing, message->end, message->parityEnd);
+    }
+    return message;
+}
+
+/** a parity gram is of use to a message that misses exactly one gram of its group, otherwise the
+* sender learns right away that the grams still missing from the group are lost
+*/
+static PartialMessage *addParityGram(ReassemblyTable *table, const struct sockaddr_in *peer, const RQGRAM_HEADER *header, const char *payload, unsigned int len) {
+    RQGRAM_PARITY group;
+    if (len <= sizeof(group))
+        return NULL;
+    memcpy(&group, payload, sizeof(group));
+    Uuid key = messageKey(peer, header->msgid);
+    PartialMessage *message = (PartialMessage*)uuidMapGet(&table->index, &key, false);
+    if (!message || group.first >= group.ngrams || group.count > group.ngrams-group.first)
+        return NULL;
+    if (group.first+group.count > message->parityEnd)
+        message->parityEnd = group.first+group.count;
+    unsigned int index = 0;
+    if (!rebuildGramFromParity(&message->rqmsg, &group, payload+sizeof(group), len-sizeof(group), &index)) {
+        if (!partialMessageComplete(message) && table->fd != -1)
+            sendSack(table->fd, peer, &message->rqmsg, message->firstMissing, message->end, message->parityEnd);
+        return message;
+    }
+    verbose("rebuilt gram index(%u) of msgid(%llu) from parity\n",index,header->msgid);
+    message->recovered++;
+    __sync_add_and_fetch(&reassemblyStats.recovered,1);
+    return gramAdded(table, peer, message, index);
+}
+
+PartialMessage *addGram(ReassemblyTable *table, const struct sockaddr_in *peer, const char *gram, unsigned int len) {
+    RQGRAM_HEADER header;
+    if (len < sizeof(header)) {
+        printf("warning: dropping gram without a header\n");
+        __sync_add_and_fetch(&reassemblyStats.dropped,1);
+        return NULL;
+    }
+    memcpy(&header, gram, sizeof(header));
+    unsigned int chunksize = len-sizeof(header);
+    if (header.ngrams == 0 && header.index == RQGRAM_CONTROL_PARITY)
+        return addParityGram(table, peer, &header, gram+sizeof(header), chunksize);
+    if (header.ngrams == 0 || header.ngrams > MAXGRAMS || header.index >= header.ngrams) {
+        printf("warning: dropping gram index(%u) ngrams(%u)\n",header.index,header.ngrams);
+        __sync_add_and_fetch(&reassemblyStats.dropped,1);
+        return NULL;
+    }
+
+    long long now = getMonotonicMillis();
+    if (!table->timers)
+        expirePartialMessages(table, now);
+
+    Uuid key = messageKey(peer, header.msgid);
+    if (isDone(table, &key, now)) {
+        // the acknowledgement got lost & the sender retransmits
+        __sync_add_and_fetch(&reassemblyStats.duplicates,1);
+        if (table->fd != -1)
+            sendAck(table->fd, peer, header.msgid, 0);
+        return NULL;
+    }
+    PartialMessage *message = (PartialMessage*)uuidMapGet(&table->index, &key, false);
+    if (!message) {
+        evictPartialMessages(table, NULL, table->maxMessages-1, table->maxBytes);
+        message = table->spare;
+        if (message) {
+            table->spare = message->newer;
+            table->nspare--;
+        } else {
+            message = (PartialMessage*)malloc(sizeof(PartialMessage));
+        }
+        initializeRQMSG(&message->rqmsg);
+        message->rqmsg.msgid = header.msgid;
+        message->rqmsg.timestamp = time(NULL);
+        message->key = key;
+        message->bytes = 0;
+        message->firstMissing = 0;
+        message->end = 0;
+        message->recovered = 0;
+        message->parityEnd = 0;
+        message->older = NULL;
+        message->newer = NULL;
+        message->table = table;
+        initTimer(&message->deadline, onPartialMessageDeadline, message);
+        uuidMapPut(&table->index, &key, message, false);
+        table->count++;
+    } else {
+        unlinkPartialMessage(table, message);
+    }
+    linkNewest(table, message);
+    message->lastGramMs = now;
+    if (table->timers)
+        addTimer(table->timers, &message->deadline, table->ttlMs);
+
+    // the buffer of a message is allocated whole by its first gram that isn't the last one, make room
+    // for it before, as a header can claim up to MAXGRAMS grams
+    bool added = false;
+    bool duplicate = message->rqmsg.received > 0 && header.index < message->rqmsg.ngrams && rqgramPresent(&message->rqmsg, header.index);
+    if (!message->rqmsg.stride && header.index+1 < header.ngrams) {
+        size_t need = (size_t)header.ngrams*chunksize;
+        if (need <= table->maxBytes) {
+            evictPartialMessages(table, message, table->maxMessages, table->maxBytes-need);
+            added = addGramToRQMSG(&message->rqmsg, header.index, header.ngrams, gram+sizeof(header), chunksize);
+        } else {
+            printf("warning: msgid(%llu) of %u grams doesn't fit the reassembly memory\n",header.msgid,header.ngrams);
+        }
+    } else {
+        added = addGramToRQMSG(&message->rqmsg, header.index, header.ngrams, gram+sizeof(header), chunksize);
+    }
+    if (duplicate) {
+        // the sender didn't hear from us in time & asks again what is missing
+        __sync_add_and_fetch(&reassemblyStats.duplicates,1);
+        if (table->fd != -1)
+            sendSack(table->fd, peer, &message->rqmsg, message->firstMissing, message->end, message->parityEnd);
+        return message;
+    }
+    if (!added) {
+        // something went wrong - a gram of a different message with the same msgid
+        printf("warning: dropping gram index(%u) of msgid(%llu)\n",header.index,header.msgid);
+        __sync_add_and_fetch(&reassemblyStats.dropped,1);
+        if (message->rqmsg.received == 0) {
+            removePartialMessage(table, message);
+            return NULL;
+        }
+        return message;
+    }
+    return gramAdded(table, peer, message, header.index);
+}
+
+/** most requests & responses fit in one gram, those don't need the table nor a copy of their data
+*/
+const char *singleGramData(ReassemblyTable *table, const struct sockaddr_in *peer, const char *gram, unsigned int len, unsigned int *size) {
+    RQGRAM_HEADER header;
+    if (len < sizeof(header))
+        return NULL;
+    memcpy(&header, gram, sizeof(header));
+    if (header.ngrams != 1 || header.index != 0)
+        return NULL;
+    if (table) {
+        Uuid key = messageKey(peer, header.msgid);
+        if (isDone(table, &key, getMonotonicMillis()))
+            return NULL;
+        markDone(table, &key);
+        if (table->fd != -1)
+            sendAck(table->fd, peer, header.msgid, 0);
+    }
+    __sync_add_and_fetch(&reassemblyStats.singleGram,1);
+    *size = len-sizeof(header);
+    return gram+sizeof(header);
+}
+
+void printReassemblyStats() {
+    printf("reassembly: single gram(%llu) reassembled(%llu) dropped grams(%llu) duplicate grams(%llu) recovered grams(%llu)\n",
+        reassemblyStats.singleGram,reassemblyStats.reassembled,reassemblyStats.dropped,reassemblyStats.duplicates,reassemblyStats.recovered);
+}
+
+bool partialMessageComplete(PartialMessage *message) {
+    return rqmsgComplete(&message->rqmsg);
+}
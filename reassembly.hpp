@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) [2023] Milan Kazarka
+ * Email: milan.kazarka.office@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __REASSEMBLY_HPP__
+#define __REASSEMBLY_HPP__
+
+#include <stdlib.h>
+#include <netinet/in.h>
+#include "msggram.hpp"
+#include "uuidmap.hpp"
+#include "timerwheel.hpp"
+
+#define REASSEMBLY_DEFAULT_MESSAGES 1024 // messages being put together at any given time
+#define REASSEMBLY_DEFAULT_MEMORY (64*1024*1024) // bytes held in their grams
+#define REASSEMBLY_STATS_INTERVAL 60 // seconds between the counters printed by the main thread, when they changed
+#define REASSEMBLY_SPARE_MESSAGES 64 // finished messages kept around for reuse instead of freed
+#define REASSEMBLY_DONE_MESSAGES 16384 // completed messages remembered, so that their retransmitted grams are only acknowledged again
+#define REASSEMBLY_DONE_MS 10000 // how long they are remembered at most
+
+/** a message some of whose grams have arrived, found by the peer that sent it & its msgid (the msgid alone
+* is only unique per sender)
+*/
+typedef struct PartialMessage {
+    RQMSG rqmsg;
+    Uuid key; // peer address & port, msgid
+    size_t bytes; // of the message's buffer
+    long long lastGramMs; // getMonotonicMillis()
+    unsigned int firstMissing; // every gram below arrived
+    unsigned int end; // one past the highest gram that arrived
+    unsigned int recovered; // grams rebuilt from parity, the sender learns of them with the acknowledgement
+    unsigned int parityEnd; // one past the furthest group whose parity arrived
+    Timer deadline;
+    struct PartialMessage *older; // least recently used order, by the last gram received
+    struct PartialMessage *newer; // next spare while not in use
+    struct ReassemblyTable *table;
+} PartialMessage;
+
+typedef struct DoneMessage {
+    Uuid key;
+    long long ms; // getMonotonicMillis() of its completion
+} DoneMessage;
+
+/** not thread safe, owned by the thread receiving the grams
+*/
+typedef struct ReassemblyTable {
+    UuidMap index;
+    PartialMessage *oldest;
+    PartialMessage *newest;
+    int count;
+    int maxMessages; // beyond this the least recently used message is dropped
+    size_t bytes;
+    size_t maxBytes;
+    long long ttlMs; // a message is dropped once no gram of it arrived for this long
+    TimerWheel *timers; // NULL to drop stale messages only as grams arrive
+    PartialMessage *spare;
+    int nspare;
+    int fd; // acknowledgements go back through it to the sender, -1 to not send any
+    UuidMap doneIndex; // DoneMessage by key
+    DoneMessage *done; // ring of the last REASSEMBLY_DONE_MESSAGES completed
+    int doneHead;
+} ReassemblyTable;
+
+/** how messages got through, summed over every table of the process
+*/
+typedef struct ReassemblyStats {
+    volatile unsigned long long singleGram; // taken straight from the receive buffer
+    volatile unsigned long long reassembled;
+    volatile unsigned long long dropped; // grams that didn't make it into a message
+    volatile unsigned long long duplicates; // grams of messages already complete
+    volatile unsigned long long recovered; // grams rebuilt from parity
+} ReassemblyStats;
+
+extern ReassemblyStats reassemblyStats;
+
+void initReassemblyTable(ReassemblyTable *table, int maxMessages, size_t maxBytes, long long ttlMs, TimerWheel *timers, int fd);
+void cleanupReassemblyTable(ReassemblyTable *table);
+PartialMessage *addGram(ReassemblyTable *table, const struct sockaddr_in *peer, const char *gram, unsigned int len); // the message the gram belongs to, NULL if it was dropped (a parity gram as well)
+const char *singleGramData(ReassemblyTable *table, const struct sockaddr_in *peer, const char *gram, unsigned int len, unsigned int *size); // the data of a message that is a single gram, NULL if it needs reassembly (or is a duplicate, addGram tells), table may be NULL
+bool partialMessageComplete(PartialMessage *message);
+void removePartialMessage(ReassemblyTable *table, PartialMessage *message); // releases it with its buffer
+void printReassemblyStats();
+
+#endif
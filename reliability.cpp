@@ -0,0 +1,900 @@
+/*
+ * Copyright (C) [2023] Milan Kazarka
+ * Email: milan.kazarka.office@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include "reliability.hpp"
+#include "time.hpp"
+#include "common.hpp"
+
+ReliabilityStats reliabilityStats = {0, 0, 0, 0};
+
+static Uuid messageKey(const struct sockaddr_in *peer, unsigned long long msgid) {
+    Uuid key;
+    key.hi = ((uint64_t)peer->sin_addr.s_addr << 16) | peer->sin_port;
+    key.lo = msgid;
+    return key;
+}
+
+/** the header & the pieces of the payload go out as one datagram straight from where they are, the
+* payload isn't copied together first
+*/
+static int sendGramParts(int fd, const struct sockaddr_in *peer, unsigned long long msgid, unsigned int ngrams, unsigned int index,
+    const struct iovec *parts, int nparts) {
+    RQGRAM_HEADER header;
+    header.msgid = msgid;
+    header.ngrams = ngrams;
+    header.index = index;
+
+    struct iovec iov[3];
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    size_t size = 0;
+    for (int n = 0; n < nparts; n++) {
+        iov[n+1] = parts[n];
+        size += parts[n].iov_len;
+    }
+    // a parity gram is as large as the grams it covers & its group on top
+    if (size > sizeof(RQGRAM_PARITY)+RQGRAM_PAYLOAD)
+        return EMSGSIZE;
+
+    verbose("    sending msgid(%llu) ngrams(%u) index(%u) size(%zu)\n",msgid,ngrams,index,size);
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = (void*)peer;
+    msg.msg_namelen = sizeof(*peer);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = nparts+1;
+    if (sendmsg(fd, &msg, 0) == -1)
+        return errno;
+    return 0;
+}
+
+int sendGram(int fd, const struct sockaddr_in *peer, unsigned long long msgid, unsigned int ngrams, unsigned int index, const char *data, unsigned int size) {
+    struct iovec part;
+    part.iov_base = (void*)data;
+    part.iov_len = size;
+    return sendGramParts(fd, peer, msgid, ngrams, index, &part, 1);
+}
+
+/** grams collected while the outbound is locked & handed to the kernel with one sendmmsg once the
+* batch is full or the sender is done for now, instead of a syscall each. The grams point into their
+* messages, which stay around until the batch is sent.
+*/
+typedef struct GramBatch {
+    int fd;
+    struct sockaddr_in peer;
+    int count;
+    RQGRAM_HEADER headers[RELIABILITY_SEND_BATCH];
+    struct iovec iov[RELIABILITY_SEND_BATCH][2];
+    OutboundMessage *messages[RELIABILITY_SEND_BATCH]; // whose gram it is, NULL without retransmission
+    OutboundMessage *finished; // given up as a gram failed, linked by nextQueued (they are off the queue), freed by endBatch
+} GramBatch;
+
+static void initBatch(GramBatch *batch) {
+    batch->fd = -1;
+    batch->count = 0;
+    batch->finished = NULL;
+}
+
+static bool finishMessage(Outbound *outbound, OutboundMessage *message);
+static void warnAbandoned(OutboundMessage *message);
+
+/** send the grams collected so far, a gram that fails doesn't hold up those after it. Its message is
+* given up, same as if it had been sent on its own. Returns the errno of the first that failed or 0.
+*/
+static int sendBatch(GramBatch *batch) {
+    struct mmsghdr msgs[RELIABILITY_SEND_BATCH];
+    int errors[RELIABILITY_SEND_BATCH];
+    int count = batch->count;
+    for (int n = 0; n < count; n++) {
+        memset(&msgs[n], 0, sizeof(msgs[n]));
+        msgs[n].msg_hdr.msg_name = &batch->peer;
+        msgs[n].msg_hdr.msg_namelen = sizeof(batch->peer);
+        msgs[n].msg_hdr.msg_iov = batch->iov[n];
+        msgs[n].msg_hdr.msg_iovlen = 2;
+        errors[n] = 0;
+    }
+    int sent = 0;
+    while (sent < count) {
+        // it stops at the first gram that fails, which is reported by the next call
+        int n = sendmmsg(batch->fd, msgs+sent, count-sent, 0);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            errors[sent++] = errno;
+        } else {
+            sent += n;
+        }
+    }
+    batch->count = 0;
+
+    int error = 0;
+    for (int n = 0; n < count; n++) {
+        if (!errors[n])
+            continue;
+        if (!error)
+            error = errors[n];
+        OutboundMessage *message = batch->messages[n];
+        if (!message || message->acked)
+            continue;
+        errno = errors[n];
+        perror("sendmmsg");
+        warnAbandoned(message);
+        // the caller may still look at it (acked), so it is only freed once the sender is done
+        if (finishMessage(message->outbound, message)) {
+            message->nextQueued = batch->finished;
+            batch->finished = message;
+        }
+    }
+    return error;
+}
+
+/** add a gram to the batch, the batch goes out first if it is full or for another socket or peer
+*/
+static int batchGram(GramBatch *batch, OutboundMessage *message, int fd, const struct sockaddr_in *peer, unsigned long long msgid,
+    unsigned int ngrams, unsigned int index, const char *data, unsigned int size) {
+    int error = 0;
+    if (batch->count == RELIABILITY_SEND_BATCH || (batch->count > 0 && (batch->fd != fd ||
+        batch->peer.sin_addr.s_addr != peer->sin_addr.s_addr || batch->peer.sin_port != peer->sin_port)))
+        error = sendBatch(batch);
+    batch->fd = fd;
+    batch->peer = *peer;
+    int n = batch->count++;
+    batch->headers[n].msgid = msgid;
+    batch->headers[n].ngrams = ngrams;
+    batch->headers[n].index = index;
+    batch->iov[n][0].iov_base = &batch->headers[n];
+    batch->iov[n][0].iov_len = sizeof(RQGRAM_HEADER);
+    batch->iov[n][1].iov_base = (void*)data;
+    batch->iov[n][1].iov_len = size;
+    batch->messages[n] = message;
+    verbose("    batching msgid(%llu) ngrams(%u) index(%u) size(%u)\n",msgid,ngrams,index,size);
+    return error;
+}
+
+static void freeOutboundMessage(OutboundMessage *message);
+
+/** send what is left in the batch & free the messages given up on the way
+*/
+static void endBatch(GramBatch *batch) {
+    sendBatch(batch);
+    while (batch->finished) {
+        OutboundMessage *message = batch->finished;
+        batch->finished = message->nextQueued;
+        freeOutboundMessage(message);
+    }
+}
+
+void sendAck(int fd, const struct sockaddr_in *peer, unsigned long long msgid, unsigned int recovered) {
+    sendGram(fd, peer, msgid, 0, RQGRAM_CONTROL_ACK, (const char*)&recovered, sizeof(recovered));
+}
+
+void sendSack(int fd, const struct sockaddr_in *peer, const RQMSG *rqmsg, unsigned int from, unsigned int end, unsigned int parityEnd) {
+    char payload[3*sizeof(unsigned int)+MAXGRAMS/8];
+    unsigned int ngrams = rqmsg->ngrams;
+    memcpy(payload, &ngrams, sizeof(ngrams));
+    memcpy(payload+sizeof(ngrams), &from, sizeof(from));
+    memcpy(payload+2*sizeof(unsigned int), &parityEnd, sizeof(parityEnd));
+    unsigned char *bitmap = (unsigned char*)payload+3*sizeof(unsigned int);
+    unsigned int nbits = end > from ? end-from : 0;
+    memset(bitmap, 0, (nbits+7)/8);
+    for (unsigned int n = 0; n < nbits; n++) {
+        if (rqgramPresent(rqmsg, from+n))
+            bitmap[n/8] |= 1 << (n%8);
+    }
+    verbose("sack msgid(%llu) received(%u/%u) from(%u)\n",rqmsg->msgid,rqmsg->received,ngrams,from);
+    sendGram(fd, peer, rqmsg->msgid, 0, RQGRAM_CONTROL_SACK, payload, 3*sizeof(unsigned int)+(nbits+7)/8);
+}
+
+static void freeOutboundMessage(OutboundMessage *message) {
+    free(message->grams);
+    releaseSlice(&message->data);
+    free(message);
+}
+
+/** sequence numbers of the grams sent to a peer wrap around
+*/
+static bool seqBefore(unsigned int a, unsigned int b) {
+    return (int)(a-b) < 0;
+}
+
+static void onPace(Timer *timer);
+
+/** expects the outbound to be locked
+*/
+static PeerPath *peerPath(Outbound *outbound, const struct sockaddr_in *peer, unsigned int gramsize) {
+    Uuid key = messageKey(peer, 0);
+    PeerPath *path = (PeerPath*)uuidMapGet(&outbound->peers, &key, false);
+    if (!path) {
+        path = (PeerPath*)malloc(sizeof(PeerPath));
+        path->srttUs = -1;
+        path->rttvarUs = 0;
+        path->rto = RELIABILITY_INITIAL_RTO_MS;
+        path->cwnd = RELIABILITY_INITIAL_CWND*gramsize;
+        path->ssthresh = outbound->maxBytes;
+        path->inflight = 0;
+        path->acked = 0;
+        path->seq = 0;
+        path->recoverySeq = 0;
+        path->recovering = false;
+        path->tokens = RELIABILITY_PACING_BURST*gramsize;
+        path->refillUs = getMonotonicMicros();
+        initTimer(&path->pace, onPace, path);
+        path->lossPermille = 0;
+        path->lossGrams = 0;
+        path->lossWindow = 0;
+        path->queued = NULL;
+        path->outbound = outbound;
+        uuidMapPut(&outbound->peers, &key, path, false);
+    }
+    return path;
+}
+
+static void sampleRtt(PeerPath *path, long long sampleUs) {
+    if (path->srttUs < 0) {
+        path->srttUs = sampleUs;
+        path->rttvarUs = sampleUs/2;
+    } else {
+        long long delta = path->srttUs > sampleUs ? path->srttUs-sampleUs : sampleUs-path->srttUs;
+        path->rttvarUs = (3*path->rttvarUs+delta)/4;
+        path->srttUs = (7*path->srttUs+sampleUs)/8;
+    }
+    long long variance = 4*path->rttvarUs > RELIABILITY_TICK_MS*1000 ? 4*path->rttvarUs : RELIABILITY_TICK_MS*1000;
+    path->rto = (path->srttUs+variance+999)/1000;
+    if (path->rto < RELIABILITY_MIN_RTO_MS)
+        path->rto = RELIABILITY_MIN_RTO_MS;
+    if (path->rto > RELIABILITY_MAX_RTO_MS)
+        path->rto = RELIABILITY_MAX_RTO_MS;
+}
+
+/** bytes per second the grams to a peer are paced out at, 0 while no round trip was measured
+*/
+static long long pacingRate(PeerPath *path) {
+    if (path->srttUs < 0)
+        return 0;
+    long long srttUs = path->srttUs > 100 ? path->srttUs : 100; // loopback rounds down to nothing
+    long long gain = path->cwnd < path->ssthresh ? 200 : 125; // percent
+    return (long long)path->cwnd*gain/100*1000000/srttUs;
+}
+
+static void refillTokens(PeerPath *path, unsigned int gramsize) {
+    long long now = getMonotonicMicros();
+    long long rate = pacingRate(path);
+    long long burst = RELIABILITY_PACING_BURST*gramsize;
+    if (rate == 0) {
+        // nothing to pace by yet, the window alone limits what is sent
+        path->tokens = path->cwnd;
+    } else {
+        long long elapsed = now-path->refillUs;
+        if (elapsed > 1000000)
+            elapsed = 1000000;
+        path->tokens += rate*elapsed/1000000;
+        // the timer wheel wakes the sender up once a tick at most, a tick's worth may go out at once
+        long long tick = rate*RELIABILITY_TICK_MS/1000*2;
+        if (path->tokens > (tick > burst ? tick : burst))
+            path->tokens = tick > burst ? tick : burst;
+    }
+    path->refillUs = now;
+}
+
+/** the timeout doubles with every round
+*/
+static long long retransmitTimeout(OutboundMessage *message) {
+    long long rto = message->path->rto << (message->rounds < 8 ? message->rounds : 8);
+    return rto < RELIABILITY_MAX_RTO_MS ? rto : RELIABILITY_MAX_RTO_MS;
+}
+
+static unsigned int gramSize(OutboundMessage *message, unsigned int index) {
+    return index == message->ngrams-1 ? message->len-index*message->gramsize : message->gramsize;
+}
+
+static bool gramsToSend(OutboundMessage *message) {
+    return message->lost > 0 || message->nextGram < message->ngrams;
+}
+
+static void enqueueMessage(PeerPath *path, OutboundMessage *message) {
+    if (message->nextQueued)
+        return;
+    if (!path->queued) {
+        message->nextQueued = message;
+        message->prevQueued = message;
+        path->queued = message;
+    } else {
+        message->nextQueued = path->queued;
+        message->prevQueued = path->queued->prevQueued;
+        path->queued->prevQueued->nextQueued = message;
+        path->queued->prevQueued = message;
+    }
+}
+
+static void dequeueMessage(PeerPath *path, OutboundMessage *message) {
+    if (!message->nextQueued)
+        return;
+    if (message->nextQueued == message) {
+        path->queued = NULL;
+    } else {
+        message->prevQueued->nextQueued = message->nextQueued;
+        message->nextQueued->prevQueued = message->prevQueued;
+        if (path->queued == message)
+            path->queued = message->nextQueued;
+    }
+    message->nextQueued = NULL;
+    message->prevQueued = NULL;
+}
+
+/** send a gram of the message (again), expects the outbound to be locked. With a batch the gram only
+* joins it & counts as sent, a failure shows once the batch goes out.
+*/
+static int transmitGram(OutboundMessage *message, unsigned int index, GramBatch *batch) {
+    PeerPath *path = message->path;
+    OutboundGram *gram = &message->grams[index];
+    unsigned int size = gramSize(message, index);
+    const char *data = message->data.data+index*message->gramsize;
+    if (batch) {
+        batchGram(batch, message, message->fd, &message->peer, message->msgid, message->ngrams, index, data, size);
+    } else {
+        int error = sendGram(message->fd, &message->peer, message->msgid, message->ngrams, index, data, size);
+        if (error)
+            return error;
+    }
+
+    if (gram->state == OUTBOUND_GRAM_LOST)
+        message->lost--;
+    if (gram->state != OUTBOUND_GRAM_SENT && gram->state != OUTBOUND_GRAM_ACKED)
+        path->inflight += size;
+    if (gram->state != OUTBOUND_GRAM_ACKED) {
+        gram->state = OUTBOUND_GRAM_SENT;
+        gram->seq = ++path->seq;
+        gram->sentUs = (unsigned int)(getMonotonicMicros()-message->sentUs);
+    }
+    if (gram->sends < 255)
+        gram->sends++;
+    if (gram->sends > 1)
+        gram->parity = OUTBOUND_PARITY_NONE;
+    if (gram->sends > 1)
+        __sync_add_and_fetch(&reliabilityStats.retransmitted,1);
+    if (index == message->nextGram)
+        message->nextGram++;
+    path->tokens -= size;
+
+    if (!timerArmed(&message->retransmit))
+        addTimer(&message->outbound->timers, &message->retransmit, retransmitTimeout(message));
+    return 0;
+}
+
+/** the loss rate sets how many grams a parity gram covers, about one lost gram in two groups
+*/
+static void measureLoss(PeerPath *path, unsigned int grams, unsigned int lost) {
+    path->lossGrams += lost;
+    path->lossWindow += grams;
+    if (path->lossWindow < RELIABILITY_LOSS_WINDOW)
+        return;
+    unsigned int sample = (unsigned int)((unsigned long long)path->lossGrams*1000/path->lossWindow);
+    path->lossPermille = (3*path->lossPermille+sample)/4;
+    path->lossGrams = 0;
+    path->lossWindow = 0;
+}
+
+static unsigned int parityGroup(PeerPath *path) {
+    if (!path->outbound->fec || path->lossPermille < RELIABILITY_FEC_MIN_LOSS)
+        return 0;
+    unsigned int group = 500/path->lossPermille;
+    if (group < 2)
+        return 2;
+    return group < RELIABILITY_FEC_MAX_GROUP ? group : RELIABILITY_FEC_MAX_GROUP;
+}
+
+/** after the first send of a gram, close its group with a parity gram once the group is full or the
+* message ends, expects the outbound to be locked
+*/
+static void sendParity(OutboundMessage *message, unsigned int index, GramBatch *batch) {
+    if (index == message->groupFirst)
+        message->groupSize = parityGroup(message->path);
+    if (message->groupSize == 0) {
+        message->groupFirst = index+1;
+        return;
+    }
+    if (message->grams[index].sends == 1)
+        message->grams[index].parity = OUTBOUND_PARITY_PENDING;
+    unsigned int first = message->groupFirst;
+    unsigned int count = index+1-first;
+    if (count < message->groupSize && index != message->ngrams-1)
+        return;
+    message->groupFirst = index+1;
+    if (count < 2)
+        return;
+    // the parity follows the grams it covers, also a message given up on the way sends none
+    if (batch) {
+        sendBatch(batch);
+        if (message->acked)
+            return;
+    }
+
+    char parity[RQGRAM_PAYLOAD];
+    RQGRAM_PARITY group;
+    group.ngrams = message->ngrams;
+    group.first = first;
+    group.count = count;
+    group.lastSize = gramSize(message, index);
+    memset(parity, 0, message->gramsize);
+    for (unsigned int n = first; n <= index; n++)
+        xorGram(parity, message->data.data+n*message->gramsize, gramSize(message, n));
+    struct iovec parts[2];
+    parts[0].iov_base = &group;
+    parts[0].iov_len = sizeof(group);
+    parts[1].iov_base = parity;
+    parts[1].iov_len = message->gramsize;
+    // nothing depends on it arriving
+    if (sendGramParts(message->fd, &message->peer, message->msgid, 0, RQGRAM_CONTROL_PARITY, parts, 2) == 0) {
+        message->path->tokens -= message->gramsize;
+        __sync_add_and_fetch(&reliabilityStats.parity,1);
+    }
+    // even if it didn't go out, the grams are lost once a later parity arrived without them
+    for (unsigned int n = first; n <= index; n++) {
+        if (message->grams[n].parity == OUTBOUND_PARITY_PENDING) {
+            message->grams[n].parity = OUTBOUND_PARITY_SENT;
+            message->grams[n].groupEnd = index+1;
+        }
+    }
+}
+
+static void markLost(OutboundMessage *message, unsigned int index) {
+    message->grams[index].state = OUTBOUND_GRAM_LOST;
+    message->path->inflight -= gramSize(message, index);
+    message->lost++;
+    message->lostGrams++;
+    if (index < message->lostFrom)
+        message->lostFrom = index;
+}
+
+/** the grams it still has in flight no longer count against the window, expects the outbound to be locked
+*/
+static void releaseMessage(Outbound *outbound, OutboundMessage *message) {
+    uuidMapRemove(&outbound->messages, &message->key, false);
+    outbound->bytes -= message->len;
+    for (unsigned int n = 0; n < message->nextGram; n++) {
+        if (message->grams[n].state == OUTBOUND_GRAM_SENT)
+            message->path->inflight -= gramSize(message, n);
+    }
+    dequeueMessage(message->path, message);
+}
+
+/** done with a message outside of its retransmission callback, true if the caller frees it
+*/
+static bool finishMessage(Outbound *outbound, OutboundMessage *message) {
+    releaseMessage(outbound, message);
+    message->acked = true;
+    return cancelTimer(&outbound->timers, &message->retransmit);
+}
+
+static void warnAbandoned(OutboundMessage *message) {
+    __sync_add_and_fetch(&reliabilityStats.abandoned,1);
+    printf("warning: msgid(%llu) to %s:%d wasn't acknowledged, giving up\n",message->msgid,
+        inet_ntoa(message->peer.sin_addr),ntohs(message->peer.sin_port));
+}
+
+/** send what the window & the tokens allow, a gram of each queued message in turn so that a short
+* message isn't stuck behind a long one. Expects the outbound to be locked.
+*/
+static void pumpPath(PeerPath *path) {
+    Outbound *outbound = path->outbound;
+    if (!path->queued)
+        return;
+    GramBatch batch;
+    initBatch(&batch);
+    refillTokens(path, path->queued->gramsize);
+    while (path->queued && path->inflight < path->cwnd) {
+        OutboundMessage *message = path->queued;
+        // everything lost came through after all
+        if (!gramsToSend(message)) {
+            dequeueMessage(path, message);
+            continue;
+        }
+        if (path->tokens <= 0) {
+            long long rate = pacingRate(path);
+            long long delayMs = rate > 0 ? (-path->tokens+message->gramsize)*1000/rate : 0;
+            if (!timerArmed(&path->pace))
+                addTimer(&outbound->timers, &path->pace, delayMs);
+            break;
+        }
+
+        unsigned int index = message->nextGram;
+        if (message->lost > 0) {
+            index = message->lostFrom;
+            while (message->grams[index].state != OUTBOUND_GRAM_LOST)
+                index++;
+            message->lostFrom = index;
+        }
+        bool fresh = index == message->nextGram;
+        transmitGram(message, index, &batch);
+        if (fresh)
+            sendParity(message, index, &batch);
+        // given up as the batch went out, it is off the queue already
+        if (message->acked)
+            continue;
+        if (!gramsToSend(message))
+            dequeueMessage(path, message);
+        else
+            path->queued = message->nextQueued;
+    }
+    endBatch(&batch);
+}
+
+static void onPace(Timer *timer) {
+    PeerPath *path = (PeerPath*)timer->data;
+    pthread_mutex_lock(&path->outbound->mutex);
+    pumpPath(path);
+    pthread_mutex_unlock(&path->outbound->mutex);
+}
+
+/** grams sent before the last one that arrived were lost, the window is halved once per round trip
+*/
+static void onLoss(PeerPath *path, unsigned int gramsize) {
+    if (path->recovering)
+        return;
+    size_t floor = RELIABILITY_MIN_CWND*gramsize;
+    path->ssthresh = path->cwnd/2 > floor ? path->cwnd/2 : floor;
+    path->cwnd = path->ssthresh;
+    path->acked = 0;
+    path->recovering = true;
+    path->recoverySeq = path->seq;
+    __sync_add_and_fetch(&reliabilityStats.congestion,1);
+}
+
+/** open the window for the bytes acknowledged, as long as it is actually used
+*/
+static void onAcked(PeerPath *path, size_t bytes, unsigned int highestSeq, unsigned int gramsize) {
+    if (path->recovering) {
+        if (!seqBefore(path->recoverySeq, highestSeq))
+            return;
+        path->recovering = false;
+    }
+    if ((path->inflight+bytes)*2 < path->cwnd)
+        return;
+    if (path->cwnd < path->ssthresh) {
+        path->cwnd += bytes;
+    } else {
+        path->acked += bytes;
+        while (path->acked >= path->cwnd) {
+            path->acked -= path->cwnd;
+            path->cwnd += gramsize;
+        }
+    }
+    if (path->cwnd > path->outbound->maxBytes)
+        path->cwnd = path->outbound->maxBytes;
+}
+
+/** nothing was heard back in time. The first time the gram sent last goes again, the receiver tells
+* which grams it has once it sees it twice. After that everything in flight counts as lost & the
+* window starts over.
+*/
+static void onRetransmit(Timer *timer) {
+    OutboundMessage *message = (OutboundMessage*)timer->data;
+    Outbound *outbound = message->outbound;
+
+    pthread_mutex_lock(&outbound->mutex);
+    if (message->acked) {
+        pthread_mutex_unlock(&outbound->mutex);
+        freeOutboundMessage(message);
+        return;
+    }
+    PeerPath *path = message->path;
+    unsigned int nsent = 0;
+    unsigned int newest = message->ngrams-1;
+    for (unsigned int n = 0; n < message->nextGram; n++) {
+        if (message->grams[n].state != OUTBOUND_GRAM_SENT)
+            continue;
+        if (nsent == 0 || seqBefore(message->grams[newest].seq, message->grams[n].seq))
+            newest = n;
+        nsent++;
+    }
+    if (nsent == 0 && gramsToSend(message)) {
+        // only waiting for its turn
+        addTimer(&outbound->timers, &message->retransmit, retransmitTimeout(message));
+        pthread_mutex_unlock(&outbound->mutex);
+        return;
+    }
+    if (message->rounds >= RELIABILITY_MAX_ROUNDS) {
+        releaseMessage(outbound, message);
+        warnAbandoned(message);
+        pthread_mutex_unlock(&outbound->mutex);
+        freeOutboundMessage(message);
+        return;
+    }
+
+    if (message->rounds > 0 && nsent > 0) {
+        size_t floor = RELIABILITY_MIN_CWND*message->gramsize;
+        path->ssthresh = path->cwnd/2 > floor ? path->cwnd/2 : floor;
+        path->cwnd = floor;
+        path->acked = 0;
+        path->recovering = false;
+        __sync_add_and_fetch(&reliabilityStats.congestion,1);
+        for (unsigned int n = 0; n < message->nextGram; n++) {
+            if (message->grams[n].state == OUTBOUND_GRAM_SENT)
+                markLost(message, n);
+        }
+        enqueueMessage(path, message);
+    } else {
+        // the whole message may have arrived & only its acknowledgement got lost
+        transmitGram(message, newest, NULL);
+    }
+    message->rounds++;
+    addTimer(&outbound->timers, &message->retransmit, retransmitTimeout(message));
+    pumpPath(path);
+    pthread_mutex_unlock(&outbound->mutex);
+}
+
+static void *retransmitThread(void *data) {
+    Outbound *outbound = (Outbound*)data;
+    while (1) {
+        struct pollfd pfd;
+        pfd.fd = outbound->timers.timerFd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        // without a timerfd we can't be woken up when a timer is added, poll the wheel instead
+        if (pfd.fd == -1)
+            poll(NULL, 0, RELIABILITY_TICK_MS);
+        else if (poll(&pfd, 1, -1) == -1 && errno != EINTR)
+            perror("poll");
+        runTimers(&outbound->timers);
+    }
+    return NULL;
+}
+
+bool initOutbound(Outbound *outbound, size_t maxBytes, bool fec) {
+    initUuidMap(&outbound->messages, 64, UUIDMAP_NOMUTEX);
+    initUuidMap(&outbound->peers, 16, UUIDMAP_NOMUTEX);
+    pthread_mutex_init(&outbound->mutex, NULL);
+    initTimerWheel(&outbound->timers, RELIABILITY_TICK_MS, TIMERWHEEL_USEMUTEX);
+    outbound->bytes = 0;
+    outbound->maxBytes = maxBytes > 0 ? maxBytes : RELIABILITY_DEFAULT_MEMORY;
+    outbound->fec = fec;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int rc = pthread_create(&outbound->thread, &attr, retransmitThread, outbound);
+    pthread_attr_destroy(&attr);
+    if (rc != 0) {
+        perror("pthread_create");
+        return false;
+    }
+    return true;
+}
+
+int sendMessage(Outbound *outbound, int fd, const struct sockaddr_in *peer, unsigned long long msgid, Slice data, unsigned int gramsize) {
+    unsigned int len = (unsigned int)data.len;
+    unsigned int ngrams = (len+gramsize-1)/gramsize;
+    if (ngrams == 0)
+        return 0;
+    if (ngrams > MAXGRAMS) {
+        printf("warning: message of %u bytes doesn't fit into %d grams, dropping it\n",len,MAXGRAMS);
+        return 0;
+    }
+
+    // keep it until it is acknowledged (a reference, a copy only if the caller borrowed the data), unless
+    // too much is waiting for that already
+    if (outbound) {
+        Uuid key = messageKey(peer, msgid);
+        pthread_mutex_lock(&outbound->mutex);
+        if (outbound->bytes+len <= outbound->maxBytes && !uuidMapGet(&outbound->messages, &key, false)) {
+            OutboundMessage *message = (OutboundMessage*)malloc(sizeof(OutboundMessage));
+            message->key = key;
+            message->fd = fd;
+            message->peer = *peer;
+            message->msgid = msgid;
+            message->data = keepSlice(data);
+            message->len = len;
+            message->gramsize = gramsize;
+            message->ngrams = ngrams;
+            message->grams = (OutboundGram*)calloc(ngrams, sizeof(OutboundGram));
+            message->nextGram = 0;
+            message->lost = 0;
+            message->lostFrom = ngrams;
+            message->lostGrams = 0;
+            message->groupFirst = 0;
+            message->parityEnd = 0;
+            message->groupSize = 0;
+            message->sentUs = getMonotonicMicros();
+            message->rounds = 0;
+            message->acked = false;
+            message->path = peerPath(outbound, peer, gramsize);
+            message->nextQueued = NULL;
+            message->prevQueued = NULL;
+            message->outbound = outbound;
+            initTimer(&message->retransmit, onRetransmit, message);
+            uuidMapPut(&outbound->messages, &key, message, false);
+            outbound->bytes += len;
+
+            // the first gram goes right away, a message of one gram never waits for a window or
+            // tokens & a gram too large for the path is reported to the caller
+            int error = transmitGram(message, 0, NULL);
+            if (error) {
+                bool free = finishMessage(outbound, message);
+                pthread_mutex_unlock(&outbound->mutex);
+                if (free)
+                    freeOutboundMessage(message);
+                return error;
+            }
+            sendParity(message, 0, NULL);
+            if (gramsToSend(message)) {
+                enqueueMessage(message->path, message);
+                pumpPath(message->path);
+            }
+            pthread_mutex_unlock(&outbound->mutex);
+            return 0;
+        }
+        printf("warning: too much unacknowledged data, msgid(%llu) is sent without retransmission\n",msgid);
+        pthread_mutex_unlock(&outbound->mutex);
+    }
+
+    GramBatch batch;
+    initBatch(&batch);
+    for (unsigned int index = 0; index < ngrams; index++) {
+        unsigned int offset = index*gramsize;
+        unsigned int size = index == ngrams-1 ? len-offset : gramsize;
+        int error = batchGram(&batch, NULL, fd, peer, msgid, ngrams, index, data.data+offset, size);
+        if (error) {
+            // the gram joined the batch after the full one failed, it still goes out
+            sendBatch(&batch);
+            return error;
+        }
+    }
+    return sendBatch(&batch);
+}
+
+/** take the grams the receiver has as acknowledged: all below from & those of the bitmap of nbits after,
+* expects the outbound to be locked. False if none of them is news, otherwise highestSeq is the sequence
+* number of the newest & grams still in flight that were sent before it got lost.
+*/
+static bool ackGrams(OutboundMessage *message, unsigned int from, const unsigned char *bitmap, unsigned int nbits, unsigned int *highestSeq) {
+    PeerPath *path = message->path;
+    size_t bytes = 0;
+    long long sampleUs = -1;
+    unsigned int sampleSeq = 0;
+    bool any = false;
+    for (unsigned int n = 0; n < message->nextGram; n++) {
+        OutboundGram *gram = &message->grams[n];
+        if (gram->state == OUTBOUND_GRAM_ACKED)
+            continue;
+        if (n >= from && (n-from >= nbits || !(bitmap[(n-from)/8] & (1 << ((n-from)%8)))))
+            continue;
+        if (gram->state == OUTBOUND_GRAM_LOST) {
+            // it arrived after all
+            message->lost--;
+        } else {
+            bytes += gramSize(message, n);
+            path->inflight -= gramSize(message, n);
+            if (!any || seqBefore(*highestSeq, gram->seq))
+                *highestSeq = gram->seq;
+            any = true;
+            // only a gram sent once tells the round trip time (Karn's algorithm)
+            if (gram->sends == 1 && (sampleUs < 0 || seqBefore(sampleSeq, gram->seq))) {
+                sampleUs = getMonotonicMicros()-message->sentUs-gram->sentUs;
+                sampleSeq = gram->seq;
+            }
+        }
+        gram->state = OUTBOUND_GRAM_ACKED;
+    }
+    if (sampleUs >= 0)
+        sampleRtt(path, sampleUs);
+    if (any)
+        onAcked(path, bytes, *highestSeq, message->gramsize);
+    return any;
+}
+
+bool onControlGram(Outbound *outbound, const struct sockaddr_in *peer, const char *gram, unsigned int len) {
+    RQGRAM_HEADER header;
+    if (len < sizeof(header))
+        return false;
+    memcpy(&header, gram, sizeof(header));
+    // parity is for the reassembly
+    if (header.ngrams != 0 || header.index == RQGRAM_CONTROL_PARITY)
+        return false;
+    if (!outbound)
+        return true;
+
+    Uuid key = messageKey(peer, header.msgid);
+    pthread_mutex_lock(&outbound->mutex);
+    OutboundMessage *message = (OutboundMessage*)uuidMapGet(&outbound->messages, &key, false);
+    if (!message) {
+        // acknowledged before, or given up on
+        pthread_mutex_unlock(&outbound->mutex);
+        return true;
+    }
+    PeerPath *path = message->path;
+    unsigned int highestSeq = 0;
+
+    if (header.index == RQGRAM_CONTROL_ACK) {
+        unsigned int recovered = 0;
+        if (len >= sizeof(header)+sizeof(recovered))
+            memcpy(&recovered, gram+sizeof(header), sizeof(recovered));
+        ackGrams(message, message->ngrams, NULL, 0, &highestSeq);
+        measureLoss(path, message->ngrams, message->lostGrams+recovered);
+        bool free = finishMessage(outbound, message);
+        pumpPath(path);
+        pthread_mutex_unlock(&outbound->mutex);
+        if (free)
+            freeOutboundMessage(message);
+        return true;
+    }
+
+    if (header.index == RQGRAM_CONTROL_SACK) {
+        unsigned int ngrams = 0;
+        unsigned int from = 0;
+        unsigned int parityEnd = 0;
+        const unsigned char *bitmap = (const unsigned char*)gram+sizeof(header)+3*sizeof(unsigned int);
+        if (len >= sizeof(header)+3*sizeof(unsigned int)) {
+            memcpy(&ngrams, gram+sizeof(header), sizeof(ngrams));
+            memcpy(&from, gram+sizeof(header)+sizeof(ngrams), sizeof(from));
+            memcpy(&parityEnd, gram+sizeof(header)+2*sizeof(unsigned int), sizeof(parityEnd));
+        }
+        if (ngrams != message->ngrams || from > ngrams) {
+            pthread_mutex_unlock(&outbound->mutex);
+            return true;
+        }
+        unsigned int nbits = (len-sizeof(header)-3*sizeof(unsigned int))*8;
+        if (nbits > ngrams-from)
+            nbits = ngrams-from;
+        bool acked = ackGrams(message, from, bitmap, nbits, &highestSeq);
+        // the lost grams it waited to resend may have arrived, nothing left to send
+        if (!gramsToSend(message))
+            dequeueMessage(path, message);
+        if (acked || parityEnd > message->parityEnd) {
+            if (acked) {
+                message->rounds = 0;
+                addTimer(&outbound->timers, &message->retransmit, retransmitTimeout(message));
+            }
+            if (parityEnd > message->parityEnd && parityEnd <= message->ngrams)
+                message->parityEnd = parityEnd;
+            unsigned int lost = 0;
+            for (unsigned int n = 0; n < message->nextGram; n++) {
+                OutboundGram *sent = &message->grams[n];
+                if (sent->state != OUTBOUND_GRAM_SENT)
+                    continue;
+                // grams under parity get their chance to be rebuilt first
+                if ((acked && sent->parity == OUTBOUND_PARITY_NONE && seqBefore(sent->seq, highestSeq)) ||
+                    (sent->parity == OUTBOUND_PARITY_SENT && sent->groupEnd <= message->parityEnd)) {
+                    markLost(message, n);
+                    lost++;
+                }
+            }
+            if (lost > 0) {
+                verbose("sack msgid(%llu) lost %u of %u grams\n",message->msgid,lost,ngrams);
+                onLoss(path, message->gramsize);
+                enqueueMessage(path, message);
+            }
+        }
+        pumpPath(path);
+    }
+    pthread_mutex_unlock(&outbound->mutex);
+    return true;
+}
+
+void printReliabilityStats() {
+    printf("reliability: retransmitted grams(%llu) abandoned messages(%llu) congestion(%llu) parity grams(%llu)\n",
+        reliabilityStats.retransmitted,reliabilityStats.abandoned,reliabilityStats.congestion,reliabilityStats.parity);
+}
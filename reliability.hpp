@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) [2023] Milan Kazarka
+ * Email: milan.kazarka.office@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __RELIABILITY_HPP__
+#define __RELIABILITY_HPP__
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include "msggram.hpp"
+#include "uuidmap.hpp"
+#include "timerwheel.hpp"
+#include "buffer.hpp"
+
+#define RELIABILITY_TICK_MS 5
+#define RELIABILITY_INITIAL_RTO_MS 200 // until the first round trip to a peer was measured
+#define RELIABILITY_MIN_RTO_MS 20
+#define RELIABILITY_MAX_RTO_MS 2000
+#define RELIABILITY_MAX_ROUNDS 8 // retransmission timeouts in a row before a message is given up
+#define RELIABILITY_DEFAULT_MEMORY (64*1024*1024) // unacknowledged messages kept for retransmission, beyond that they are sent once
+#define RELIABILITY_SACK_EVERY 2 // grams a receiver takes before it tells the sender how a message is getting along
+#define RELIABILITY_INITIAL_CWND 16 // grams in flight to a peer before anything was acknowledged
+#define RELIABILITY_MIN_CWND 4 // grams, after a retransmission timeout
+#define RELIABILITY_PACING_BURST 4 // grams that may leave back to back, at least
+#define RELIABILITY_LOSS_WINDOW 256 // grams the loss rate to a peer is measured over
+#define RELIABILITY_FEC_MIN_LOSS 10 // permille of grams lost before parity is sent along
+#define RELIABILITY_FEC_MAX_GROUP 32 // grams covered by a parity gram, at the lowest loss rate
+#define RELIABILITY_SEND_BATCH 32 // grams handed to the kernel with one sendmmsg
+
+/** what a sender knows about the path to a peer, shared by all the messages to it
+*
+* The congestion window (AIMD): it opens by the bytes acknowledged while below ssthresh (slow start)
+* & by a gram per window above it, halves once per round trip that lost grams & falls to
+* RELIABILITY_MIN_CWND when nothing came back in time. The grams are paced out at cwnd per smoothed
+* round trip time (twice that in slow start) by a token bucket, instead of in bursts that overflow
+* the socket buffers along the way.
+*/
+typedef struct PeerPath {
+    long long srttUs; // -1 until measured
+    long long rttvarUs;
+    long long rto; // ms
+    size_t cwnd; // bytes
+    size_t ssthresh;
+    size_t inflight; // bytes of the grams sent & neither acknowledged nor lost
+    size_t acked; // bytes acknowledged towards the next gram of congestion avoidance
+    unsigned int seq; // of the last gram sent to the peer
+    unsigned int recoverySeq; // the window isn't reduced again for losses of grams sent up to here
+    bool recovering;
+    long long tokens; // bytes that may be sent right now, negative when in debt
+    long long refillUs; // getMonotonicMicros() of the last refill
+    Timer pace; // armed while grams wait for tokens
+    unsigned int lossPermille; // smoothed, of the grams lost on the way including those the peer rebuilt from parity
+    unsigned int lossGrams; // in the current window
+    unsigned int lossWindow; // grams
+    struct OutboundMessage *queued; // messages with grams to send, served round-robin
+    struct Outbound *outbound;
+} PeerPath;
+
+#define OUTBOUND_GRAM_UNSENT 0
+#define OUTBOUND_GRAM_SENT 1 // counted in inflight
+#define OUTBOUND_GRAM_LOST 2 // waits to be sent again
+#define OUTBOUND_GRAM_ACKED 3
+
+#define OUTBOUND_PARITY_NONE 0
+#define OUTBOUND_PARITY_PENDING 1 // its group isn't complete yet
+#define OUTBOUND_PARITY_SENT 2 // it is lost once the receiver got the parity without it
+
+typedef struct OutboundGram {
+    unsigned int seq; // PeerPath seq of its last send, grams sent before one that arrived are lost
+    unsigned int sentUs; // of its last send, since the message's sentUs
+    unsigned int groupEnd; // one past the last gram of the group its parity covers
+    unsigned char state;
+    unsigned char sends;
+    unsigned char parity; // of its first send
+} OutboundGram;
+
+typedef struct OutboundMessage {
+    Uuid key; // peer address & port, msgid
+    int fd;
+    struct sockaddr_in peer;
+    unsigned long long msgid;
+    Slice data; // a reference held until it is acknowledged
+    unsigned int len;
+    unsigned int gramsize;
+    unsigned int ngrams;
+    OutboundGram *grams;
+    unsigned int nextGram; // first one never sent
+    unsigned int lost; // grams waiting to be sent again
+    unsigned int lostFrom; // none lost below
+    unsigned int lostGrams; // ever, towards the loss rate
+    unsigned int groupFirst; // of the grams the next parity gram covers
+    unsigned int parityEnd; // as the receiver last reported it
+    unsigned int groupSize; // 0 to send no parity for the group
+    long long sentUs; // getMonotonicMicros() of the first send
+    int rounds; // retransmission timeouts since the last progress
+    bool acked; // the retransmission callback frees it
+    PeerPath *path;
+    Timer retransmit;
+    struct OutboundMessage *nextQueued; // circular while queued on the path
+    struct OutboundMessage *prevQueued;
+    struct Outbound *outbound;
+} OutboundMessage;
+
+typedef struct Outbound {
+    UuidMap messages; // OutboundMessage by peer & msgid
+    UuidMap peers; // PeerPath by peer address & port, never removed
+    pthread_mutex_t mutex;
+    TimerWheel timers;
+    pthread_t thread;
+    size_t bytes;
+    size_t maxBytes;
+    bool fec; // send parity grams along when the path loses grams
+} Outbound;
+
+/** summed over every Outbound of the process
+*/
+typedef struct ReliabilityStats {
+    volatile unsigned long long retransmitted; // grams
+    volatile unsigned long long abandoned; // messages never acknowledged
+    volatile unsigned long long congestion; // windows reduced for lost grams
+    volatile unsigned long long parity; // grams
+} ReliabilityStats;
+
+extern ReliabilityStats reliabilityStats;
+
+bool initOutbound(Outbound *outbound, size_t maxBytes, bool fec);
+int sendGram(int fd, const struct sockaddr_in *peer, unsigned long long msgid, unsigned int ngrams, unsigned int index, const char *data, unsigned int size); // 0 or errno
+int sendMessage(Outbound *outbound, int fd, const struct sockaddr_in *peer, unsigned long long msgid, Slice data, unsigned int gramsize); // 0 or the errno of its first gram, the rest is paced out
+bool onControlGram(Outbound *outbound, const struct sockaddr_in *peer, const char *gram, unsigned int len); // false if it isn't an acknowledgement
+
+void sendAck(int fd, const struct sockaddr_in *peer, unsigned long long msgid, unsigned int recovered); // recovered grams rebuilt from parity
+void sendSack(int fd, const struct sockaddr_in *peer, const RQMSG *rqmsg, unsigned int from, unsigned int end, unsigned int parityEnd); // the grams from below end, all of them below from arrived
+void printReliabilityStats();
+
+#endif
@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) [2023] Milan Kazarka
+ * Email: milan.kazarka.office@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "slotmap.hpp"
+#include "time.hpp"
+
+/** put the slots from 'from' up to the capacity on the free list
+*/
+static void freeSlots(SlotMap *map, int from) {
+    for (int index = map->capacity-1; index >= from; index--) {
+        map->slots[index].used = false;
+        map->slots[index].data = NULL;
+        map->slots[index].nextFree = map->freeHead;
+        map->freeHead = index;
+    }
+}
+
+void initSlotMap(SlotMap *map, int capacity, bool createmutex) {
+    if (capacity < 1)
+        capacity = 1;
+    map->slots = (Slot*)malloc(sizeof(Slot)*capacity);
+    if (!map->slots) {
+        perror("Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    memset(map->slots, 0, sizeof(Slot)*capacity);
+    map->capacity = capacity;
+    map->count = 0;
+    map->freeHead = -1;
+    freeSlots(map, 0);
+    if (createmutex) {
+        pthread_mutex_init(&map->mutex, NULL);
+        map->bmutex = true;
+    } else {
+        map->bmutex = false;
+    }
+}
+
+void cleanupSlotMap(SlotMap *map) {
+    free(map->slots);
+    map->slots = NULL;
+    map->capacity = 0;
+    map->count = 0;
+    map->freeHead = -1;
+    if (map->bmutex)
+        pthread_mutex_destroy(&map->mutex);
+}
+
+long long slotMapInsert(SlotMap *map, void *data, bool lock) {
+    if (lock)
+        lockSlotMap(map);
+
+    if (map->freeHead == -1) {
+        int capacity = map->capacity;
+        if (capacity*2 > SLOTMAP_INDEX_MASK+1) {
+            if (lock)
+                unlockSlotMap(map);
+            return -1;
+        }
+        Slot *slots = (Slot*)realloc(map->slots, sizeof(Slot)*capacity*2);
+        if (!slots) {
+            perror("Memory allocation failed");
+            exit(EXIT_FAILURE);
+        }
+        memset(slots+capacity, 0, sizeof(Slot)*capacity);
+        map->slots = slots;
+        map->capacity = capacity*2;
+        freeSlots(map, capacity);
+    }
+
+    int index = map->freeHead;
+    Slot *slot = &map->slots[index];
+    map->freeHead = slot->nextFree;
+    slot->used = true;
+    slot->nextFree = -1;
+    slot->timestamp_ms = getCurrentTimeMillis();
+    slot->data = data;
+    map->count++;
+    long long handle = slotMapHandle(map, index);
+
+    if (lock)
+        unlockSlotMap(map);
+    return handle;
+}
+
+/** the slot the handle points to, if it is still the entry the handle was given for
+*/
+static Slot *slotByHandle(SlotMap *map, long long handle) {
+    if (handle < 0)
+        return NULL;
+    long long index = handle & SLOTMAP_INDEX_MASK;
+    if (index >= map->capacity)
+        return NULL;
+    Slot *slot = &map->slots[index];
+    if (!slot->used || slot->generation != (unsigned int)(handle >> SLOTMAP_INDEX_BITS))
+        return NULL;
+    return slot;
+}
+
+void *slotMapGet(SlotMap *map, long long handle, bool lock) {
+    if (lock)
+        lockSlotMap(map);
+    Slot *slot = slotByHandle(map, handle);
+    void *data = slot ? slot->data : NULL;
+    if (lock)
+        unlockSlotMap(map);
+    return data;
+}
+
+void *slotMapRemove(SlotMap *map, long long handle, bool lock) {
+    if (lock)
+        lockSlotMap(map);
+
+    void *data = NULL;
+    Slot *slot = slotByHandle(map, handle);
+    if (slot) {
+        data = slot->data;
+        slot->used = false;
+        slot->data = NULL;
+        slot->generation = (slot->generation+1) & SLOTMAP_GENERATION_MASK;
+        slot->nextFree = map->freeHead;
+        map->freeHead = (int)(slot-map->slots);
+        map->count--;
+    }
+
+    if (lock)
+        unlockSlotMap(map);
+    return data;
+}
+
+Slot *slotMapAt(SlotMap *map, int index) {
+    if (index < 0 || index >= map->capacity || !map->slots[index].used)
+        return NULL;
+    return &map->slots[index];
+}
+
+long long slotMapHandle(SlotMap *map, int index) {
+    return ((long long)map->slots[index].generation << SLOTMAP_INDEX_BITS) | index;
+}
+
+int slotMapCount(SlotMap *map, bool lock) {
+    if (lock)
+        lockSlotMap(map);
+    int count = map->count;
+    if (lock)
+        unlockSlotMap(map);
+    return count;
+}
+
+void lockSlotMap(SlotMap *map) {
+    pthread_mutex_lock(&map->mutex);
+}
+
+void unlockSlotMap(SlotMap *map) {
+    pthread_mutex_unlock(&map->mutex);
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) [2023] Milan Kazarka
+ * Email: milan.kazarka.office@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SLOTMAP_HPP__
+#define __SLOTMAP_HPP__
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#define SLOTMAP_USEMUTEX true
+#define SLOTMAP_NOMUTEX false
+
+// a handle is the slot index & the generation of the slot at the time of the insert, so that a handle
+// of a removed entry doesn't match the next entry stored in the same slot
+#define SLOTMAP_INDEX_BITS 24
+#define SLOTMAP_INDEX_MASK ((1LL<<SLOTMAP_INDEX_BITS)-1)
+#define SLOTMAP_GENERATION_MASK ((1U<<24)-1) // handles stay below 2^48
+
+typedef struct Slot {
+    unsigned int generation;
+    bool used;
+    int nextFree; // next slot on the free list, -1 at the end
+    long long timestamp_ms; // time of the insert
+    void *data;
+} Slot;
+
+typedef struct SlotMap {
+    Slot *slots;
+    int capacity; // grows by doubling when all slots are used
+    int count;
+    int freeHead;
+    bool bmutex;
+    pthread_mutex_t mutex;
+} SlotMap;
+
+void initSlotMap(SlotMap *map, int capacity, bool createmutex);
+void cleanupSlotMap(SlotMap *map); // doesn't free the data
+long long slotMapInsert(SlotMap *map, void *data, bool lock); // returns the handle
+void *slotMapGet(SlotMap *map, long long handle, bool lock); // NULL if the handle is stale
+void *slotMapRemove(SlotMap *map, long long handle, bool lock); // returns the data, NULL if the handle is stale
+Slot *slotMapAt(SlotMap *map, int index); // NULL if the slot isn't used, for walking all slots up to capacity
+long long slotMapHandle(SlotMap *map, int index);
+int slotMapCount(SlotMap *map, bool lock);
+void lockSlotMap(SlotMap *map);
+void unlockSlotMap(SlotMap *map);
+
+#endif
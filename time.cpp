@@ -23,3 +23,15 @@ long long getCurrentTimeMillis() {
     gettimeofday(&tv, NULL);
     return (long long)tv.tv_sec * 1000 + (long long)tv.tv_usec / 1000;
 }
+
+long long getMonotonicMillis() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + (long long)ts.tv_nsec / 1000000;
+}
+
+long long getMonotonicMicros() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + (long long)ts.tv_nsec / 1000;
+}
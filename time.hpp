@@ -23,5 +23,7 @@
 #include <sys/time.h>
 
 long long getCurrentTimeMillis();
+long long getMonotonicMillis(); // for deadlines, doesn't jump with the wall clock
+long long getMonotonicMicros(); // same, for round trip times & pacing
 
 #endif
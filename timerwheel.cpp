@@ -0,0 +1,240 @@
+/*
+ * Copyright (C) [2023] Milan Kazarka
+ * Email: milan.kazarka.office@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "timerwheel.hpp"
+#include "time.hpp"
+
+#ifdef __linux__
+#include <sys/timerfd.h>
+#endif
+
+static void lockTimerWheel(TimerWheel *wheel) {
+    if (wheel->bmutex)
+        pthread_mutex_lock(&wheel->mutex);
+}
+
+static void unlockTimerWheel(TimerWheel *wheel) {
+    if (wheel->bmutex)
+        pthread_mutex_unlock(&wheel->mutex);
+}
+
+static unsigned long long currentTick(TimerWheel *wheel) {
+    return (unsigned long long)(getMonotonicMillis()-wheel->startMs)/wheel->tickMs;
+}
+
+bool initTimerWheel(TimerWheel *wheel, int tickMs, bool createmutex) {
+    for (int level = 0; level < TIMERWHEEL_LEVELS; level++) {
+        for (int slot = 0; slot < TIMERWHEEL_SLOTS; slot++) {
+            wheel->slots[level][slot].next = &wheel->slots[level][slot];
+            wheel->slots[level][slot].prev = &wheel->slots[level][slot];
+        }
+    }
+    wheel->tickMs = tickMs > 0 ? tickMs : 1;
+    wheel->startMs = getMonotonicMillis();
+    wheel->tick = 0;
+    wheel->count = 0;
+    wheel->armedTick = 0;
+    wheel->timerFd = -1;
+#ifdef __linux__
+    wheel->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (wheel->timerFd == -1)
+        perror("timerfd_create");
+#endif
+    if (createmutex) {
+        pthread_mutex_init(&wheel->mutex, NULL);
+        wheel->bmutex = true;
+    } else {
+        wheel->bmutex = false;
+    }
+    return true;
+}
+
+void cleanupTimerWheel(TimerWheel *wheel) {
+    if (wheel->timerFd != -1)
+        close(wheel->timerFd);
+    wheel->timerFd = -1;
+    if (wheel->bmutex)
+        pthread_mutex_destroy(&wheel->mutex);
+}
+
+void initTimer(Timer *timer, void (*callback)(Timer *timer), void *data) {
+    timer->expires = 0;
+    timer->callback = callback;
+    timer->data = data;
+    timer->next = NULL;
+    timer->prev = NULL;
+}
+
+bool timerArmed(Timer *timer) {
+    return timer->next != NULL;
+}
+
+static void unlinkTimer(TimerWheel *wheel, Timer *timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = NULL;
+    timer->prev = NULL;
+    wheel->count--;
+}
+
+/** put the timer on the slot of the level its distance from the current tick falls into
+*/
+static void linkTimer(TimerWheel *wheel, Timer *timer) {
+    unsigned long long delta = timer->expires > wheel->tick ? timer->expires-wheel->tick : 0;
+    unsigned long long expires = wheel->tick+delta;
+    int level = 0;
+    while (level < TIMERWHEEL_LEVELS-1 && delta >= (1ULL << (TIMERWHEEL_BITS*(level+1))))
+        level++;
+    if (delta >= (1ULL << (TIMERWHEEL_BITS*TIMERWHEEL_LEVELS)))
+        expires = wheel->tick+(1ULL << (TIMERWHEEL_BITS*TIMERWHEEL_LEVELS))-1; // cascades down again later
+    Timer *head = &wheel->slots[level][(expires >> (TIMERWHEEL_BITS*level)) & TIMERWHEEL_MASK];
+    timer->next = head;
+    timer->prev = head->prev;
+    head->prev->next = timer;
+    head->prev = timer;
+    wheel->count++;
+}
+
+/** ticks from the next one to run until something has to be done, a timer on level 0 expires or the
+* slots of the higher levels have to be cascaded down
+*/
+static unsigned long long nextTicks(TimerWheel *wheel) {
+    for (unsigned long long n = 0; n < TIMERWHEEL_SLOTS; n++) {
+        unsigned long long tick = wheel->tick+n;
+        Timer *head = &wheel->slots[0][tick & TIMERWHEEL_MASK];
+        if (head->next != head || (tick & TIMERWHEEL_MASK) == 0)
+            return n;
+    }
+    return TIMERWHEEL_SLOTS;
+}
+
+/** make the timerfd readable when the wheel needs to run next, expects the wheel to be locked
+*/
+static void armTimerFd(TimerWheel *wheel) {
+#ifdef __linux__
+    if (wheel->timerFd == -1)
+        return;
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if (wheel->count > 0) {
+        wheel->armedTick = wheel->tick+nextTicks(wheel);
+        long long ms = wheel->startMs+(long long)wheel->armedTick*wheel->tickMs-getMonotonicMillis();
+        if (ms < 1)
+            ms = 1; // a zero it_value would disarm it
+        spec.it_value.tv_sec = ms/1000;
+        spec.it_value.tv_nsec = (ms%1000)*1000000;
+    } else {
+        wheel->armedTick = 0;
+    }
+    timerfd_settime(wheel->timerFd, 0, &spec, NULL);
+#endif
+}
+
+void addTimer(TimerWheel *wheel, Timer *timer, long long delayMs) {
+    lockTimerWheel(wheel);
+    if (timerArmed(timer))
+        unlinkTimer(wheel, timer);
+    if (delayMs < 0)
+        delayMs = 0;
+    // at least one full tick, the current one may be almost over
+    timer->expires = currentTick(wheel)+(delayMs+wheel->tickMs-1)/wheel->tickMs+1;
+    linkTimer(wheel, timer);
+    if (wheel->armedTick == 0 || timer->expires < wheel->armedTick)
+        armTimerFd(wheel);
+    unlockTimerWheel(wheel);
+}
+
+bool cancelTimer(TimerWheel *wheel, Timer *timer) {
+    lockTimerWheel(wheel);
+    bool armed = timerArmed(timer);
+    if (armed)
+        unlinkTimer(wheel, timer);
+    unlockTimerWheel(wheel);
+    return armed;
+}
+
+int runTimers(TimerWheel *wheel) {
+#ifdef __linux__
+    if (wheel->timerFd != -1) {
+        unsigned long long expirations;
+        read(wheel->timerFd, &expirations, sizeof(expirations));
+    }
+#endif
+    lockTimerWheel(wheel);
+
+    // collect the expired timers first, the callbacks run without the wheel locked
+    Timer expired;
+    expired.next = &expired;
+    expired.prev = &expired;
+
+    // tick is the next one to run
+    unsigned long long now = currentTick(wheel);
+    if (wheel->count == 0 && wheel->tick <= now)
+        wheel->tick = now+1; // nothing to cascade
+    while (wheel->tick <= now) {
+        for (int level = 1; level < TIMERWHEEL_LEVELS; level++) {
+            if (wheel->tick & ((1ULL << (TIMERWHEEL_BITS*level))-1))
+                break;
+            Timer *head = &wheel->slots[level][(wheel->tick >> (TIMERWHEEL_BITS*level)) & TIMERWHEEL_MASK];
+            while (head->next != head) {
+                Timer *timer = head->next;
+                unlinkTimer(wheel, timer);
+                linkTimer(wheel, timer);
+            }
+        }
+        Timer *head = &wheel->slots[0][wheel->tick & TIMERWHEEL_MASK];
+        while (head->next != head) {
+            Timer *timer = head->next;
+            unlinkTimer(wheel, timer);
+            wheel->count++; // until its callback runs, it can still be cancelled meanwhile
+            timer->next = &expired;
+            timer->prev = expired.prev;
+            expired.prev->next = timer;
+            expired.prev = timer;
+        }
+        wheel->tick++;
+    }
+
+    int count = 0;
+    while (expired.next != &expired) {
+        Timer *timer = expired.next;
+        unlinkTimer(wheel, timer);
+        unlockTimerWheel(wheel);
+        timer->callback(timer);
+        lockTimerWheel(wheel);
+        count++;
+    }
+
+    armTimerFd(wheel);
+    unlockTimerWheel(wheel);
+    return count;
+}
+
+int timerWheelTimeout(TimerWheel *wheel) {
+    lockTimerWheel(wheel);
+    int timeout = -1;
+    if (wheel->count > 0) {
+        long long ms = wheel->startMs+(long long)(wheel->tick+nextTicks(wheel))*wheel->tickMs-getMonotonicMillis();
+        timeout = ms > 0 ? (int)ms : 0;
+    }
+    unlockTimerWheel(wheel);
+    return timeout;
+}
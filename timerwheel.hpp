@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) [2023] Milan Kazarka
+ * Email: milan.kazarka.office@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TIMERWHEEL_HPP__
+#define __TIMERWHEEL_HPP__
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#define TIMERWHEEL_USEMUTEX true
+#define TIMERWHEEL_NOMUTEX false
+
+// 4 levels of 64 slots, with 10ms ticks level 0 covers 640ms, level 1 41s, level 2 44min & level 3 46h.
+// Timers further out are put on the last slot of level 3 and cascade down from there.
+#define TIMERWHEEL_BITS 6
+#define TIMERWHEEL_SLOTS (1<<TIMERWHEEL_BITS)
+#define TIMERWHEEL_MASK (TIMERWHEEL_SLOTS-1)
+#define TIMERWHEEL_LEVELS 4
+
+typedef struct Timer {
+    unsigned long long expires; // tick
+    void (*callback)(struct Timer *timer); // called once the timer expires, it may be added again from there
+    void *data;
+    struct Timer *next; // slot list, the timer isn't armed when next is NULL
+    struct Timer *prev;
+} Timer;
+
+typedef struct TimerWheel {
+    Timer slots[TIMERWHEEL_LEVELS][TIMERWHEEL_SLOTS]; // list heads
+    unsigned long long tick; // ticks that have been run
+    long long startMs; // monotonic time of tick 0
+    int tickMs;
+    int count; // armed timers
+    int timerFd; // timerfd (CLOCK_MONOTONIC) readable once a timer is due, -1 where it's not available
+    unsigned long long armedTick; // the timerfd fires at this tick, 0 when it is disarmed
+    bool bmutex;
+    pthread_mutex_t mutex;
+} TimerWheel;
+
+bool initTimerWheel(TimerWheel *wheel, int tickMs, bool createmutex);
+void cleanupTimerWheel(TimerWheel *wheel);
+void initTimer(Timer *timer, void (*callback)(Timer *timer), void *data);
+void addTimer(TimerWheel *wheel, Timer *timer, long long delayMs); // (re)arms the timer
+bool cancelTimer(TimerWheel *wheel, Timer *timer); // false if it wasn't armed, its callback may be running right now
+bool timerArmed(Timer *timer);
+int runTimers(TimerWheel *wheel); // calls the callbacks of the expired timers, returns how many expired
+int timerWheelTimeout(TimerWheel *wheel); // ms until the next timer is due, -1 when there's none
+
+#endif
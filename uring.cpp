@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) [2023] Milan Kazarka
+ * Email: milan.kazarka.office@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "uring.hpp"
+
+#ifdef HAVE_URING
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+static int uringSetup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+static int uringRegister(int fd, unsigned opcode, void *arg, unsigned nrArgs) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+}
+
+bool initUring(Uring *ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(Uring));
+
+    ring->fd = uringSetup(entries, &params);
+    if (ring->fd < 0) {
+        perror("io_uring_setup");
+        return false;
+    }
+
+    ring->sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cqSize > ring->sqSize)
+            ring->sqSize = ring->cqSize;
+        ring->cqSize = ring->sqSize;
+    }
+
+    ring->sqPtr = mmap(NULL, ring->sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sqPtr == MAP_FAILED) {
+        perror("mmap");
+        close(ring->fd);
+        return false;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cqPtr = ring->sqPtr;
+    } else {
+        ring->cqPtr = mmap(NULL, ring->cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cqPtr == MAP_FAILED) {
+            perror("mmap");
+            munmap(ring->sqPtr, ring->sqSize);
+            close(ring->fd);
+            return false;
+        }
+    }
+
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        perror("mmap");
+        cleanupUring(ring);
+        return false;
+    }
+
+    char *sq = (char*)ring->sqPtr;
+    ring->sqHead = (unsigned*)(sq + params.sq_off.head);
+    ring->sqTail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned*)(sq + params.sq_off.array);
+    ring->sqTailLocal = *ring->sqTail;
+
+    char *cq = (char*)ring->cqPtr;
+    ring->cqHead = (unsigned*)(cq + params.cq_off.head);
+    ring->cqTail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    return true;
+}
+
+void cleanupUring(Uring *ring) {
+    if (ring->sqes && ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqesSize);
+    if (ring->cqPtr && ring->cqPtr != ring->sqPtr)
+        munmap(ring->cqPtr, ring->cqSize);
+    if (ring->sqPtr)
+        munmap(ring->sqPtr, ring->sqSize);
+    if (ring->fd >= 0)
+        close(ring->fd);
+    memset(ring, 0, sizeof(Uring));
+    ring->fd = -1;
+}
+
+struct io_uring_sqe *uringGetSqe(Uring *ring) {
+    unsigned head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+    unsigned entries = *ring->sqMask + 1;
+    if (ring->sqTailLocal - head >= entries) {
+        // full - hand what we have over to the kernel & try again
+        uringSubmit(ring, 0);
+        head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+        if (ring->sqTailLocal - head >= entries)
+            return NULL;
+    }
+    unsigned index = ring->sqTailLocal & *ring->sqMask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sqArray[index] = index;
+    ring->sqTailLocal++;
+    return sqe;
+}
+
+unsigned uringSqSpace(Uring *ring) {
+    unsigned head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+    return *ring->sqMask + 1 - (ring->sqTailLocal - head);
+}
+
+/** submit the queued entries & optionally wait for waitNr completions
+*/
+int uringSubmit(Uring *ring, unsigned waitNr) {
+    unsigned toSubmit = ring->sqTailLocal - *ring->sqTail;
+    __atomic_store_n(ring->sqTail, ring->sqTailLocal, __ATOMIC_RELEASE);
+    unsigned flags = waitNr ? IORING_ENTER_GETEVENTS : 0;
+    if (!toSubmit && !waitNr)
+        return 0;
+    return uringEnter(ring->fd, toSubmit, waitNr, flags);
+}
+
+struct io_uring_cqe *uringPeekCqe(Uring *ring) {
+    unsigned head = *ring->cqHead;
+    if (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &ring->cqes[head & *ring->cqMask];
+}
+
+void uringSeenCqe(Uring *ring) {
+    __atomic_store_n(ring->cqHead, *ring->cqHead + 1, __ATOMIC_RELEASE);
+}
+
+bool initUringBufRing(Uring *ring, UringBufRing *bufRing, unsigned short bgid, unsigned nbuffers, unsigned bufferSize) {
+    bufRing->ringSize = nbuffers * sizeof(struct io_uring_buf);
+    bufRing->ring = (struct io_uring_buf_ring*)mmap(NULL, bufRing->ringSize, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (bufRing->ring == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+    bufRing->buffers = (char*)malloc((size_t)nbuffers * bufferSize);
+    bufRing->nbuffers = nbuffers;
+    bufRing->bufferSize = bufferSize;
+    bufRing->bgid = bgid;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)bufRing->ring;
+    reg.ring_entries = nbuffers;
+    reg.bgid = bgid;
+    if (uringRegister(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        perror("io_uring_register(PBUF_RING)");
+        munmap(bufRing->ring, bufRing->ringSize);
+        free(bufRing->buffers);
+        return false;
+    }
+
+    bufRing->ring->tail = 0;
+    for (unsigned n = 0; n < nbuffers; n++)
+        uringRecycleBuffer(bufRing, (unsigned short)n);
+    return true;
+}
+
+char *uringBuffer(UringBufRing *bufRing, unsigned short bid) {
+    return bufRing->buffers + (size_t)bid * bufRing->bufferSize;
+}
+
+/** give a provided buffer back to the kernel once we're done with its contents
+*/
+void uringRecycleBuffer(UringBufRing *bufRing, unsigned short bid) {
+    unsigned short tail = bufRing->ring->tail;
+    // not ring->bufs, __DECLARE_FLEX_ARRAY doesn't put it at offset 0 when compiled as C++
+    struct io_uring_buf *buf = (struct io_uring_buf*)bufRing->ring + (tail & (bufRing->nbuffers - 1));
+    buf->addr = (unsigned long)uringBuffer(bufRing, bid);
+    buf->len = bufRing->bufferSize;
+    buf->bid = bid;
+    __atomic_store_n(&bufRing->ring->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+}
+
+#endif
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) [2023] Milan Kazarka
+ * Email: milan.kazarka.office@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __URING_HPP__
+#define __URING_HPP__
+
+// minimal io_uring ring management on top of the raw syscalls (no liburing dependency)
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#define HAVE_URING
+#endif
+
+#include <stdlib.h>
+
+#ifdef HAVE_URING
+
+typedef struct Uring {
+    int fd;
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned *sqMask;
+    unsigned *sqArray;
+    struct io_uring_sqe *sqes;
+    unsigned sqTailLocal; // tail of queued but not yet submitted entries
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned *cqMask;
+    struct io_uring_cqe *cqes;
+    void *sqPtr;
+    size_t sqSize;
+    void *cqPtr;
+    size_t cqSize;
+    size_t sqesSize;
+} Uring;
+
+// provided buffers the kernel picks from for IOSQE_BUFFER_SELECT receives
+typedef struct UringBufRing {
+    struct io_uring_buf_ring *ring;
+    size_t ringSize;
+    char *buffers;
+    unsigned nbuffers; // power of 2
+    unsigned bufferSize;
+    unsigned short bgid;
+} UringBufRing;
+
+bool initUring(Uring *ring, unsigned entries);
+void cleanupUring(Uring *ring);
+struct io_uring_sqe *uringGetSqe(Uring *ring); // submits queued entries when the queue is full
+unsigned uringSqSpace(Uring *ring);
+int uringSubmit(Uring *ring, unsigned waitNr);
+struct io_uring_cqe *uringPeekCqe(Uring *ring);
+void uringSeenCqe(Uring *ring);
+
+bool initUringBufRing(Uring *ring, UringBufRing *bufRing, unsigned short bgid, unsigned nbuffers, unsigned bufferSize);
+char *uringBuffer(UringBufRing *bufRing, unsigned short bid);
+void uringRecycleBuffer(UringBufRing *bufRing, unsigned short bid);
+
+#endif
+
+#endif
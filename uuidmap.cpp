@@ -0,0 +1,211 @@
+/*
+ * Copyright (C) [2023] Milan Kazarka
+ * Email: milan.kazarka.office@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "uuidmap.hpp"
+
+static int hexValue(char c) {
+    if (c >= '0' && c <= '9')
+        return c-'0';
+    if (c >= 'a' && c <= 'f')
+        return c-'a'+10;
+    if (c >= 'A' && c <= 'F')
+        return c-'A'+10;
+    return -1;
+}
+
+bool parseUuid(const char *text, Uuid *uuid) {
+    if (!text || strnlen(text, 37) != 36)
+        return false;
+    return parseUuidLen(text, 36, uuid);
+}
+
+bool parseUuidLen(const char *text, size_t len, Uuid *uuid) {
+    if (!text || len != 36)
+        return false;
+    uint64_t halves[2] = {0, 0};
+    int digits = 0;
+    for (int n = 0; n < 36; n++) {
+        if (n == 8 || n == 13 || n == 18 || n == 23) {
+            if (text[n] != '-')
+                return false;
+            continue;
+        }
+        int value = hexValue(text[n]);
+        if (value < 0)
+            return false;
+        halves[digits/16] = (halves[digits/16] << 4) | value;
+        digits++;
+    }
+    uuid->hi = halves[0];
+    uuid->lo = halves[1];
+    return true;
+}
+
+bool uuidEqual(const Uuid *a, const Uuid *b) {
+    return a->hi == b->hi && a->lo == b->lo;
+}
+
+/** UUIDs are mostly random already, mixing still keeps sequential or hand written ones from clustering
+*/
+static unsigned int uuidHash(const Uuid *key) {
+    uint64_t h = key->hi ^ (key->lo * 0x9e3779b97f4a7c15ULL);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (unsigned int)h;
+}
+
+void initUuidMap(UuidMap *map, int capacity, bool createmutex) {
+    int n = 8;
+    while (n < capacity*4/3+1)
+        n *= 2;
+    map->entries = (UuidEntry*)calloc(n, sizeof(UuidEntry));
+    if (!map->entries) {
+        perror("Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    map->capacity = n;
+    map->count = 0;
+    if (createmutex) {
+        pthread_mutex_init(&map->mutex, NULL);
+        map->bmutex = true;
+    } else {
+        map->bmutex = false;
+    }
+}
+
+void cleanupUuidMap(UuidMap *map) {
+    free(map->entries);
+    map->entries = NULL;
+    map->capacity = 0;
+    map->count = 0;
+    if (map->bmutex)
+        pthread_mutex_destroy(&map->mutex);
+}
+
+void lockUuidMap(UuidMap *map) {
+    if (map->bmutex)
+        pthread_mutex_lock(&map->mutex);
+}
+
+void unlockUuidMap(UuidMap *map) {
+    if (map->bmutex)
+        pthread_mutex_unlock(&map->mutex);
+}
+
+/** the entry holding key, or the free entry where it would go
+*/
+static UuidEntry *findEntry(UuidEntry *entries, int capacity, const Uuid *key) {
+    unsigned int mask = capacity-1;
+    unsigned int index = uuidHash(key) & mask;
+    while (entries[index].value && !uuidEqual(&entries[index].key, key))
+        index = (index+1) & mask;
+    return &entries[index];
+}
+
+static void growUuidMap(UuidMap *map) {
+    int capacity = map->capacity*2;
+    UuidEntry *entries = (UuidEntry*)calloc(capacity, sizeof(UuidEntry));
+    if (!entries) {
+        perror("Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    for (int index = 0; index < map->capacity; index++) {
+        if (map->entries[index].value)
+            *findEntry(entries, capacity, &map->entries[index].key) = map->entries[index];
+    }
+    free(map->entries);
+    map->entries = entries;
+    map->capacity = capacity;
+}
+
+void uuidMapPut(UuidMap *map, const Uuid *key, void *value, bool lock) {
+    if (lock)
+        lockUuidMap(map);
+    if ((map->count+1)*4 > map->capacity*3)
+        growUuidMap(map);
+    UuidEntry *entry = findEntry(map->entries, map->capacity, key);
+    if (!entry->value)
+        map->count++;
+    entry->key = *key;
+    entry->value = value;
+    if (lock)
+        unlockUuidMap(map);
+}
+
+void *uuidMapGet(UuidMap *map, const Uuid *key, bool lock) {
+    if (lock)
+        lockUuidMap(map);
+    void *value = findEntry(map->entries, map->capacity, key)->value;
+    if (lock)
+        unlockUuidMap(map);
+    return value;
+}
+
+void *uuidMapGetText(UuidMap *map, const char *key, bool lock) {
+    Uuid uuid;
+    if (!parseUuid(key, &uuid))
+        return NULL;
+    return uuidMapGet(map, &uuid, lock);
+}
+
+void *uuidMapRemove(UuidMap *map, const Uuid *key, bool lock) {
+    if (lock)
+        lockUuidMap(map);
+    UuidEntry *entry = findEntry(map->entries, map->capacity, key);
+    void *value = entry->value;
+    if (value) {
+        // move entries of the same probe sequence into the hole so lookups don't stop early
+        unsigned int mask = map->capacity-1;
+        unsigned int hole = entry-map->entries;
+        unsigned int index = hole;
+        while (1) {
+            index = (index+1) & mask;
+            if (!map->entries[index].value)
+                break;
+            unsigned int home = uuidHash(&map->entries[index].key) & mask;
+            // the entry can move back if its home isn't cyclically within (hole, index]
+            if (((index-home) & mask) >= ((index-hole) & mask)) {
+                map->entries[hole] = map->entries[index];
+                hole = index;
+            }
+        }
+        map->entries[hole].value = NULL;
+        map->count--;
+    }
+    if (lock)
+        unlockUuidMap(map);
+    return value;
+}
+
+void *uuidMapAt(UuidMap *map, int index) {
+    if (index < 0 || index >= map->capacity)
+        return NULL;
+    return map->entries[index].value;
+}
+
+int uuidMapCount(UuidMap *map, bool lock) {
+    if (lock)
+        lockUuidMap(map);
+    int count = map->count;
+    if (lock)
+        unlockUuidMap(map);
+    return count;
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) [2023] Milan Kazarka
+ * Email: milan.kazarka.office@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __UUIDMAP_HPP__
+#define __UUIDMAP_HPP__
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define UUIDMAP_USEMUTEX true
+#define UUIDMAP_NOMUTEX false
+
+// a UUID in binary, parsed once from its 36 character text form
+typedef struct Uuid {
+    uint64_t hi;
+    uint64_t lo;
+} Uuid;
+
+typedef struct UuidEntry {
+    Uuid key;
+    void *value; // NULL for a free entry
+} UuidEntry;
+
+// open addressing with linear probing, removal shifts the following entries back so there are no tombstones
+typedef struct UuidMap {
+    UuidEntry *entries;
+    int capacity; // power of 2, doubles once the map is 3/4 full
+    int count;
+    bool bmutex;
+    pthread_mutex_t mutex;
+} UuidMap;
+
+bool parseUuid(const char *text, Uuid *uuid); // 8-4-4-4-12 hex digits, false if text is anything else
+bool parseUuidLen(const char *text, size_t len, Uuid *uuid); // same, for text that isn't terminated
+bool uuidEqual(const Uuid *a, const Uuid *b);
+
+void initUuidMap(UuidMap *map, int capacity, bool createmutex);
+void cleanupUuidMap(UuidMap *map); // doesn't free the values
+void uuidMapPut(UuidMap *map, const Uuid *key, void *value, bool lock); // replaces the value of an existing key
+void *uuidMapGet(UuidMap *map, const Uuid *key, bool lock); // NULL if the key isn't in the map
+void *uuidMapGetText(UuidMap *map, const char *key, bool lock); // same, parses the key first
+void *uuidMapRemove(UuidMap *map, const Uuid *key, bool lock); // returns the value
+void *uuidMapAt(UuidMap *map, int index); // NULL if the entry is free, for walking all entries up to capacity
+int uuidMapCount(UuidMap *map, bool lock);
+void lockUuidMap(UuidMap *map);
+void unlockUuidMap(UuidMap *map);
+
+#endif
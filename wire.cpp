@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) [2023] Milan Kazarka
+ * Email: milan.kazarka.office@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "wire.hpp"
+
+bool isWireFrame(const char *data, size_t len) {
+    return data && len > 0 && (unsigned char)data[0] == WIRE_MAGIC;
+}
+
+void writeWireHeader(char *out, unsigned char kind, unsigned char flags, unsigned int part, long long requestId, const Uuid *pipe,
+    const Uuid *service, size_t len) {
+    WIRE_HEADER header;
+    memset(&header, 0, sizeof(header));
+    header.magic = WIRE_MAGIC;
+    header.version = WIRE_VERSION;
+    header.kind = kind;
+    header.flags = flags;
+    header.part = part;
+    header.requestId = requestId;
+    header.pipe = *pipe;
+    header.service = *service;
+    header.length = (unsigned int)len;
+    memcpy(out, &header, sizeof(header));
+}
+
+char *wireFrame(unsigned char kind, unsigned char flags, unsigned int part, long long requestId, const Uuid *pipe, const Uuid *service,
+    const char *payload, size_t len, size_t *size) {
+    // terminated, so that it can still be printed as far as it goes
+    char *frame = (char*)malloc(sizeof(WIRE_HEADER)+len+1);
+    if (!frame)
+        return NULL;
+    writeWireHeader(frame, kind, flags, part, requestId, pipe, service, len);
+    if (len > 0)
+        memcpy(frame+sizeof(WIRE_HEADER), payload, len);
+    frame[sizeof(WIRE_HEADER)+len] = 0x00;
+    *size = sizeof(WIRE_HEADER)+len;
+    return frame;
+}
+
+bool parseWireHeader(const char *data, size_t len, WIRE_HEADER *header) {
+    if (!isWireFrame(data, len) || len < sizeof(WIRE_HEADER))
+        return false;
+    // the frame starts wherever the reassembly put it, no alignment to rely on
+    memcpy(header, data, sizeof(WIRE_HEADER));
+    return header->version == WIRE_VERSION;
+}
+
+bool parseWireFrame(const char *data, size_t len, WIRE_HEADER *header, const char **payload) {
+    if (!parseWireHeader(data, len, header) || header->length > len-sizeof(WIRE_HEADER))
+        return false;
+    *payload = data+sizeof(WIRE_HEADER);
+    return true;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) [2023] Milan Kazarka
+ * Email: milan.kazarka.office@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __WIRE_HPP__
+#define __WIRE_HPP__
+
+#include <stdlib.h>
+#include "uuidmap.hpp"
+
+/** the binary framing of requests & responses, the alternative to the XML envelope with a base64 payload.
+* The SP offers it with <wire>binary</wire> when it asks for a pipe & the SC answers the same if it
+* takes it, from then on the requests & responses of that pipe are frames. Registrations & the pipe
+* handshake itself stay XML.
+*
+* A frame is the header followed by length bytes of raw payload. The fields are in host byte order, same
+* as the gram header.
+*/
+
+#define WIRE_MAGIC 0xEB // first byte of a frame, an XML envelope starts with '<'
+#define WIRE_VERSION 1
+#define WIRE_BINARY "binary" // what <wire> says to negotiate the frames
+
+#define WIRE_KIND_REQUEST 1
+#define WIRE_KIND_RESPONSE 2
+
+#define WIRE_FLAG_PART 1 // a request forwarded in parts, see part
+#define WIRE_FLAG_MORE 2 // not the last part
+
+typedef struct WIRE_HEADER {
+    unsigned char magic;
+    unsigned char version;
+    unsigned char kind;
+    unsigned char flags;
+    unsigned int part; // of a request forwarded in parts, numbered from 0
+    long long requestId;
+    Uuid pipe;
+    Uuid service;
+    unsigned int length; // of the payload
+    unsigned int reserved;
+} WIRE_HEADER;
+
+bool isWireFrame(const char *data, size_t len); // tells a frame from an XML envelope
+char *wireFrame(unsigned char kind, unsigned char flags, unsigned int part, long long requestId, const Uuid *pipe, const Uuid *service,
+    const char *payload, size_t len, size_t *size); // header & payload in one allocation, free upstream
+void writeWireHeader(char *out, unsigned char kind, unsigned char flags, unsigned int part, long long requestId, const Uuid *pipe,
+    const Uuid *service, size_t len); // the first sizeof(WIRE_HEADER) bytes of a frame, for a payload already in place behind it
+bool parseWireHeader(const char *data, size_t len, WIRE_HEADER *header); // the payload may still be arriving
+bool parseWireFrame(const char *data, size_t len, WIRE_HEADER *header, const char **payload); // false if it isn't a whole frame we understand
+
+#endif